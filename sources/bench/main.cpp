@@ -0,0 +1,77 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace djup
+{
+    namespace bench
+    {
+        int Bench(int i_argc, const char * const * i_argv);
+
+        std::atomic<uint64_t> & AllocationCounter();
+    }
+}
+
+/* The global allocation functions are replaced to count the heap allocations of
+   every benchmark. The other forms of operator new and delete call these ones. */
+
+void * operator new(std::size_t i_size)
+{
+    djup::bench::AllocationCounter().fetch_add(1, std::memory_order_relaxed);
+    if (void * const block = std::malloc(i_size != 0 ? i_size : 1))
+        return block;
+    throw std::bad_alloc();
+}
+
+void * operator new(std::size_t i_size, std::align_val_t i_alignment)
+{
+    djup::bench::AllocationCounter().fetch_add(1, std::memory_order_relaxed);
+    const std::size_t alignment = static_cast<std::size_t>(i_alignment);
+    #ifdef _MSC_VER
+        void * const block = _aligned_malloc(i_size != 0 ? i_size : 1, alignment);
+    #else
+        // the size passed to aligned_alloc must be a multiple of the alignment
+        const std::size_t size = i_size != 0 ? (i_size + alignment - 1) / alignment * alignment : alignment;
+        void * const block = std::aligned_alloc(alignment, size);
+    #endif
+    if (block != nullptr)
+        return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void * i_block) noexcept
+{
+    std::free(i_block);
+}
+
+void operator delete(void * i_block, std::align_val_t) noexcept
+{
+    #ifdef _MSC_VER
+        _aligned_free(i_block);
+    #else
+        std::free(i_block);
+    #endif
+}
+
+void operator delete(void * i_block, std::size_t) noexcept
+{
+    operator delete(i_block);
+}
+
+void operator delete(void * i_block, std::size_t, std::align_val_t i_alignment) noexcept
+{
+    operator delete(i_block, i_alignment);
+}
+
+/* Runs the benchmarks, writing a record for every benchmark. For example:
+    djup_bench --filter canonicalize --sizes 100,1000 --rules 10 --format csv --output results.csv */
+int main(int argc, char ** argv)
+{
+    return djup::bench::Bench(argc, argv);
+}
@@ -1,54 +1,92 @@
-
 //   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
 // Distributed under the Boost Software License, Version 1.0.
 //        (See accompanying file LICENSE or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include <core/name.h>
+#include <core/memory.h>
+#include <unordered_map>
+#include <mutex>
 #include <string.h>
 
 namespace core
 {
-    Name::Name() = default;
-
-    Name::Name(const std::string & i_name)
-        : m_string(i_name.begin(), i_name.end())
+    namespace
     {
-        m_hash << m_string;
-    }
-
-    Name::Name(const char* i_name)
-        : m_string(i_name, i_name + strlen(i_name))
+        /** Global table of the interned names. The table is split in shards, each protected
+            by its own mutex. It is never destroyed, as names may be used during the static
+            destruction. */
+        template <typename ENTRY>
+            class NameTable
+        {
+        public:
+
+            const ENTRY * Intern(std::string_view i_string, Hash i_hash)
+            {
+                Shard & shard = m_shards[i_hash.GetValue() % s_shard_count];
+                std::lock_guard<std::mutex> lock(shard.m_mutex);
+
+                const auto range = shard.m_entries.equal_range(i_hash.GetValue());
+                for (auto it = range.first; it != range.second; ++it)
+                    if (it->second->m_string == i_string)
+                        return it->second;
+
+                // the characters are allocated right after the entry
+                void * const block = aligned_allocate(sizeof(ENTRY) + i_string.size(), alignof(ENTRY));
+                char * const chars = static_cast<char*>(block) + sizeof(ENTRY);
+                if (!i_string.empty())
+                    memcpy(chars, i_string.data(), i_string.size());
+                const ENTRY * const entry = new(block) ENTRY{ std::string_view(chars, i_string.size()), i_hash };
+
+                shard.m_entries.insert({ i_hash.GetValue(), entry });
+                return entry;
+            }
+
+        private:
+
+            struct Shard
+            {
+                std::mutex m_mutex;
+                std::unordered_multimap<uint64_t, const ENTRY*> m_entries;
+            };
+
+            constexpr static size_t s_shard_count = 16;
+            Shard m_shards[s_shard_count];
+        };
+
+    } // anonymous namespace
+
+    const Name::Entry * Name::Intern(std::string_view i_string, Hash i_hash)
     {
-        m_hash << m_string;
+        static NameTable<Entry> & table = *new NameTable<Entry>;
+        return table.Intern(i_string, i_hash);
     }
 
-    Name::Name(std::string_view i_name)
-        : m_string(i_name.begin(), i_name.end())
+    Name::Name()
     {
-        m_hash << m_string;
+        // the entry of the empty string is looked up once, so default construction doesn't lock
+        static const Entry * const empty_entry = Intern({}, Hash(std::string_view{}));
+        m_entry = empty_entry;
     }
 
-    Name::Name(ConstexprName i_name)
-        : m_string(i_name.AsString().begin(), i_name.AsString().end()),
-          m_hash(i_name.GetHash())
+    Name::Name(const std::string & i_name)
+        : Name(std::string_view(i_name))
     {
-
     }
 
-    bool operator == (const Name& i_first, const Name& i_second) noexcept
+    Name::Name(const char* i_name)
+        : Name(std::string_view(i_name, strlen(i_name)))
     {
-        return i_first.GetHash() == i_second.GetHash() && i_first.AsString() == i_second.AsString();
     }
 
-    bool operator == (const ConstexprName& i_first, const Name& i_second) noexcept
+    Name::Name(std::string_view i_name)
+        : m_entry(Intern(i_name, Hash(i_name)))
     {
-        return i_first.GetHash() == i_second.GetHash() && i_first.AsString() == i_second.AsString();
     }
 
-    bool operator == (const Name& i_first, const ConstexprName& i_second) noexcept
+    Name::Name(ConstexprName i_name)
+        : m_entry(Intern(i_name.AsString(), i_name.GetHash()))
     {
-        return i_first.GetHash() == i_second.GetHash() && i_first.AsString() == i_second.AsString();
     }
 
     bool operator == (const ConstexprName& i_first, const ConstexprName& i_second) noexcept
@@ -56,21 +94,6 @@ namespace core
         return i_first.GetHash() == i_second.GetHash() && i_first.AsString() == i_second.AsString();
     }
 
-    bool operator != (const Name& i_first, const Name& i_second) noexcept
-    {
-        return !(i_first == i_second);
-    }
-
-    bool operator != (const ConstexprName& i_first, const Name& i_second) noexcept
-    {
-        return !(i_first == i_second);
-    }
-
-    bool operator != (const Name& i_first, const ConstexprName& i_second) noexcept
-    {
-        return !(i_first == i_second);
-    }
-
     bool operator != (const ConstexprName& i_first, const ConstexprName& i_second) noexcept
     {
         return !(i_first == i_second);
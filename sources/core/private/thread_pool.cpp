@@ -0,0 +1,134 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/thread_pool.h>
+#include <algorithm>
+
+namespace core
+{
+    namespace
+    {
+        // the pool the calling thread is a worker of, if any, and the index of its queue
+        thread_local const ThreadPool * t_current_pool = nullptr;
+        thread_local size_t t_current_queue = 0;
+    }
+
+    ThreadPool::ThreadPool(size_t i_thread_count)
+    {
+        if (i_thread_count == 0)
+            i_thread_count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        for (size_t index = 0; index <= i_thread_count; index++)
+            m_queues.push_back(std::make_unique<TaskQueue>());
+
+        m_threads.reserve(i_thread_count);
+        for (size_t index = 0; index < i_thread_count; index++)
+            m_threads.emplace_back([this, index] { WorkerLoop(index); });
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+
+        for (std::thread & thread : m_threads)
+            thread.join();
+    }
+
+    size_t ThreadPool::GetOwnQueue() const
+    {
+        return t_current_pool == this ? t_current_queue : m_queues.size() - 1;
+    }
+
+    void ThreadPool::Submit(std::function<void()> i_task)
+    {
+        /* the counter is incremented before the task is visible, so that it never underflows,
+           and before locking m_wake_mutex, so that a worker that checks it under the lock
+           either sees the task or gets the notification */
+        m_queued_tasks.fetch_add(1, std::memory_order_relaxed);
+
+        TaskQueue & queue = *m_queues[GetOwnQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            queue.m_tasks.push_back(std::move(i_task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+        }
+        m_wake.notify_one();
+    }
+
+    bool ThreadPool::TryRunTask(size_t i_own_queue)
+    {
+        std::function<void()> task;
+
+        // the newest task of the own queue, which likely shares data with the last one...
+        if (i_own_queue + 1 < m_queues.size())
+        {
+            TaskQueue & queue = *m_queues[i_own_queue];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (!queue.m_tasks.empty())
+            {
+                task = std::move(queue.m_tasks.back());
+                queue.m_tasks.pop_back();
+            }
+        }
+
+        // ...or the oldest task of another queue, which likely spawns many others
+        for (size_t offset = 1; !task && offset <= m_queues.size(); offset++)
+        {
+            TaskQueue & queue = *m_queues[(i_own_queue + offset) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (!queue.m_tasks.empty())
+            {
+                task = std::move(queue.m_tasks.front());
+                queue.m_tasks.pop_front();
+            }
+        }
+
+        if (!task)
+            return false;
+
+        m_queued_tasks.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        return true;
+    }
+
+    void ThreadPool::RunUntil(const std::function<bool()> & i_done)
+    {
+        const size_t own_queue = GetOwnQueue();
+        while (!i_done())
+        {
+            if (!TryRunTask(own_queue))
+                std::this_thread::yield();
+        }
+    }
+
+    void ThreadPool::WorkerLoop(size_t i_queue_index)
+    {
+        t_current_pool = this;
+        t_current_queue = i_queue_index;
+
+        for (;;)
+        {
+            if (TryRunTask(i_queue_index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake.wait(lock, [this] {
+                return m_stop || m_queued_tasks.load(std::memory_order_relaxed) != 0; });
+            if (m_stop && m_queued_tasks.load(std::memory_order_relaxed) == 0)
+                break;
+        }
+
+        t_current_pool = nullptr;
+    }
+
+} // namespace core
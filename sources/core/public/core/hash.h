@@ -13,7 +13,7 @@
 
 namespace core
 {
-    // machine dependent hash
+    // 64-bit hash, the same at compile time and at runtime on every machine
     class Hash
     {
     public:
@@ -50,11 +50,30 @@ namespace core
             constexpr explicit Hash(const TYPE & ... i_object)
                 { ((*this) << ... << i_object); }
 
+        /** Combines a sequence of bytes into the hash. The bytes are consumed 8 at a time, each
+            word goes through a multiply-rotate round (the same of xxHash64), and the state is
+            finalized with the avalanche step of MurmurHash3, so that every bit of the input
+            affects every bit of the value. Words are assembled byte by byte in little-endian
+            order, so the result is the same at compile time and at runtime, on any machine. */
         constexpr Hash & operator << (Span<const char> i_data)
         {
-            // http://www.cse.yorku.ca/~oz/hash.html
-            for(auto c : i_data)
-                m_value = m_value * 33 + static_cast<uint64_t>(c);
+            const char * data = i_data.data();
+            size_t remaining = i_data.size();
+            uint64_t value = m_value;
+            for (; remaining >= 8; data += 8, remaining -= 8)
+                value = Round(value, LoadWord(data, 8));
+
+            // the length is combined with the tail, so that trailing zeros are significant
+            const uint64_t length = static_cast<uint64_t>(i_data.size()) << 56;
+            m_value = Avalanche(Round(value, LoadWord(data, remaining) ^ length));
+            return *this;
+        }
+
+        /** Combines a 64-bit word into the hash. Equivalent to, but faster than, combining its
+            little-endian representation as bytes. */
+        constexpr Hash & AddWord(uint64_t i_word)
+        {
+            m_value = Avalanche(Round(Round(m_value, i_word), uint64_t(8) << 56));
             return *this;
         }
 
@@ -87,6 +106,39 @@ namespace core
             return result;
         }
 
+    private:
+
+        static constexpr uint64_t LoadWord(const char * i_data, size_t i_size)
+        {
+            // compilers turn this into a single load on little-endian machines
+            uint64_t word = 0;
+            for (size_t i = 0; i < i_size; i++)
+                word |= static_cast<uint64_t>(static_cast<unsigned char>(i_data[i])) << (i * 8);
+            return word;
+        }
+
+        static constexpr uint64_t RotateLeft(uint64_t i_value, unsigned i_shift)
+        {
+            return (i_value << i_shift) | (i_value >> (64 - i_shift));
+        }
+
+        static constexpr uint64_t Round(uint64_t i_accumulator, uint64_t i_word)
+        {
+            i_accumulator += i_word * 0xC2B2AE3D27D4EB4Full;
+            i_accumulator = RotateLeft(i_accumulator, 31);
+            return i_accumulator * 0x9E3779B185EBCA87ull;
+        }
+
+        static constexpr uint64_t Avalanche(uint64_t i_value)
+        {
+            i_value ^= i_value >> 33;
+            i_value *= 0xFF51AFD7ED558CCDull;
+            i_value ^= i_value >> 33;
+            i_value *= 0xC4CEB9FE1A85EC53ull;
+            i_value ^= i_value >> 33;
+            return i_value;
+        }
+
     private:
         static constexpr uint64_t s_empty_value = 5381;
         uint64_t m_value = s_empty_value;
@@ -104,15 +156,22 @@ namespace core
             std::is_arithmetic_v<TYPE> || std::is_enum_v<TYPE> >>
         Hash & operator << (Hash & i_dest, const TYPE & i_object)
     {
-        // type-aliasing rule is not violated becuse we inspect the object with unsigned chars
-        // https://en.cppreference.com/w/cpp/language/reinterpret_cast#Type_aliasing
-        auto const address = reinterpret_cast<const char*>(&i_object);
-        return i_dest << Span(address, sizeof(TYPE));
+        if constexpr ((std::is_integral_v<TYPE> || std::is_enum_v<TYPE>) && sizeof(TYPE) == 8)
+        {
+            return i_dest.AddWord(static_cast<uint64_t>(i_object));
+        }
+        else
+        {
+            // type-aliasing rule is not violated becuse we inspect the object with unsigned chars
+            // https://en.cppreference.com/w/cpp/language/reinterpret_cast#Type_aliasing
+            auto const address = reinterpret_cast<const char*>(&i_object);
+            return i_dest << Span(address, sizeof(TYPE));
+        }
     }
 
-    inline Hash & operator << (Hash & i_dest, const Hash & i_source)
+    constexpr Hash & operator << (Hash & i_dest, const Hash & i_source)
     {
-        return i_dest << i_source.GetValue();
+        return i_dest.AddWord(i_source.GetValue());
     }
 
     constexpr Hash & operator << (Hash & i_dest, std::string_view i_src)
@@ -124,9 +183,15 @@ namespace core
         FirstOf<Hash, ContainerElementTypeT<CONTAINER>> & operator <<
             (Hash & i_dest, const CONTAINER & i_container)
     {
-        for(const auto & element : i_container)
-            i_dest << element;
-        return i_dest;
+        // strings are hashed as a whole, so that all the representations of a string agree
+        if constexpr (std::is_same_v<ContainerElementTypeT<CONTAINER>, char>)
+            return i_dest << Span<const char>(std::data(i_container), std::size(i_container));
+        else
+        {
+            for(const auto & element : i_container)
+                i_dest << element;
+            return i_dest;
+        }
     }
 
     template <> struct CharWriter<Hash>
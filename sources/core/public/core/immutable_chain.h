@@ -0,0 +1,45 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <core/intrusive_ptr.h>
+#include <cstdint>
+
+namespace core
+{
+    /** Base of the nodes of an immutable singly-linked chain, in which every node points to
+        its parent. Nodes have an atomic reference count, so a chain can be shared between
+        threads, and many chains can share their tail. Releasing the last reference to a node
+        releases its parents iteratively, so that long chains don't overflow the stack.
+        NODE must derive from ImmutableChainNode<NODE>, and is referenced by IntrusivePtr<const NODE>. */
+    template <typename NODE>
+        struct ImmutableChainNode
+    {
+        IntrusivePtr<const NODE> m_parent;
+        mutable RefCounter<true> m_ref_count{};
+
+        friend void IntrusiveAddRef(const NODE * i_node) noexcept
+        {
+            i_node->m_ref_count.AddRef();
+        }
+
+        friend void IntrusiveRelease(const NODE * i_node) noexcept
+        {
+            while (i_node != nullptr && i_node->m_ref_count.Release())
+            {
+                const NODE * parent = const_cast<NODE*>(i_node)->m_parent.release();
+                delete i_node;
+                i_node = parent;
+            }
+        }
+
+        friend uint32_t IntrusiveUseCount(const NODE * i_node) noexcept
+        {
+            return i_node->m_ref_count.GetCount();
+        }
+    };
+
+} // namespace core
@@ -7,6 +7,7 @@
 #pragma once
 #include <core/memory.h>
 #include <core/traits.h>
+#include <core/intrusive_ptr.h>
 #include <utility>
 #include <iterator>
 #include <assert.h>
@@ -30,14 +31,13 @@ namespace core
         ImmutableVector() noexcept
             : m_elements(GetEmptyElements()), m_size(0)
         {
-            ++s_empty_header.m_ref_count;
+            s_empty_header.m_ref_count.AddRef();
         }
 
         ImmutableVector(const ImmutableVector & i_source) noexcept
             : m_elements(i_source.m_elements), m_size(i_source.m_size)
         {
-            Header & header = i_source.GetHeader();
-            ++header.m_ref_count;
+            i_source.GetHeader().m_ref_count.AddRef();
         }
 
         ImmutableVector(ImmutableVector && i_source) noexcept
@@ -45,7 +45,7 @@ namespace core
         {
             i_source.m_elements = GetEmptyElements();
             i_source.m_size = 0;
-            ++s_empty_header.m_ref_count;
+            s_empty_header.m_ref_count.AddRef();
         }
 
         template <typename INPUT_ITERATOR, 
@@ -111,9 +111,7 @@ namespace core
         ~ImmutableVector()
         {
             Header & header = GetHeader();
-            assert(header.m_ref_count > 0);
-            --header.m_ref_count;
-            if (header.m_ref_count == 0 && &header != &s_empty_header)
+            if (header.m_ref_count.Release() && &header != &s_empty_header)
             {
                 for (size_t i = 0; i < m_size; i++)
                     m_elements[i].ELEMENT::~ELEMENT();
@@ -179,9 +177,10 @@ namespace core
 
     private:
 
+        // vectors are shared between threads, so the counter is atomic
         struct Header
         {
-            uint32_t m_ref_count{};
+            RefCounter<true> m_ref_count;
         };
 
         Header & GetHeader() const
@@ -197,13 +196,13 @@ namespace core
 
         void Allocate(size_t i_size)
         {
-            auto header = static_cast<Header*>(aligned_allocate(
+            auto header = new(aligned_allocate(
                 i_size * sizeof(ELEMENT) + sizeof(Header),
-                alignof(ELEMENT), sizeof(Header)));;
+                alignof(ELEMENT), sizeof(Header))) Header;
 
             m_elements = reinterpret_cast<ELEMENT*>(header + 1);
             m_size = i_size;
-            GetHeader().m_ref_count = 1;
+            header->m_ref_count.AddRef();
         }
 
     private:
@@ -0,0 +1,214 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <assert.h>
+
+namespace core
+{
+    /** Reference counter to be embedded in objects managed by IntrusivePtr.
+        If ATOMIC is false the counter is a plain integer: copying and destroying
+        pointers is cheaper, but objects can't be shared between threads.
+        A new counter is zero, and copying an object does not copy its counter. */
+    template <bool ATOMIC>
+        class RefCounter
+    {
+    public:
+
+        RefCounter() noexcept = default;
+
+        RefCounter(const RefCounter &) noexcept { }
+
+        RefCounter & operator = (const RefCounter &) noexcept { return *this; }
+
+        void AddRef() noexcept
+        {
+            if constexpr (ATOMIC)
+                m_count.fetch_add(1, std::memory_order_relaxed);
+            else
+                ++m_count;
+        }
+
+        /** Decrements the counter, and returns true if it reached zero. */
+        [[nodiscard]] bool Release() noexcept
+        {
+            assert(GetCount() > 0);
+            if constexpr (ATOMIC)
+                return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+            else
+                return --m_count == 0;
+        }
+
+        uint32_t GetCount() const noexcept
+        {
+            if constexpr (ATOMIC)
+                return m_count.load(std::memory_order_relaxed);
+            else
+                return m_count;
+        }
+
+    private:
+        std::conditional_t<ATOMIC, std::atomic<uint32_t>, uint32_t> m_count{0};
+    };
+
+    /** Smart pointer to an object with an embedded reference count. Unlike std::shared_ptr
+        there is no separate control block, and the pointer has the size of a raw pointer.
+        The interface mimics std::shared_ptr. The pointed type may be incomplete: the pointer
+        manages the object with the unqualified functions IntrusiveAddRef(const TYPE *),
+        IntrusiveRelease(const TYPE *) and IntrusiveUseCount(const TYPE *), found by ADL.
+        IntrusiveRelease is responsible of destroying the object when the count reaches zero.
+        Constructing a pointer from a raw pointer adds a reference, so a new object must
+        start with a zero count. */
+    template <typename TYPE>
+        class IntrusivePtr
+    {
+    public:
+
+        using element_type = TYPE;
+
+        constexpr IntrusivePtr() noexcept = default;
+
+        constexpr IntrusivePtr(std::nullptr_t) noexcept { }
+
+        explicit IntrusivePtr(TYPE * i_object) noexcept
+            : m_object(i_object)
+        {
+            if (m_object != nullptr)
+                IntrusiveAddRef(m_object);
+        }
+
+        IntrusivePtr(const IntrusivePtr & i_source) noexcept
+            : m_object(i_source.m_object)
+        {
+            if (m_object != nullptr)
+                IntrusiveAddRef(m_object);
+        }
+
+        IntrusivePtr(IntrusivePtr && i_source) noexcept
+            : m_object(i_source.m_object)
+        {
+            i_source.m_object = nullptr;
+        }
+
+        template <typename OTHER, typename = std::enable_if_t<std::is_convertible_v<OTHER*, TYPE*>>>
+            IntrusivePtr(const IntrusivePtr<OTHER> & i_source) noexcept
+                : IntrusivePtr(i_source.get())
+        {
+        }
+
+        template <typename OTHER, typename = std::enable_if_t<std::is_convertible_v<OTHER*, TYPE*>>>
+            IntrusivePtr(IntrusivePtr<OTHER> && i_source) noexcept
+                : m_object(i_source.release())
+        {
+        }
+
+        IntrusivePtr & operator = (const IntrusivePtr & i_source) noexcept
+        {
+            if (m_object != i_source.m_object)
+                IntrusivePtr(i_source).swap(*this);
+            return *this;
+        }
+
+        IntrusivePtr & operator = (IntrusivePtr && i_source) noexcept
+        {
+            IntrusivePtr(std::move(i_source)).swap(*this);
+            return *this;
+        }
+
+        ~IntrusivePtr()
+        {
+            if (m_object != nullptr)
+                IntrusiveRelease(m_object);
+        }
+
+        void reset() noexcept
+        {
+            IntrusivePtr().swap(*this);
+        }
+
+        void swap(IntrusivePtr & i_other) noexcept
+        {
+            std::swap(m_object, i_other.m_object);
+        }
+
+        /** Detaches the pointer from the object without releasing it. */
+        [[nodiscard]] TYPE * release() noexcept
+        {
+            TYPE * const object = m_object;
+            m_object = nullptr;
+            return object;
+        }
+
+        TYPE * get() const noexcept { return m_object; }
+
+        TYPE & operator * () const noexcept
+        {
+            assert(m_object != nullptr);
+            return *m_object;
+        }
+
+        TYPE * operator -> () const noexcept
+        {
+            assert(m_object != nullptr);
+            return m_object;
+        }
+
+        explicit operator bool() const noexcept { return m_object != nullptr; }
+
+        long use_count() const noexcept
+        {
+            return m_object != nullptr ? static_cast<long>(IntrusiveUseCount(m_object)) : 0;
+        }
+
+    private:
+        TYPE * m_object = nullptr;
+    };
+
+    template <typename FIRST, typename SECOND>
+        bool operator == (const IntrusivePtr<FIRST> & i_first, const IntrusivePtr<SECOND> & i_second) noexcept
+            { return i_first.get() == i_second.get(); }
+
+    template <typename FIRST, typename SECOND>
+        bool operator != (const IntrusivePtr<FIRST> & i_first, const IntrusivePtr<SECOND> & i_second) noexcept
+            { return i_first.get() != i_second.get(); }
+
+    template <typename TYPE>
+        bool operator == (const IntrusivePtr<TYPE> & i_pointer, std::nullptr_t) noexcept
+            { return i_pointer.get() == nullptr; }
+
+    template <typename TYPE>
+        bool operator != (const IntrusivePtr<TYPE> & i_pointer, std::nullptr_t) noexcept
+            { return i_pointer.get() != nullptr; }
+
+    template <typename TYPE>
+        bool operator == (std::nullptr_t, const IntrusivePtr<TYPE> & i_pointer) noexcept
+            { return i_pointer.get() == nullptr; }
+
+    template <typename TYPE>
+        bool operator != (std::nullptr_t, const IntrusivePtr<TYPE> & i_pointer) noexcept
+            { return i_pointer.get() != nullptr; }
+
+    template <typename FIRST, typename SECOND>
+        bool operator < (const IntrusivePtr<FIRST> & i_first, const IntrusivePtr<SECOND> & i_second) noexcept
+            { return std::less<const void*>()(i_first.get(), i_second.get()); }
+
+} // namespace core
+
+namespace std
+{
+    template <typename TYPE>
+        struct hash<core::IntrusivePtr<TYPE>>
+    {
+        size_t operator()(const core::IntrusivePtr<TYPE> & i_pointer) const noexcept
+        {
+            return std::hash<TYPE*>()(i_pointer.get());
+        }
+    };
+}
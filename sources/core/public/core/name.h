@@ -5,11 +5,11 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
-#include <core/immutable_vector.h>
 #include <core/hash.h>
 #include <core/to_chars.h>
 #include <string>
 #include <string_view>
+#include <cstdint>
 #include <functional> // for std::hash
 
 namespace core
@@ -19,7 +19,7 @@ namespace core
     {
     public:
 
-        constexpr ConstexprName() = default;
+        constexpr ConstexprName() : ConstexprName(std::string_view{}) { }
 
         constexpr ConstexprName(std::string_view i_name)
             : m_string(i_name)
@@ -38,6 +38,11 @@ namespace core
         Hash m_hash;
     };
 
+    /** Interned string. All the names with the same characters share a single entry of a
+        global table, so copying a name is copying a pointer, and two names are compared
+        by comparing their entries. Entries are never released. The comparison with a
+        ConstexprName compares the hash, and the characters only if the hashes are equal.
+        Construction is thread safe. */
     class Name
     {
     public:
@@ -52,27 +57,63 @@ namespace core
 
         Name(ConstexprName i_name);
 
-        std::string AsString() const { return { m_string.data(), m_string.size() }; }
+        std::string AsString() const { return std::string(m_entry->m_string); }
 
-        std::string_view AsStringView() const { return { m_string.data(), m_string.size() }; }
+        std::string_view AsStringView() const { return m_entry->m_string; }
 
-        Hash GetHash() const { return m_hash; }
+        Hash GetHash() const { return m_entry->m_hash; }
 
-        bool IsEmpty() const { return m_string.empty(); }
+        bool IsEmpty() const { return m_entry->m_string.empty(); }
+
+        /** Returns an identifier unique among all the names with different characters */
+        uintptr_t GetId() const { return reinterpret_cast<uintptr_t>(m_entry); }
+
+        friend bool operator == (const Name & i_first, const Name & i_second) noexcept
+        {
+            return i_first.m_entry == i_second.m_entry;
+        }
+
+        friend bool operator != (const Name & i_first, const Name & i_second) noexcept
+        {
+            return i_first.m_entry != i_second.m_entry;
+        }
+
+        friend bool operator == (const Name & i_first, const ConstexprName & i_second) noexcept
+        {
+            return i_first.m_entry->m_hash == i_second.GetHash() &&
+                i_first.m_entry->m_string == i_second.AsString();
+        }
+
+        friend bool operator == (const ConstexprName & i_first, const Name & i_second) noexcept
+        {
+            return i_second == i_first;
+        }
+
+        friend bool operator != (const Name & i_first, const ConstexprName & i_second) noexcept
+        {
+            return !(i_first == i_second);
+        }
+
+        friend bool operator != (const ConstexprName & i_first, const Name & i_second) noexcept
+        {
+            return !(i_second == i_first);
+        }
 
     private:
-        ImmutableVector<char> m_string;
-        Hash m_hash;
+
+        struct Entry
+        {
+            std::string_view m_string; /**< points to characters allocated after the entry */
+            Hash m_hash;
+        };
+
+        static const Entry * Intern(std::string_view i_string, Hash i_hash);
+
+    private:
+        const Entry * m_entry;
     };
 
-    bool operator == (const Name& i_first, const Name& i_second) noexcept;
-    bool operator == (const ConstexprName& i_first, const Name& i_second) noexcept;
-    bool operator == (const Name& i_first, const ConstexprName& i_second) noexcept;
     bool operator == (const ConstexprName& i_first, const ConstexprName& i_second) noexcept;
-
-    bool operator != (const Name& i_first, const Name& i_second) noexcept;
-    bool operator != (const ConstexprName& i_first, const Name& i_second) noexcept;
-    bool operator != (const Name& i_first, const ConstexprName& i_second) noexcept;
     bool operator != (const ConstexprName& i_first, const ConstexprName& i_second) noexcept;
 
     inline Hash& operator << (Hash& i_dest, const Name& i_source)
@@ -0,0 +1,143 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <assert.h>
+
+namespace core
+{
+    /** Map from pointers to values, with open addressing and linear probing. Keys are
+        compared by address and are not owned by the map, so looking them up does not touch
+        any reference count. The null pointer can't be a key. Elements can't be removed
+        one by one, and inserting an element may invalidate the references to the values. */
+    template <typename KEY, typename VALUE>
+        class PointerMap
+    {
+    public:
+
+        PointerMap() = default;
+
+        explicit PointerMap(size_t i_expected_size)
+        {
+            Reserve(i_expected_size);
+        }
+
+        size_t size() const noexcept { return m_size; }
+
+        bool empty() const noexcept { return m_size == 0; }
+
+        /** Returns the value associated to a key, or null */
+        VALUE * Find(const KEY * i_key) noexcept
+        {
+            return const_cast<VALUE *>(std::as_const(*this).Find(i_key));
+        }
+
+        const VALUE * Find(const KEY * i_key) const noexcept
+        {
+            assert(i_key != nullptr);
+            if (m_slots.empty())
+                return nullptr;
+
+            for (size_t index = GetHomeSlot(i_key); ; index = (index + 1) & (m_slots.size() - 1))
+            {
+                const Slot & slot = m_slots[index];
+                if (slot.m_key == i_key)
+                    return &slot.m_value;
+                if (slot.m_key == nullptr)
+                    return nullptr;
+            }
+        }
+
+        /** If the key is not in the map, inserts it with a value-initialized value. Returns
+            the value associated to the key, and whether it has been inserted */
+        std::pair<VALUE &, bool> TryEmplace(const KEY * i_key)
+        {
+            assert(i_key != nullptr);
+            if ((m_size + 1) * 2 > m_slots.size())
+                Rehash(m_slots.empty() ? s_min_slot_count : m_slots.size() * 2);
+
+            size_t index = GetHomeSlot(i_key);
+            for (; m_slots[index].m_key != nullptr; index = (index + 1) & (m_slots.size() - 1))
+            {
+                if (m_slots[index].m_key == i_key)
+                    return { m_slots[index].m_value, false };
+            }
+
+            m_slots[index].m_key = i_key;
+            m_size++;
+            return { m_slots[index].m_value, true };
+        }
+
+        /** Makes room for i_size elements, so that inserting them does not rehash */
+        void Reserve(size_t i_size)
+        {
+            size_t slot_count = s_min_slot_count;
+            while (slot_count < i_size * 2)
+                slot_count *= 2;
+            if (slot_count > m_slots.size())
+                Rehash(slot_count);
+        }
+
+        /** Removes all the elements, keeping the capacity */
+        void clear() noexcept
+        {
+            for (Slot & slot : m_slots)
+                slot = Slot{};
+            m_size = 0;
+        }
+
+    private:
+
+        struct Slot
+        {
+            const KEY * m_key{};
+            VALUE m_value{};
+        };
+
+        static constexpr size_t s_min_slot_count = 16;
+
+        // the address is mixed, so that the low bits of aligned addresses are not always zero
+        size_t GetHomeSlot(const KEY * i_key) const noexcept
+        {
+            const uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(i_key))
+                * UINT64_C(0x9E3779B97F4A7C15);
+            return static_cast<size_t>(hash >> m_shift);
+        }
+
+        void Rehash(size_t i_slot_count)
+        {
+            assert((i_slot_count & (i_slot_count - 1)) == 0);
+
+            std::vector<Slot> old_slots(i_slot_count);
+            std::swap(old_slots, m_slots);
+
+            m_shift = 64;
+            for (size_t count = i_slot_count; count > 1; count /= 2)
+                m_shift--;
+
+            for (Slot & old_slot : old_slots)
+            {
+                if (old_slot.m_key == nullptr)
+                    continue;
+
+                size_t index = GetHomeSlot(old_slot.m_key);
+                while (m_slots[index].m_key != nullptr)
+                    index = (index + 1) & (m_slots.size() - 1);
+                m_slots[index] = std::move(old_slot);
+            }
+        }
+
+    private:
+        std::vector<Slot> m_slots;
+        size_t m_size{};
+        uint32_t m_shift{ 64 };
+    };
+
+} // namespace core
@@ -0,0 +1,75 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core
+{
+    /** Work-stealing thread pool. Every worker has its own queue of tasks: a task
+        submitted by a worker is pushed in the queue of the worker, which runs the most
+        recent tasks first, while idle workers steal the oldest tasks from the queues of
+        the others. Tasks submitted by other threads go in a shared queue.
+        Tasks must not throw. A thread waiting for some tasks should use RunUntil, so that
+        it runs tasks too, rather than blocking. */
+    class ThreadPool
+    {
+    public:
+
+        /** If i_thread_count is zero, the number of hardware threads is used */
+        explicit ThreadPool(size_t i_thread_count = 0);
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator = (const ThreadPool &) = delete;
+
+        /** Runs the tasks still in the queues, and then joins the workers */
+        ~ThreadPool();
+
+        size_t GetThreadCount() const { return m_threads.size(); }
+
+        /** Number of tasks submitted and not yet started. The value may be already
+            out of date when it is returned, so it's only a hint. */
+        size_t GetQueuedTaskCount() const { return m_queued_tasks.load(std::memory_order_relaxed); }
+
+        void Submit(std::function<void()> i_task);
+
+        /** Runs tasks on the calling thread until i_done returns true. i_done is
+            called after every task, and while no task is available. */
+        void RunUntil(const std::function<bool()> & i_done);
+
+    private:
+
+        struct TaskQueue
+        {
+            std::mutex m_mutex;
+            std::deque<std::function<void()>> m_tasks;
+        };
+
+        /** Index of the queue of the calling thread, or the shared queue if the
+            thread is not a worker of this pool */
+        size_t GetOwnQueue() const;
+
+        bool TryRunTask(size_t i_own_queue);
+
+        void WorkerLoop(size_t i_queue_index);
+
+    private:
+        std::vector<std::unique_ptr<TaskQueue>> m_queues; // the last one is the shared queue
+        std::vector<std::thread> m_threads;
+        std::atomic<size_t> m_queued_tasks{0};
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake;
+        bool m_stop{false};
+    };
+
+} // namespace core
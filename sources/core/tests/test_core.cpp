@@ -13,8 +13,14 @@ namespace core
     {
         void TestSystemUtils();
         void Traits();
+        void Hash_();
+        void ImmutableChain_();
         void ImmutableVector_();
+        void IntrusivePtr_();
+        void Name_();
         void Pool_();
+        void PointerMap_();
+        void ThreadPool_();
         void Bits();
         void Memory();
         void ToChars();
@@ -30,8 +36,14 @@ namespace core
             PrintLn("Test: Core...");
 
             TestSystemUtils();
+            Hash_();
+            ImmutableChain_();
             ImmutableVector_();
+            IntrusivePtr_();
+            Name_();
             Pool_();
+            PointerMap_();
+            ThreadPool_();
             GraphWiz();
             Traits();
             Bits();
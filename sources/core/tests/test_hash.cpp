@@ -0,0 +1,116 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/hash.h>
+#include <core/name.h>
+#include <core/diagnostic.h>
+#include <unordered_set>
+#include <string>
+#include <random>
+
+namespace core
+{
+    namespace tests
+    {
+        namespace
+        {
+            void Hash_Consistency()
+            {
+                // compile-time and runtime hashes must agree, as Name and ConstexprName are compared by hash
+                constexpr ConstexprName constexpr_name("a_quite_long_identifier_with_37_chars");
+                static_assert(constexpr_name.GetHash() != ConstexprName("a_quite_long_identifier_with_37_char_").GetHash());
+                const Name name(std::string("a_quite_long_identifier_with_37_chars"));
+                CORE_EXPECTS(name.GetHash() == constexpr_name.GetHash());
+                CORE_EXPECTS(name == constexpr_name);
+
+                // trailing zeros are significant
+                const char zeros[16] = {};
+                CORE_EXPECTS(Hash(Span(zeros, 3)) != Hash(Span(zeros, 4)));
+                CORE_EXPECTS(Hash(Span(zeros, 8)) != Hash(Span(zeros, 16)));
+                CORE_EXPECTS(Hash(std::string_view("")) != Hash());
+
+                // words are equivalent to their little-endian bytes
+                const uint64_t word = 0x0123456789ABCDEFull;
+                const char bytes[8] = { char(0xEF), char(0xCD), char(0xAB), char(0x89),
+                    char(0x67), char(0x45), char(0x23), char(0x01) };
+                CORE_EXPECTS(Hash().AddWord(word) == Hash(Span(bytes, 8)));
+            }
+
+            void Hash_Collisions()
+            {
+                std::unordered_set<uint64_t> values;
+                std::unordered_set<uint64_t> low_bits;
+                size_t count = 0;
+
+                auto Add = [&](Hash i_hash) {
+                    CORE_EXPECTS(values.insert(i_hash.GetValue()).second);
+                    low_bits.insert(i_hash.GetValue() & 0xFFFF);
+                    count++;
+                };
+
+                for (uint64_t i = 0; i < 200'000; i++)
+                    Add(Hash(i));
+
+                std::string identifier;
+                for (char first = 'a'; first <= 'z'; first++)
+                    for (char second = 'a'; second <= 'z'; second++)
+                        for (int index = 0; index < 100; index++)
+                        {
+                            identifier = "identifier_";
+                            identifier += first;
+                            identifier += second;
+                            identifier += std::to_string(index);
+                            Add(Hash(std::string_view(identifier)));
+                        }
+
+                CORE_EXPECTS(values.size() == count);
+
+                // with ~270k values almost every one of the 65536 values of the lowest 16 bits is expected
+                CORE_EXPECTS(low_bits.size() > 65536 * 95 / 100);
+            }
+
+            void Hash_Avalanche()
+            {
+                std::mt19937_64 random(42);
+                size_t total_flipped_bits = 0, total_samples = 0;
+                for (int sample = 0; sample < 200; sample++)
+                {
+                    char data[16];
+                    for (char & c : data)
+                        c = static_cast<char>(random());
+                    const uint64_t reference = Hash(Span(data, 16)).GetValue();
+                    for (unsigned bit = 0; bit < 16 * 8; bit++)
+                    {
+                        data[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+                        const uint64_t value = Hash(Span(data, 16)).GetValue();
+                        data[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+
+                        uint64_t diff = value ^ reference;
+                        for (; diff != 0; diff &= diff - 1)
+                            total_flipped_bits++;
+                        total_samples++;
+                    }
+                }
+
+                // on average half of the bits of the hash should change
+                const double average = static_cast<double>(total_flipped_bits) / total_samples;
+                CORE_EXPECTS(average > 31. && average < 33.);
+            }
+        }
+
+        void Hash_()
+        {
+            Print("Test: Core - Hash...");
+
+            Hash_Consistency();
+            Hash_Collisions();
+            Hash_Avalanche();
+
+            PrintLn("ok");
+        }
+
+    } // namespace tests
+
+} // namespace core
@@ -0,0 +1,61 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/immutable_chain.h>
+#include <core/diagnostic.h>
+
+namespace core
+{
+    namespace tests
+    {
+        namespace
+        {
+            struct ChainNode : ImmutableChainNode<ChainNode>
+            {
+                int m_value{};
+            };
+
+            IntrusivePtr<const ChainNode> Push(IntrusivePtr<const ChainNode> i_parent, int i_value)
+            {
+                return IntrusivePtr<const ChainNode>(new ChainNode{ { std::move(i_parent) }, i_value });
+            }
+        }
+
+        void ImmutableChain_()
+        {
+            Print("Test: Core - ImmutableChain...");
+
+            // a shared tail
+            {
+                IntrusivePtr<const ChainNode> tail = Push(Push({}, 1), 2);
+                IntrusivePtr<const ChainNode> first = Push(tail, 3);
+                IntrusivePtr<const ChainNode> second = Push(tail, 4);
+                CORE_EXPECTS_EQ(IntrusiveUseCount(tail.get()), 3u);
+
+                first = {};
+                CORE_EXPECTS_EQ(IntrusiveUseCount(tail.get()), 2u);
+                tail = {};
+
+                int sum = 0;
+                for (const ChainNode * node = second.get(); node != nullptr; node = node->m_parent.get())
+                    sum += node->m_value;
+                CORE_EXPECTS_EQ(sum, 7);
+            }
+
+            // a long chain is released without recursion
+            {
+                IntrusivePtr<const ChainNode> chain;
+                for (int i = 0; i < 1'000'000; i++)
+                    chain = Push(std::move(chain), i);
+                CORE_EXPECTS_EQ(chain->m_value, 999'999);
+            }
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace core
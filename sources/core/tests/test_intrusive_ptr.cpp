@@ -0,0 +1,108 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/intrusive_ptr.h>
+#include <core/diagnostic.h>
+#include <unordered_set>
+
+namespace core
+{
+    namespace tests
+    {
+        namespace
+        {
+            template <bool ATOMIC>
+                struct TestObject
+            {
+                int m_value;
+                mutable RefCounter<ATOMIC> m_ref_count;
+
+                static int s_instances;
+
+                TestObject(int i_value) : m_value(i_value) { ++s_instances; }
+                ~TestObject() { --s_instances; }
+            };
+
+            template <bool ATOMIC>
+                int TestObject<ATOMIC>::s_instances = 0;
+
+            template <bool ATOMIC>
+                void IntrusiveAddRef(const TestObject<ATOMIC> * i_object) noexcept
+            {
+                i_object->m_ref_count.AddRef();
+            }
+
+            template <bool ATOMIC>
+                void IntrusiveRelease(const TestObject<ATOMIC> * i_object) noexcept
+            {
+                if (i_object->m_ref_count.Release())
+                    delete i_object;
+            }
+
+            template <bool ATOMIC>
+                uint32_t IntrusiveUseCount(const TestObject<ATOMIC> * i_object) noexcept
+            {
+                return i_object->m_ref_count.GetCount();
+            }
+
+            template <bool ATOMIC>
+                void IntrusivePtr_Test()
+            {
+                using Object = TestObject<ATOMIC>;
+                {
+                    IntrusivePtr<const Object> null_ptr;
+                    CORE_EXPECTS(!null_ptr);
+                    CORE_EXPECTS(null_ptr == nullptr);
+                    CORE_EXPECTS(null_ptr.use_count() == 0);
+
+                    IntrusivePtr<Object> first(new Object(42));
+                    CORE_EXPECTS(Object::s_instances == 1);
+                    CORE_EXPECTS(first.use_count() == 1);
+                    CORE_EXPECTS(first->m_value == 42);
+                    CORE_EXPECTS((*first).m_value == 42);
+
+                    IntrusivePtr<const Object> second(first);
+                    CORE_EXPECTS(first.use_count() == 2);
+                    CORE_EXPECTS(first == second);
+                    CORE_EXPECTS(first.get() == second.get());
+
+                    IntrusivePtr<const Object> third(std::move(second));
+                    CORE_EXPECTS(!second);
+                    CORE_EXPECTS(third.use_count() == 2);
+
+                    third = IntrusivePtr<const Object>(new Object(3));
+                    CORE_EXPECTS(Object::s_instances == 2);
+                    CORE_EXPECTS(first.use_count() == 1);
+
+                    std::unordered_set<IntrusivePtr<const Object>> set;
+                    set.insert(first);
+                    set.insert(first);
+                    set.insert(third);
+                    CORE_EXPECTS(set.size() == 2);
+                    set.clear();
+
+                    third.reset();
+                    CORE_EXPECTS(Object::s_instances == 1);
+
+                    first = first; // self assignment
+                    CORE_EXPECTS(first.use_count() == 1);
+                }
+                CORE_EXPECTS(Object::s_instances == 0);
+            }
+        }
+
+        void IntrusivePtr_()
+        {
+            Print("Test: Core - IntrusivePtr...");
+
+            IntrusivePtr_Test<true>();
+            IntrusivePtr_Test<false>();
+
+            PrintLn("ok");
+        }
+
+    } // namespace tests
+
+} // namespace core
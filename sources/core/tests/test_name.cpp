@@ -0,0 +1,49 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/name.h>
+#include <core/diagnostic.h>
+#include <string>
+
+namespace core
+{
+    namespace tests
+    {
+        void Name_()
+        {
+            Print("Test: Core - Name...");
+
+            constexpr ConstexprName constexpr_add("Add");
+
+            const Name add_1("Add");
+            const Name add_2(std::string("A") + "dd");
+            const Name add_3(constexpr_add);
+            const Name mul("Mul");
+
+            // equal names share the same entry
+            CORE_EXPECTS(add_1 == add_2 && add_2 == add_3);
+            CORE_EXPECTS(add_1.GetId() == add_2.GetId());
+            CORE_EXPECTS(add_1.AsStringView().data() == add_3.AsStringView().data());
+            CORE_EXPECTS(add_1 != mul);
+            CORE_EXPECTS(add_1.GetId() != mul.GetId());
+
+            CORE_EXPECTS(add_1 == constexpr_add);
+            CORE_EXPECTS(constexpr_add == add_2);
+            CORE_EXPECTS(mul != constexpr_add);
+            CORE_EXPECTS(add_1.AsString() == "Add");
+            CORE_EXPECTS(add_1.GetHash() == constexpr_add.GetHash());
+
+            // the default name is the empty string
+            CORE_EXPECTS(Name().IsEmpty());
+            CORE_EXPECTS(Name() == Name(""));
+            CORE_EXPECTS(Name() == ConstexprName());
+            CORE_EXPECTS(Name() != add_1);
+
+            PrintLn("ok");
+        }
+
+    } // namespace tests
+
+} // namespace core
@@ -0,0 +1,59 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/pointer_map.h>
+#include <core/diagnostic.h>
+#include <memory>
+#include <vector>
+
+namespace core
+{
+    namespace tests
+    {
+        void PointerMap_()
+        {
+            Print("Test: Core - PointerMap...");
+
+            PointerMap<int, size_t> map;
+            CORE_EXPECTS(map.empty());
+
+            int dummy = 0;
+            CORE_EXPECTS(map.Find(&dummy) == nullptr);
+
+            // enough elements to rehash many times
+            const size_t count = 10'000;
+            std::unique_ptr<int[]> keys(new int[count]);
+            for (size_t i = 0; i < count; i++)
+            {
+                auto [value, inserted] = map.TryEmplace(&keys[i]);
+                CORE_EXPECTS(inserted);
+                CORE_EXPECTS_EQ(value, 0u);
+                value = i;
+            }
+            CORE_EXPECTS_EQ(map.size(), count);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                const auto [value, inserted] = map.TryEmplace(&keys[i]);
+                CORE_EXPECTS(!inserted);
+                CORE_EXPECTS_EQ(value, i);
+                CORE_EXPECTS_EQ(*map.Find(&keys[i]), i);
+            }
+            CORE_EXPECTS(map.Find(&dummy) == nullptr);
+
+            map.clear();
+            CORE_EXPECTS(map.empty() && map.Find(&keys[0]) == nullptr);
+
+            PointerMap<int, std::vector<int>> reserved(100);
+            reserved.TryEmplace(&dummy).first.push_back(5);
+            CORE_EXPECTS_EQ(reserved.Find(&dummy)->size(), 1u);
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace core
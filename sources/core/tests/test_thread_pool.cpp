@@ -0,0 +1,71 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <core/thread_pool.h>
+#include <core/diagnostic.h>
+#include <atomic>
+
+namespace core
+{
+    namespace tests
+    {
+        namespace
+        {
+            // every task splits its range in two halves, and submits one of them
+            void SumRange(ThreadPool & i_pool, uint64_t i_begin, uint64_t i_end,
+                std::atomic<uint64_t> & io_sum, std::atomic<size_t> & io_pending_tasks)
+            {
+                while (i_end - i_begin > 16)
+                {
+                    const uint64_t middle = i_begin + (i_end - i_begin) / 2;
+                    io_pending_tasks++;
+                    i_pool.Submit([&i_pool, middle, i_end, &io_sum, &io_pending_tasks] {
+                        SumRange(i_pool, middle, i_end, io_sum, io_pending_tasks);
+                    });
+                    i_end = middle;
+                }
+
+                uint64_t sum = 0;
+                for (uint64_t value = i_begin; value < i_end; value++)
+                    sum += value;
+                io_sum += sum;
+                io_pending_tasks--;
+            }
+        }
+
+        void ThreadPool_()
+        {
+            Print("Test: Core - ThreadPool...");
+
+            for (size_t thread_count : { 1, 2, 4 })
+            {
+                ThreadPool pool(thread_count);
+                CORE_EXPECTS_EQ(pool.GetThreadCount(), thread_count);
+
+                const uint64_t count = 100'000;
+                std::atomic<uint64_t> sum{ 0 };
+                std::atomic<size_t> pending_tasks{ 1 };
+                pool.Submit([&] { SumRange(pool, 0, count, sum, pending_tasks); });
+                pool.RunUntil([&] { return pending_tasks == 0; });
+
+                CORE_EXPECTS_EQ(sum.load(), count * (count - 1) / 2);
+            }
+
+            // the destructor runs the tasks still queued
+            std::atomic<int> executed{ 0 };
+            {
+                ThreadPool pool(2);
+                for (int i = 0; i < 100; i++)
+                    pool.Submit([&executed] { executed++; });
+            }
+            CORE_EXPECTS_EQ(executed.load(), 100);
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace core
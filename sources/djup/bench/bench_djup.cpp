@@ -0,0 +1,36 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <bench/bench_utils.h>
+#include <iostream>
+
+namespace djup
+{
+    namespace bench
+    {
+        void BenchExpressions(BenchmarkRunner & i_runner);
+        void BenchPatterns(BenchmarkRunner & i_runner);
+
+        int Bench(int i_argc, const char * const * i_argv)
+        {
+            try
+            {
+                BenchmarkRunner runner(ParseBenchmarkOptions(i_argc, i_argv));
+
+                BenchExpressions(runner);
+                BenchPatterns(runner);
+
+                return 0;
+            }
+            catch (const std::exception & i_exception)
+            {
+                std::cerr << "Error: " << i_exception.what() << std::endl;
+                return 1;
+            }
+        }
+
+    } // namespace bench
+
+} // namespace djup
@@ -0,0 +1,153 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/make_expr.h>
+#include <private/namespace.h>
+#include <private/substitute_by_predicate.h>
+#include <bench/bench_utils.h>
+#include <algorithm>
+
+namespace djup
+{
+    namespace bench
+    {
+        namespace
+        {
+            // rebuilds an expression bottom-up with MakeExpression
+            Tensor Rebuild(const Namespace & i_namespace, const Tensor & i_source)
+            {
+                const Expression & source = *i_source.GetExpression();
+                std::vector<Tensor> arguments;
+                arguments.reserve(source.GetArguments().size());
+                for (const Tensor & argument : source.GetArguments())
+                    arguments.push_back(Rebuild(i_namespace, argument));
+                return MakeExpression(i_namespace, source.GetType(), source.GetName(),
+                    arguments, source.GetMetadata());
+            }
+
+            /* Generates a DAG of about i_node_count nodes in 5 layers. The first layer has integer
+               literals and, every 8 nodes, i_leaf. Every node of the next 3 layers has two arguments
+               in the previous layer, and the root has the whole last layer. The DAG is shallow, so
+               that expanding it to a tree (as ToSimplifiedString does) is still feasible. */
+            Tensor GenerateDag(const Namespace & i_namespace, Random & i_random,
+                size_t i_node_count, const Tensor & i_leaf)
+            {
+                const size_t width = std::max<size_t>(i_node_count / 4, 1);
+
+                std::vector<Tensor> layer;
+                for (size_t i = 0; i < width; i++)
+                    layer.push_back(i % 8 == 0 ? i_leaf : MakeLiteral(i_namespace, NumericCast<int64_t>(i)));
+
+                std::vector<Tensor> next_layer;
+                for (int layer_index = 1; layer_index < 4; layer_index++)
+                {
+                    next_layer.clear();
+                    for (size_t i = 0; i < width; i++)
+                    {
+                        const Tensor arguments[] = { layer[i_random.Below(width)], layer[i_random.Below(width)] };
+                        next_layer.push_back(MakeExpression(i_namespace, {}, "f", arguments, {}));
+                    }
+                    std::swap(layer, next_layer);
+                }
+
+                return MakeExpression(i_namespace, {}, "g", layer, {});
+            }
+
+            // the hash used before core::Hash, kept as reference for the throughput
+            uint64_t Djb2(Span<const char> i_data)
+            {
+                uint64_t value = 5381;
+                for (auto c : i_data)
+                    value = value * 33 + static_cast<uint64_t>(c);
+                return value;
+            }
+        }
+
+        void BenchExpressions(BenchmarkRunner & i_runner)
+        {
+            const Namespace & standard_namespace = *GetStandardNamespace();
+
+            for (size_t size : i_runner.GetOptions().m_sizes)
+            {
+                Random random(i_runner.GetOptions().m_seed);
+                const std::string source = GenerateExpressionSource(random, size, 8);
+                const Tensor expression(source);
+
+                i_runner.Run("parse", size, 0, [&] {
+                    Consume(Tensor(source));
+                });
+
+                i_runner.Run("make_expression", size, 0, [&] {
+                    Consume(Rebuild(standard_namespace, expression));
+                });
+
+                i_runner.Run("to_simplified_string", size, 0, [&] {
+                    Consume(ToSimplifiedString(expression).size());
+                });
+
+                // throughput of the hash on a buffer of size KiB
+                if (i_runner.IsEnabled("hash") || i_runner.IsEnabled("hash_djb2"))
+                {
+                    std::vector<char> buffer(size * 1024);
+                    for (char & c : buffer)
+                        c = static_cast<char>(random.Below(256));
+
+                    i_runner.Run("hash", size, 0, [&] {
+                        Consume(static_cast<size_t>(Hash(Span<const char>(buffer)).GetValue()));
+                    });
+
+                    i_runner.Run("hash_djb2", size, 0, [&] {
+                        Consume(static_cast<size_t>(Djb2(Span<const char>(buffer))));
+                    });
+                }
+
+                // a DAG with many shared nodes, traversed and rebuilt from some leaves
+                if (i_runner.IsEnabled("substitute_by_predicate_none") || i_runner.IsEnabled("substitute_by_predicate_leaf"))
+                {
+                    const Tensor leaf("real x");
+                    const Tensor replacement = MakeLiteral(standard_namespace, int64_t{ -1 });
+                    const Tensor dag = GenerateDag(standard_namespace, random, size, leaf);
+
+                    i_runner.Run("substitute_by_predicate_none", size, 0, [&] {
+                        Consume(SubstituteByPredicate(standard_namespace, dag,
+                            [](const Tensor & i_tensor) { return i_tensor; }));
+                    });
+
+                    i_runner.Run("substitute_by_predicate_leaf", size, 0, [&] {
+                        Consume(SubstituteByPredicate(standard_namespace, dag, [&](const Tensor & i_tensor) {
+                            return i_tensor.GetExpression() == leaf.GetExpression() ? replacement : i_tensor; }));
+                    });
+                }
+
+                // the same substitution in a namespace with an axiom, canonicalizing every rebuilt node or only the result
+                if (i_runner.IsEnabled("substitute_by_predicate_canonicalize_each") ||
+                    i_runner.IsEnabled("substitute_by_predicate_canonicalize_result"))
+                {
+                    Namespace test_namespace("Bench", GetStandardNamespace());
+                    test_namespace.AddSubstitutionAxiom("f(real x, 1)", "x");
+
+                    const Tensor leaf("real x");
+                    const Tensor replacement = MakeLiteral(test_namespace, int64_t{ -1 });
+                    const Tensor dag = GenerateDag(test_namespace, random, size, leaf);
+                    auto const predicate = [&](const Tensor & i_tensor) {
+                        return i_tensor.GetExpression() == leaf.GetExpression() ? replacement : i_tensor; };
+
+                    i_runner.Run("substitute_by_predicate_canonicalize_each", size, 0, [&] {
+                        Consume(SubstituteByPredicate(test_namespace, dag, predicate,
+                            SubstitutionRebuild::CanonicalizeEachNode));
+                    });
+
+                    i_runner.Run("substitute_by_predicate_canonicalize_result", size, 0, [&] {
+                        Consume(SubstituteByPredicate(test_namespace, dag, predicate,
+                            SubstitutionRebuild::CanonicalizeResult));
+                    });
+                }
+            }
+        }
+
+    } // namespace bench
+
+} // namespace djup
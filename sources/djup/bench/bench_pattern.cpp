@@ -0,0 +1,381 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/namespace.h>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <private/o2o_pattern/o2o_substitution_template.h>
+#include <private/m2o_pattern/m2o_discrimination_tree.h>
+#include <private/m2o_pattern/m2o_substitution_graph.h>
+#include <bench/bench_utils.h>
+#include <core/to_string.h>
+#include <core/thread_pool.h>
+#include <algorithm>
+#include <memory>
+
+namespace djup
+{
+    namespace bench
+    {
+        namespace
+        {
+            void CollectSubExpressions(const Tensor & i_source, std::vector<Tensor> & o_dest)
+            {
+                o_dest.push_back(i_source);
+                for (const Tensor & argument : i_source.GetExpression()->GetArguments())
+                    CollectSubExpressions(argument, o_dest);
+            }
+
+            std::string GenerateVariadicTarget(Random & i_random,
+                std::string_view i_function_name, size_t i_argument_count)
+            {
+                std::string result = ToString(i_function_name, "(");
+                for (size_t i = 0; i < i_argument_count; i++)
+                {
+                    if (i != 0)
+                        result += ", ";
+                    result += ToString(i_random.Below(10));
+                }
+                result += ")";
+                return result;
+            }
+
+            /* Patterns matching the expressions generated by GenerateExpressionSource.
+               Half of the functions of a generated expression have a pattern. */
+            std::vector<Tensor> GeneratePatterns(size_t i_count)
+            {
+                std::vector<Tensor> patterns;
+                for (size_t i = 0; i < i_count; i++)
+                {
+                    switch (i % 3)
+                    {
+                    case 0: patterns.push_back(Tensor(ToString("f", i, "(any x)"))); break;
+                    case 1: patterns.push_back(Tensor(ToString("f", i, "(any x, any y)"))); break;
+                    default: patterns.push_back(Tensor(ToString("f", i, "(any x, 1, any y)"))); break;
+                    }
+                }
+                return patterns;
+            }
+
+            /* Like GenerateExpressionSource, but two fifths of the functions are Equals, that is
+               commutative, or Add, that is associative and commutative */
+            void GenerateMixedExpressionSource(Random & i_random, size_t i_node_count,
+                size_t i_function_count, std::string & o_dest)
+            {
+                if (i_node_count == 1)
+                {
+                    o_dest += ToString(i_random.Below(10));
+                    return;
+                }
+
+                const size_t kind = i_random.Below(5);
+                const size_t arity = std::min(kind < 2 ? 2 : 1 + i_random.Below(3), i_node_count - 1);
+                const size_t extra_nodes = i_node_count - 1 - arity;
+
+                // split the extra nodes among the arguments
+                std::vector<size_t> cuts;
+                for (size_t i = 0; i + 1 < arity; i++)
+                    cuts.push_back(i_random.Below(extra_nodes + 1));
+                cuts.push_back(extra_nodes);
+                std::sort(cuts.begin(), cuts.end());
+
+                if (kind == 0)
+                    o_dest += "Equals(";
+                else if (kind == 1)
+                    o_dest += "Add(";
+                else
+                    o_dest += ToString("f", i_random.Below(i_function_count), "(");
+                size_t prev_cut = 0;
+                for (size_t i = 0; i < arity; i++)
+                {
+                    if (i != 0)
+                        o_dest += ", ";
+                    GenerateMixedExpressionSource(i_random, 1 + cuts[i] - prev_cut, i_function_count, o_dest);
+                    prev_cut = cuts[i];
+                }
+                o_dest += ")";
+            }
+
+            /* Patterns matching the expressions generated by GenerateMixedExpressionSource. Two
+               fifths of the patterns have a commutative root, and two fifths an associative one. */
+            std::vector<Tensor> GenerateMixedPatterns(size_t i_count)
+            {
+                std::vector<Tensor> patterns;
+                for (size_t i = 0; i < i_count; i++)
+                {
+                    switch (i % 5)
+                    {
+                    case 0: patterns.push_back(Tensor(ToString("Equals(f", i, "(any x), any y)"))); break;
+                    case 1: patterns.push_back(Tensor(ToString("Equals(f", i, "(any x), f", i + 1, "(any y, any z))"))); break;
+                    case 2: patterns.push_back(Tensor(ToString("Add(f", i, "(any x), any y)"))); break;
+                    case 3: patterns.push_back(Tensor(ToString("Add(f", i, "(any x, any y), any z)"))); break;
+                    default: patterns.push_back(Tensor(ToString("f", i, "(any x, Equals(any y, 1))"))); break;
+                    }
+                }
+                return patterns;
+            }
+
+            /* Substitutes the i-th pattern with gi(x). If i_rhs_depth is not zero, x is nested in
+               i_rhs_depth nodes h(x, h(x, ... h(x, 1))) of the right-hand side */
+            std::shared_ptr<Namespace> MakeAxiomNamespace(Span<const Tensor> i_patterns, size_t i_rhs_depth = 0)
+            {
+                std::string rhs_argument = i_rhs_depth != 0 ? "1" : "x";
+                for (size_t depth = 0; depth < i_rhs_depth; depth++)
+                    rhs_argument = ToString("h(x, ", rhs_argument, ")");
+
+                auto result = std::make_shared<Namespace>("Bench", GetStandardNamespace());
+                for (size_t i = 0; i < i_patterns.size(); i++)
+                    result->AddSubstitutionAxiom(i_patterns[i], Tensor(ToString("g", i, "(", rhs_argument, ")")));
+                return result;
+            }
+        }
+
+        void BenchPatterns(BenchmarkRunner & i_runner)
+        {
+            const Namespace & standard_namespace = *GetStandardNamespace();
+
+            // the workers are started only if some parallel benchmark is going to run
+            const std::unique_ptr<ThreadPool> thread_pool = i_runner.IsEnabled("o2o_match_all_parallel") ||
+                i_runner.IsEnabled("o2o_match_all_associative_parallel") ||
+                i_runner.IsEnabled("o2o_match_batch_parallel") ? std::make_unique<ThreadPool>() : nullptr;
+
+            // one pattern against one target
+            for (size_t size : i_runner.GetOptions().m_sizes)
+            {
+                Random random(i_runner.GetOptions().m_seed);
+                const Tensor target(GenerateVariadicTarget(random, "f", size));
+                const o2o_pattern::Pattern pattern(standard_namespace, "f(real x..., 1, real y...)");
+
+                i_runner.Run("o2o_match_one", size, 1, [&] {
+                    Consume(pattern.MatchOne(target, nullptr).has_value());
+                });
+
+                i_runner.Run("o2o_match_all", size, 1, [&] {
+                    Consume(pattern.MatchAll(target, nullptr).size());
+                });
+
+                i_runner.Run("o2o_match_all_parallel", size, 1, [&] {
+                    Consume(pattern.MatchAll(target, *thread_pool).size());
+                });
+
+                // the right-hand side of a rule instantiated with every solution
+                {
+                    const std::vector<o2o_pattern::MatchResult> solutions = i_runner.IsEnabled("o2o_apply_substitutions") ||
+                        i_runner.IsEnabled("o2o_instantiate_template") ? pattern.MatchAll(target, nullptr) :
+                        std::vector<o2o_pattern::MatchResult>{};
+                    const Tensor right_hand_side("g(Sin(real y)..., h(real x..., 2), real x...)");
+                    const o2o_pattern::SubstitutionTemplate substitution_template(right_hand_side);
+
+                    i_runner.Run("o2o_apply_substitutions", size, 1, [&] {
+                        for (const o2o_pattern::MatchResult & solution : solutions)
+                            Consume(o2o_pattern::ApplySubstitutions(standard_namespace, right_hand_side, solution.m_substitutions));
+                    });
+
+                    i_runner.Run("o2o_instantiate_template", size, 1, [&] {
+                        for (const o2o_pattern::MatchResult & solution : solutions)
+                            Consume(substitution_template.Instantiate(standard_namespace, solution.m_substitutions));
+                    });
+                }
+
+                // one pattern against a batch of small targets, half of which have the wrong root
+                {
+                    std::vector<Tensor> batch;
+                    for (size_t index = 0; index < size; index++)
+                        batch.emplace_back(GenerateVariadicTarget(random, index % 2 ? "f" : "g", 8));
+
+                    i_runner.Run("o2o_match_all_loop", size, 1, [&] {
+                        size_t solutions = 0;
+                        for (const Tensor & batch_target : batch)
+                            solutions += pattern.MatchAll(batch_target, nullptr).size();
+                        Consume(solutions);
+                    });
+
+                    i_runner.Run("o2o_match_batch", size, 1, [&] {
+                        Consume(pattern.MatchBatch(batch).GetSolutionCount());
+                    });
+
+                    i_runner.Run("o2o_match_batch_parallel", size, 1, [&] {
+                        Consume(pattern.MatchBatch(batch, o2o_pattern::Pattern::SolutionType::All,
+                            thread_pool.get()).GetSolutionCount());
+                    });
+                }
+
+                /* the arguments of a commutative function are assigned to the pattern arguments,
+                   rather than matched in every order */
+                {
+                    const std::string constants = GenerateVariadicTarget(random, "", size);
+                    const std::string arguments = constants.substr(1, constants.size() - 2);
+                    const Tensor commutative_target(ToString("Equals(Sin(1), ", arguments, ", Cos(2))"));
+                    const o2o_pattern::Pattern commutative_pattern(standard_namespace,
+                        Tensor(ToString("Equals(", arguments, ", Cos(real y), Sin(real x))")));
+
+                    i_runner.Run("o2o_match_all_commutative", size, 1, [&] {
+                        Consume(commutative_pattern.MatchAll(commutative_target, nullptr).size());
+                    });
+                }
+
+                /* nested variadic groups, every inner group is closed many times
+                   before the substitutions are materialized */
+                {
+                    std::string nested_target = "f(";
+                    for (size_t index = 0; index < size; index++)
+                        nested_target += ToString(index == 0 ? "" : ", ", "g(", index, ", ", index + 1, ", 1)");
+                    nested_target += ")";
+                    const Tensor nested(nested_target);
+                    const o2o_pattern::Pattern nested_pattern(standard_namespace, "f(g(real x..., 1)...)");
+
+                    i_runner.Run("o2o_match_all_nested", size, 1, [&] {
+                        Consume(nested_pattern.MatchAll(nested, nullptr).size());
+                    });
+                }
+
+                /* in associative functions every identifier can match a sequence of arguments,
+                   so the number of solutions grows with the square of the size */
+                if (size <= 64)
+                {
+                    const Tensor associative_target(GenerateVariadicTarget(random, "MatMul", size));
+                    const o2o_pattern::Pattern associative_pattern(standard_namespace, "MatMul(real x, real y, real z)");
+
+                    i_runner.Run("o2o_match_all_associative", size, 1, [&] {
+                        Consume(associative_pattern.MatchAll(associative_target, nullptr).size());
+                    });
+
+                    i_runner.Run("o2o_match_all_associative_parallel", size, 1, [&] {
+                        Consume(associative_pattern.MatchAll(associative_target, *thread_pool).size());
+                    });
+                }
+            }
+
+            // many rules against all the nodes of an expression
+            for (size_t rule_count : i_runner.GetOptions().m_rule_counts)
+            {
+                const std::vector<Tensor> patterns = GeneratePatterns(rule_count);
+
+                std::vector<o2o_pattern::Pattern> o2o_patterns;
+                m2o_pattern::DiscriminationTree discrimination_tree(standard_namespace);
+                for (size_t i = 0; i < patterns.size(); i++)
+                {
+                    o2o_patterns.emplace_back(standard_namespace, patterns[i]);
+                    discrimination_tree.AddPattern(NumericCast<uint32_t>(i), patterns[i]);
+                }
+                discrimination_tree.Compile();
+
+                for (size_t size : i_runner.GetOptions().m_sizes)
+                {
+                    Random random(i_runner.GetOptions().m_seed);
+                    const Tensor target(GenerateExpressionSource(random, size, 2 * rule_count));
+
+                    std::vector<Tensor> sub_expressions;
+                    CollectSubExpressions(target, sub_expressions);
+
+                    i_runner.Run("o2o_match_each_pattern", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                            for (const o2o_pattern::Pattern & pattern : o2o_patterns)
+                                matches += pattern.MatchAll(sub_expression, nullptr).size();
+                        Consume(matches);
+                    });
+
+                    i_runner.Run("m2o_find_matches", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                            matches += discrimination_tree.FindMatches(sub_expression).size();
+                        Consume(matches);
+                    });
+
+                    // the same graph is reused for all the sub-expressions
+                    m2o_pattern::SubstitutionGraph all_solutions(discrimination_tree);
+                    i_runner.Run("m2o_substitution_graph_all", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                        {
+                            all_solutions.FindMatches(standard_namespace, sub_expression);
+                            matches += all_solutions.GetSolutionCount();
+                        }
+                        Consume(matches);
+                    });
+
+                    m2o_pattern::SubstitutionGraph any_solution(discrimination_tree,
+                        m2o_pattern::SubstitutionGraph::SolutionType::Any);
+                    i_runner.Run("m2o_substitution_graph_any", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                        {
+                            any_solution.FindMatches(standard_namespace, sub_expression);
+                            matches += any_solution.GetSolutionCount();
+                        }
+                        Consume(matches);
+                    });
+
+                    // a new namespace for every iteration, so that the canonicalization cache is empty
+                    std::shared_ptr<Namespace> cold_namespace;
+                    i_runner.Run("canonicalize_cold", size, rule_count, [&] {
+                        Consume(cold_namespace->Canonicalize(target));
+                    }, [&] {
+                        cold_namespace = MakeAxiomNamespace(patterns);
+                    });
+
+                    // every substitution builds a chain of nodes, that is canonicalized once
+                    i_runner.Run("canonicalize_cold_nested_rhs", size, rule_count, [&] {
+                        Consume(cold_namespace->Canonicalize(target));
+                    }, [&] {
+                        cold_namespace = MakeAxiomNamespace(patterns, 16);
+                    });
+
+                    const std::shared_ptr<Namespace> warm_namespace = i_runner.IsEnabled("canonicalize_warm") ?
+                        MakeAxiomNamespace(patterns) : nullptr;
+                    i_runner.Run("canonicalize_warm", size, rule_count, [&] {
+                        Consume(warm_namespace->Canonicalize(target));
+                    });
+                }
+            }
+
+            /* many rules with commutative and associative functions against all the nodes of an
+               expression. Commutative patterns are compiled in the automaton, while associative ones
+               are matched one by one with o2o_pattern::Pattern. */
+            for (size_t rule_count : i_runner.GetOptions().m_rule_counts)
+            {
+                const std::vector<Tensor> patterns = GenerateMixedPatterns(rule_count);
+
+                std::vector<o2o_pattern::Pattern> o2o_patterns;
+                m2o_pattern::DiscriminationTree discrimination_tree(standard_namespace);
+                for (size_t i = 0; i < patterns.size(); i++)
+                {
+                    o2o_patterns.emplace_back(standard_namespace, patterns[i]);
+                    discrimination_tree.AddPattern(NumericCast<uint32_t>(i), patterns[i]);
+                }
+                discrimination_tree.Compile();
+
+                for (size_t size : i_runner.GetOptions().m_sizes)
+                {
+                    Random random(i_runner.GetOptions().m_seed);
+                    std::string target_source;
+                    GenerateMixedExpressionSource(random, size, 2 * rule_count, target_source);
+                    const Tensor target(target_source);
+
+                    std::vector<Tensor> sub_expressions;
+                    CollectSubExpressions(target, sub_expressions);
+
+                    i_runner.Run("o2o_match_each_pattern_mixed", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                            for (const o2o_pattern::Pattern & pattern : o2o_patterns)
+                                matches += pattern.MatchAll(sub_expression, nullptr).size();
+                        Consume(matches);
+                    });
+
+                    i_runner.Run("m2o_find_matches_mixed", size, rule_count, [&] {
+                        size_t matches = 0;
+                        for (const Tensor & sub_expression : sub_expressions)
+                            matches += discrimination_tree.FindMatches(sub_expression).size();
+                        Consume(matches);
+                    });
+                }
+            }
+        }
+
+    } // namespace bench
+
+} // namespace djup
@@ -0,0 +1,226 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <bench/bench_utils.h>
+#include <core/from_chars.h>
+#include <core/to_string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace djup
+{
+    namespace bench
+    {
+        namespace
+        {
+            std::vector<size_t> ParseList(std::string_view i_source)
+            {
+                std::vector<size_t> result;
+                for (;;)
+                {
+                    const size_t separator = i_source.find(',');
+                    result.push_back(Parse<size_t>(i_source.substr(0, separator)));
+                    if (separator == std::string_view::npos)
+                        return result;
+                    i_source.remove_prefix(separator + 1);
+                }
+            }
+
+            volatile uintptr_t g_sink;
+        }
+
+        std::atomic<uint64_t> & AllocationCounter()
+        {
+            static std::atomic<uint64_t> counter{ 0 };
+            return counter;
+        }
+
+        BenchmarkOptions ParseBenchmarkOptions(int i_argc, const char * const * i_argv)
+        {
+            BenchmarkOptions options;
+            for (int i = 1; i < i_argc; i++)
+            {
+                const std::string_view option = i_argv[i];
+                if (i + 1 >= i_argc)
+                    Error("Missing value for the option ", option);
+                const std::string_view value = i_argv[++i];
+
+                if (option == "--filter")
+                    options.m_filter = value;
+                else if (option == "--min-time-ms")
+                    options.m_min_time_ms = static_cast<double>(Parse<size_t>(value));
+                else if (option == "--min-iterations")
+                    options.m_min_iterations = Parse<size_t>(value);
+                else if (option == "--sizes")
+                    options.m_sizes = ParseList(value);
+                else if (option == "--rules")
+                    options.m_rule_counts = ParseList(value);
+                else if (option == "--seed")
+                    options.m_seed = Parse<uint64_t>(value);
+                else if (option == "--format")
+                {
+                    if (value == "json")
+                        options.m_format = OutputFormat::JsonLines;
+                    else if (value == "csv")
+                        options.m_format = OutputFormat::Csv;
+                    else
+                        Error("Unknown format: ", value);
+                }
+                else if (option == "--output")
+                    options.m_output_path = value;
+                else
+                    Error("Unknown option: ", option);
+            }
+            return options;
+        }
+
+        BenchmarkRunner::BenchmarkRunner(const BenchmarkOptions & i_options)
+            : m_options(i_options), m_output(&std::cout)
+        {
+            if (!m_options.m_output_path.empty())
+            {
+                m_file.open(m_options.m_output_path);
+                if (!m_file)
+                    Error("Could not open ", m_options.m_output_path);
+                m_output = &m_file;
+            }
+
+            if (m_options.m_format == OutputFormat::Csv)
+                *m_output << "benchmark,size,rules,iterations,min_ns,median_ns,mean_ns,allocations" << std::endl;
+        }
+
+        bool BenchmarkRunner::IsEnabled(std::string_view i_name) const
+        {
+            return i_name.find(m_options.m_filter) != std::string_view::npos;
+        }
+
+        void BenchmarkRunner::Run(std::string_view i_name, size_t i_size, size_t i_rules,
+            const std::function<void()> & i_body, const std::function<void()> & i_setup)
+        {
+            if (!IsEnabled(i_name))
+                return;
+
+            using Clock = std::chrono::steady_clock;
+
+            // warm up
+            if (i_setup)
+                i_setup();
+            i_body();
+
+            std::vector<double> durations;
+            double total_ns = 0;
+            uint64_t total_allocations = 0;
+            while (durations.size() < m_options.m_min_iterations ||
+                total_ns < m_options.m_min_time_ms * 1e6)
+            {
+                if (i_setup)
+                    i_setup();
+
+                const uint64_t allocations_before = AllocationCounter().load(std::memory_order_relaxed);
+                const auto start = Clock::now();
+                i_body();
+                const auto end = Clock::now();
+                total_allocations += AllocationCounter().load(std::memory_order_relaxed) - allocations_before;
+
+                const double duration = std::chrono::duration<double, std::nano>(end - start).count();
+                durations.push_back(duration);
+                total_ns += duration;
+            }
+
+            std::sort(durations.begin(), durations.end());
+            const double min_ns = durations.front();
+            const double median_ns = durations[durations.size() / 2];
+            const double mean_ns = total_ns / static_cast<double>(durations.size());
+            const double allocations = static_cast<double>(total_allocations) / static_cast<double>(durations.size());
+
+            if (m_options.m_format == OutputFormat::Csv)
+            {
+                *m_output << ToString(i_name, ",", i_size, ",", i_rules, ",", durations.size(), ",",
+                    static_cast<int64_t>(min_ns), ",", static_cast<int64_t>(median_ns), ",",
+                    static_cast<int64_t>(mean_ns), ",", allocations) << std::endl;
+            }
+            else
+            {
+                *m_output << ToString("{\"benchmark\":\"", i_name, "\",\"size\":", i_size,
+                    ",\"rules\":", i_rules, ",\"iterations\":", durations.size(),
+                    ",\"min_ns\":", static_cast<int64_t>(min_ns),
+                    ",\"median_ns\":", static_cast<int64_t>(median_ns),
+                    ",\"mean_ns\":", static_cast<int64_t>(mean_ns),
+                    ",\"allocations\":", allocations, "}") << std::endl;
+            }
+        }
+
+        uint64_t Random::Next()
+        {
+            uint64_t value = (m_state += 0x9E3779B97F4A7C15ull);
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        size_t Random::Below(size_t i_bound)
+        {
+            DJUP_ASSERT(i_bound > 0);
+            return static_cast<size_t>(Next() % i_bound);
+        }
+
+        namespace
+        {
+            void GenerateExpressionSource(Random & i_random, size_t i_node_count,
+                size_t i_function_count, std::string & o_dest)
+            {
+                DJUP_ASSERT(i_node_count > 0);
+
+                if (i_node_count == 1)
+                {
+                    o_dest += ToString(i_random.Below(10));
+                    return;
+                }
+
+                const size_t arity = std::min(1 + i_random.Below(3), i_node_count - 1);
+                const size_t extra_nodes = i_node_count - 1 - arity;
+
+                // split the extra nodes among the arguments
+                std::vector<size_t> cuts;
+                for (size_t i = 0; i + 1 < arity; i++)
+                    cuts.push_back(i_random.Below(extra_nodes + 1));
+                cuts.push_back(extra_nodes);
+                std::sort(cuts.begin(), cuts.end());
+
+                o_dest += ToString("f", i_random.Below(i_function_count), "(");
+                size_t prev_cut = 0;
+                for (size_t i = 0; i < arity; i++)
+                {
+                    if (i != 0)
+                        o_dest += ", ";
+                    GenerateExpressionSource(i_random, 1 + cuts[i] - prev_cut, i_function_count, o_dest);
+                    prev_cut = cuts[i];
+                }
+                o_dest += ")";
+            }
+        }
+
+        std::string GenerateExpressionSource(Random & i_random,
+            size_t i_node_count, size_t i_function_count)
+        {
+            std::string result;
+            GenerateExpressionSource(i_random, i_node_count, i_function_count, result);
+            return result;
+        }
+
+        void Consume(const Tensor & i_value)
+        {
+            g_sink = reinterpret_cast<uintptr_t>(i_value.GetExpression().get());
+        }
+
+        void Consume(size_t i_value)
+        {
+            g_sink = i_value;
+        }
+
+    } // namespace bench
+
+} // namespace djup
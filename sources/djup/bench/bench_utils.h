@@ -0,0 +1,117 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <djup/tensor.h>
+#include <atomic>
+#include <functional>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace djup
+{
+    namespace bench
+    {
+        enum class OutputFormat
+        {
+            JsonLines,
+            Csv
+        };
+
+        struct BenchmarkOptions
+        {
+            /** Only the benchmarks whose name contains this string are run */
+            std::string m_filter;
+
+            /** Every benchmark runs for at least this time and this number of iterations */
+            double m_min_time_ms = 200;
+            size_t m_min_iterations = 3;
+
+            /** Size of the generated expressions, in nodes or arguments */
+            std::vector<size_t> m_sizes{ 16, 128, 1024 };
+
+            /** Number of axioms or patterns */
+            std::vector<size_t> m_rule_counts{ 1, 16, 256 };
+
+            /** Seed of the generators, so that runs with the same options are reproducible */
+            uint64_t m_seed = 1;
+
+            OutputFormat m_format = OutputFormat::JsonLines;
+
+            /** If empty the results are written to the standard output */
+            std::string m_output_path;
+        };
+
+        /** Number of heap allocations made so far by all the threads. The benchmark executable
+            replaces the global operator new to increment it, so in other executables it stays zero. */
+        std::atomic<uint64_t> & AllocationCounter();
+
+        /** Parses the command line. Supported options are --filter <string>, --min-time-ms <ms>,
+            --min-iterations <count>, --sizes <list>, --rules <list>, --seed <int>, --format json|csv,
+            --output <path>. Lists are separated by commas. */
+        BenchmarkOptions ParseBenchmarkOptions(int i_argc, const char * const * i_argv);
+
+        /** Times repeated executions of benchmarks, and writes a record for every
+            benchmark, with one line per record. The record has the average number of
+            heap allocations per execution of the body, see AllocationCounter. */
+        class BenchmarkRunner
+        {
+        public:
+
+            explicit BenchmarkRunner(const BenchmarkOptions & i_options);
+
+            BenchmarkRunner(const BenchmarkRunner &) = delete;
+            BenchmarkRunner & operator = (const BenchmarkRunner &) = delete;
+
+            const BenchmarkOptions & GetOptions() const { return m_options; }
+
+            /** Returns whether a benchmark is selected by the filter */
+            bool IsEnabled(std::string_view i_name) const;
+
+            /** Calls i_body until the minimum time and iteration count are reached. i_setup,
+                if not empty, is called before every execution of the body, and is not timed. */
+            void Run(std::string_view i_name, size_t i_size, size_t i_rules,
+                const std::function<void()> & i_body,
+                const std::function<void()> & i_setup = {});
+
+        private:
+            BenchmarkOptions m_options;
+            std::ofstream m_file;
+            std::ostream * m_output;
+        };
+
+        /** Deterministic pseudo-random generator (splitmix64). Unlike the distributions of
+            the standard library, it produces the same sequence on every platform. */
+        class Random
+        {
+        public:
+
+            explicit Random(uint64_t i_seed) : m_state(i_seed) {}
+
+            uint64_t Next();
+
+            /** Returns a value in [0, i_bound) */
+            size_t Below(size_t i_bound);
+
+        private:
+            uint64_t m_state;
+        };
+
+        /** Generates the source of an expression with i_node_count nodes. Internal
+            nodes are calls to f0, f1, ... f(i_function_count - 1), with 1 to 3 arguments,
+            and leaves are integer literals. */
+        std::string GenerateExpressionSource(Random & i_random,
+            size_t i_node_count, size_t i_function_count);
+
+        /** Prevents the compiler from discarding the computation of a value */
+        void Consume(const Tensor & i_value);
+
+        void Consume(size_t i_value);
+
+    } // namespace bench
+
+} // namespace djup
@@ -10,34 +10,37 @@
 
 namespace djup
 {
+    /** Names with a special meaning. They are interned when the program starts, so comparing
+        them with another name compares two pointers. Like any inline variable, they are initialized
+        before the namespace-scope variables that follow this header in the same translation unit. */
     namespace builtin_names
     {
-        constexpr ConstexprName Stack("Stack");
-        constexpr ConstexprName Tuple("Tuple");
-        constexpr ConstexprName Namespace("Namespace");
-        constexpr ConstexprName SubstitutionAxiom("SubstitutionAxiom");
-        constexpr ConstexprName Is("is");
+        inline const Name Stack("Stack");
+        inline const Name Tuple("Tuple");
+        inline const Name Namespace("Namespace");
+        inline const Name SubstitutionAxiom("SubstitutionAxiom");
+        inline const Name Is("is");
 
-        constexpr ConstexprName Return("return");
+        inline const Name Return("return");
         
-        constexpr ConstexprName Any("any");
-        constexpr ConstexprName Bool("bool");
-        constexpr ConstexprName Int("int");
+        inline const Name Any("any");
+        inline const Name Bool("bool");
+        inline const Name Int("int");
 
-        constexpr ConstexprName RepetitionsZeroToMany("RepetitionsZeroToMany");
-        constexpr ConstexprName RepetitionsOneToMany("RepetitionsOneToMany");
-        constexpr ConstexprName RepetitionsZeroToOne("RepetitionsZeroToOne");
+        inline const Name RepetitionsZeroToMany("RepetitionsZeroToMany");
+        inline const Name RepetitionsOneToMany("RepetitionsOneToMany");
+        inline const Name RepetitionsZeroToOne("RepetitionsZeroToOne");
 
-        constexpr ConstexprName AssociativeIdentifier("AssociativeIdentifier");
+        inline const Name AssociativeIdentifier("AssociativeIdentifier");
         
-        constexpr ConstexprName If("If");
-        constexpr ConstexprName Add("Add");
-        constexpr ConstexprName Mul("Mul");
-        constexpr ConstexprName Pow("Pow");
-        constexpr ConstexprName And("And");
-        constexpr ConstexprName Or("Or");
-        constexpr ConstexprName Not("Not");
-        constexpr ConstexprName Equal("Equal");
-        constexpr ConstexprName Less("Less");
+        inline const Name If("If");
+        inline const Name Add("Add");
+        inline const Name Mul("Mul");
+        inline const Name Pow("Pow");
+        inline const Name And("And");
+        inline const Name Or("Or");
+        inline const Name Not("Not");
+        inline const Name Equal("Equal");
+        inline const Name Less("Less");
     }
 }
@@ -0,0 +1,75 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/canonicalization_cache.h>
+#include <private/expression.h>
+
+namespace djup
+{
+    CanonicalizationCache::CanonicalizationCache(size_t i_generation_capacity)
+        : m_generation_capacity(i_generation_capacity)
+    {
+        DJUP_ASSERT(i_generation_capacity > 0);
+    }
+
+    ExpressionPtr CanonicalizationCache::Find(const ExpressionPtr & i_source)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const auto current_it = m_current.find(i_source);
+        if (current_it != m_current.end())
+        {
+            m_hits++;
+            return current_it->second;
+        }
+
+        const auto previous_it = m_previous.find(i_source);
+        if (previous_it != m_previous.end())
+        {
+            m_hits++;
+            ExpressionPtr canonical = previous_it->second;
+            InsertInCurrent(i_source, canonical);
+            return canonical;
+        }
+
+        m_misses++;
+        return {};
+    }
+
+    void CanonicalizationCache::Insert(const ExpressionPtr & i_source, const ExpressionPtr & i_canonical)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        InsertInCurrent(i_source, i_canonical);
+    }
+
+    void CanonicalizationCache::InsertInCurrent(const ExpressionPtr & i_source, const ExpressionPtr & i_canonical)
+    {
+        if (m_current.size() >= m_generation_capacity)
+        {
+            m_previous = std::move(m_current);
+            m_current.clear();
+        }
+        m_current.insert_or_assign(i_source, i_canonical);
+    }
+
+    void CanonicalizationCache::Clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current.clear();
+        m_previous.clear();
+    }
+
+    CanonicalizationCacheStats CanonicalizationCache::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CanonicalizationCacheStats stats;
+        stats.m_hits = m_hits;
+        stats.m_misses = m_misses;
+        stats.m_size = m_current.size() + m_previous.size();
+        return stats;
+    }
+
+} // namespace djup
@@ -0,0 +1,60 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <djup/tensor.h>
+#include <unordered_map>
+#include <mutex>
+
+namespace djup
+{
+    struct CanonicalizationCacheStats
+    {
+        size_t m_hits{}; /**< number of lookups that have found the canonical form */
+        size_t m_misses{}; /**< number of lookups that have found nothing */
+        size_t m_size{}; /**< number of entries currently in the cache */
+    };
+
+    /** Bounded map from expressions to their canonical form. Expressions are compared by
+        identity, and the cache keeps them alive, so an address can't be reused by another
+        expression while it is a key. The cache has two generations: new entries go in the
+        current one, and when it is full the previous generation is discarded and the current
+        becomes the previous. Entries found in the previous generation are moved to the
+        current one, so that frequently used entries survive. Thread safe. */
+    class CanonicalizationCache
+    {
+    public:
+
+        explicit CanonicalizationCache(size_t i_generation_capacity = 4096);
+
+        CanonicalizationCache(const CanonicalizationCache &) = delete;
+        CanonicalizationCache & operator = (const CanonicalizationCache &) = delete;
+
+        /** Returns the canonical form of an expression, or null if it is not in the cache */
+        ExpressionPtr Find(const ExpressionPtr & i_source);
+
+        void Insert(const ExpressionPtr & i_source, const ExpressionPtr & i_canonical);
+
+        /** Removes all the entries, but not the statistics */
+        void Clear();
+
+        CanonicalizationCacheStats GetStats() const;
+
+    private:
+        using Map = std::unordered_map<ExpressionPtr, ExpressionPtr>;
+
+        void InsertInCurrent(const ExpressionPtr & i_source, const ExpressionPtr & i_canonical);
+
+    private:
+        mutable std::mutex m_mutex;
+        Map m_current;
+        Map m_previous;
+        size_t m_generation_capacity;
+        size_t m_hits{};
+        size_t m_misses{};
+    };
+
+} // namespace djup
@@ -15,6 +15,7 @@
 #include <core/bits.h>
 #include <core/hash.h>
 #include <core/flags.h>
+#include <memory>
 
 namespace djup
 {
@@ -65,56 +66,208 @@ namespace djup
             || NameIs(i_expression, builtin_names::RepetitionsOneToMany);
     }
 
+    namespace
+    {
+        /* Order of the arguments of commutative functions: constants come first, then
+           arguments are sorted by name, and only arguments with the same name are sorted
+           by hash. The order of arguments with different names does not depend on their
+           arguments, so that patterns and targets with the same structure are sorted in
+           the same way. */
+        bool CommutativeArgumentLess(const Tensor & i_first, const Tensor & i_second)
+        {
+            const Expression & first = *i_first.GetExpression();
+            const Expression & second = *i_second.GetExpression();
+
+            const bool first_is_constant = first.GetMetadata().m_is_constant;
+            if (first_is_constant != second.GetMetadata().m_is_constant)
+                return first_is_constant;
+
+            if (first.GetName() != second.GetName())
+                return first.GetName().AsStringView() < second.GetName().AsStringView();
+
+            return first.GetHash() < second.GetHash();
+        }
+    }
+
+    static_assert(alignof(Expression) <= expression_arena_alignment);
+    static_assert(sizeof(Expression) % alignof(Tensor) == 0,
+        "the arguments must be correctly aligned after the expression");
+
+    void IntrusiveAddRef(const Expression * i_expression) noexcept
+    {
+        i_expression->m_ref_count.AddRef();
+    }
+
+    namespace
+    {
+        thread_local bool t_release_queue_destroyed = false;
+
+        /* Expressions released while another expression is being destroyed are queued
+           here instead of being destroyed recursively, so that releasing a deep expression
+           does not overflow the stack. */
+        struct ReleaseQueue
+        {
+            std::vector<const Expression*> m_expressions;
+            bool m_draining = false;
+
+            ~ReleaseQueue()
+            {
+                t_release_queue_destroyed = true;
+            }
+        };
+
+        thread_local ReleaseQueue t_release_queue;
+    }
+
+    void Expression::Destroy() noexcept
+    {
+        const size_t size = AllocationSize(m_argument_count);
+        this->~Expression();
+        DeallocateExpressionStorage(this, size);
+    }
+
+    void IntrusiveRelease(const Expression * i_expression) noexcept
+    {
+        if (!i_expression->m_ref_count.Release())
+            return;
+
+        Expression * const expression = const_cast<Expression*>(i_expression);
+
+        // during the destruction of thread-local objects the queue may be gone
+        if (t_release_queue_destroyed)
+        {
+            expression->Destroy();
+            return;
+        }
+
+        ReleaseQueue & queue = t_release_queue;
+        if (queue.m_draining)
+        {
+            try
+            {
+                queue.m_expressions.push_back(expression);
+                return;
+            }
+            catch (...)
+            {
+                // out of memory, fall back to the recursive destruction
+                expression->Destroy();
+                return;
+            }
+        }
+
+        queue.m_draining = true;
+        expression->Destroy();
+        while (!queue.m_expressions.empty())
+        {
+            const Expression * const next = queue.m_expressions.back();
+            queue.m_expressions.pop_back();
+            const_cast<Expression*>(next)->Destroy();
+        }
+        queue.m_draining = false;
+    }
+
+    uint32_t IntrusiveUseCount(const Expression * i_expression) noexcept
+    {
+        return i_expression->m_ref_count.GetCount();
+    }
+
+    ExpressionPtr NewExpression()
+    {
+        void * const block = AllocateExpressionStorage(Expression::AllocationSize(0));
+        try
+        {
+            return ExpressionPtr(new(block) Expression());
+        }
+        catch (...)
+        {
+            DeallocateExpressionStorage(block, Expression::AllocationSize(0));
+            throw;
+        }
+    }
+
+    ExpressionPtr NewExpression(TensorType i_type, Name i_name,
+        Span<const Tensor> i_arguments, ExpressionMetadata i_metadata)
+    {
+        const size_t size = Expression::AllocationSize(i_arguments.size());
+        void * const block = AllocateExpressionStorage(size);
+        try
+        {
+            return ExpressionPtr(new(block) Expression(std::move(i_type), 
+                std::move(i_name), i_arguments, std::move(i_metadata)));
+        }
+        catch (...)
+        {
+            DeallocateExpressionStorage(block, size);
+            throw;
+        }
+    }
+
     Expression::Expression()
     {
         m_hash << m_name;
-        m_hash << m_arguments;
+        m_hash << GetArguments();
     }
 
     Expression::Expression(TensorType i_type, Name i_name,
             Span<const Tensor> i_arguments, ExpressionMetadata i_metadata)
-        : m_name(std::move(i_name)),
+        : m_argument_count(NumericCast<uint32_t>(i_arguments.size())),
+          m_name(std::move(i_name)),
           m_type(std::move(i_type)),
-          m_arguments(i_arguments.begin(), i_arguments.end()),
           m_metadata(std::move(i_metadata))
     {
-        static const Name non_constants[] = {builtin_names::RepetitionsZeroToMany, 
-            builtin_names::RepetitionsOneToMany, builtin_names::RepetitionsZeroToOne, builtin_names::AssociativeIdentifier};
+        Tensor * const arguments = GetArgumentStorage();
+        std::uninitialized_copy(i_arguments.begin(), i_arguments.end(), arguments);
 
-        if(!Contains(non_constants, m_name) && !m_metadata.m_is_identifier
-            && AllOf(m_arguments, djup::IsConstant))
+        try
         {
-            m_metadata.m_is_constant = true;
-        }
+            static const Name non_constants[] = {builtin_names::RepetitionsZeroToMany, 
+                builtin_names::RepetitionsOneToMany, builtin_names::RepetitionsZeroToOne, builtin_names::AssociativeIdentifier};
+
+            if(!Contains(non_constants, m_name) && !m_metadata.m_is_identifier
+                && AllOf(GetArguments(), djup::IsConstant))
+            {
+                m_metadata.m_is_constant = true;
+            }
+
+            m_metadata.m_is_repetition = m_name == builtin_names::RepetitionsZeroToMany ||
+                m_name == builtin_names::RepetitionsZeroToOne ||
+                m_name == builtin_names::RepetitionsOneToMany;
 
-        m_metadata.m_is_repetition = m_name == builtin_names::RepetitionsZeroToMany ||
-            m_name == builtin_names::RepetitionsZeroToOne ||
-            m_name == builtin_names::RepetitionsOneToMany;
+            if(HasFlag(GetFunctionFlags(*this), FunctionFlags::Commutative))
+            {
+                std::sort(arguments, arguments + m_argument_count, CommutativeArgumentLess);
+            }
+            m_hash << m_name;
+            m_hash << GetArguments();
 
-        if(HasFlag(GetFunctionFlags(*this), FunctionFlags::Commutative))
+            /* the highest bit of the hash is clear for constants and set for
+               non-constants, so a constant never has the same hash of a
+               non-constant expression. */
+            auto hash = m_hash.GetValue();
+            if(m_metadata.m_is_constant)
+                hash &= ~bit_reverse<decltype(hash)>(0);
+            else
+                hash |= bit_reverse<decltype(hash)>(0);
+            m_hash = HashFromValue(hash);
+
+            #if DJUP_DEBUG_STRING
+                StringBuilder dest;
+                // the depth is limited, otherwise building a deep expression would take quadratic time
+                ToSimplifiedString(dest, *this, FormatFlags::Tidy, 8);
+                m_debug_string = dest.StealString();
+            #endif
+        }
+        catch (...)
         {
-            std::sort(m_arguments.begin(), m_arguments.end(), 
-                [](const Tensor & i_first, const Tensor & i_second){
-                    return i_first.GetExpression()->GetHash() < i_second.GetExpression()->GetHash(); });
+            std::destroy_n(arguments, m_argument_count);
+            throw;
         }
-        m_hash << m_name;
-        m_hash << m_arguments;
-
-        /* constants have always lower hash than non-constants, so that
-           they appear first after sorting commutative function arguments
-           and parameters. */
-        auto hash = m_hash.GetValue();
-        if(m_metadata.m_is_constant)
-            hash &= ~bit_reverse<decltype(hash)>(0);
-        else
-            hash |= bit_reverse<decltype(hash)>(0);
-        m_hash = HashFromValue(hash);
+    }
 
-        #if DJUP_DEBUG_STRING
-            StringBuilder dest;
-            ToSimplifiedString(dest, *this, FormatFlags::Tidy, std::numeric_limits<size_t>::max());
-            m_debug_string = dest.StealString();
-        #endif
+    Expression::~Expression()
+    {
+        std::destroy_n(GetArgumentStorage(), m_argument_count);
     }
 
     Hash & operator << (Hash & i_dest, const Tensor & i_src)
@@ -134,6 +287,10 @@ namespace djup
 
     bool AlwaysEqual(const Expression & i_first, const Expression & i_second)
     {
+        // shared subexpressions (always the case with hash-consing) are equal
+        if(&i_first == &i_second)
+            return true;
+
         if(i_first.GetHash() != i_second.GetHash())
             return false;
 
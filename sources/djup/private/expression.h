@@ -13,6 +13,7 @@
 #include <djup/tensor.h>
 #include <private/tensor_type.h>
 #include <private/uint_interval.h>
+#include <private/expression_arena.h>
 
 namespace djup
 {
@@ -28,38 +29,82 @@ namespace djup
         bool m_is_repetition = false;
     };
 
+    /** Immutable node of an expression tree. The arguments are stored right after the
+        object, in the same memory block, so expressions can only be created with
+        NewExpression. */
     class Expression
     {
     public:
 
-        Expression();
+        Expression(const Expression &) = delete;
+        Expression & operator = (const Expression &) = delete;
 
-        Expression(TensorType i_type, Name i_name, 
-            Span<const Tensor> i_arguments, ExpressionMetadata i_metadata);
+        ~Expression();
 
         const Name & GetName() const { return m_name; }
 
         Hash GetHash() const { return m_hash; }
 
-        const Tensor & GetArgument(size_t i_index) const { return m_arguments[i_index]; }
+        const Tensor & GetArgument(size_t i_index) const
+        {
+            DJUP_ASSERT(i_index < m_argument_count);
+            return GetArgumentStorage()[i_index];
+        }
 
-        const std::vector<Tensor> & GetArguments() const { return m_arguments; }
+        Span<const Tensor> GetArguments() const { return { GetArgumentStorage(), m_argument_count }; }
 
         const ExpressionMetadata & GetMetadata() const { return m_metadata; }
 
         const TensorType & GetType() const { return m_type; }
 
     private:
+
+        Expression();
+
+        Expression(TensorType i_type, Name i_name, 
+            Span<const Tensor> i_arguments, ExpressionMetadata i_metadata);
+
+        Tensor * GetArgumentStorage() const
+        {
+            return const_cast<Tensor*>(reinterpret_cast<const Tensor*>(this + 1));
+        }
+
+        static size_t AllocationSize(size_t i_argument_count)
+        {
+            return sizeof(Expression) + i_argument_count * sizeof(Tensor);
+        }
+
+        /** Destroys the expression and deallocates its storage */
+        void Destroy() noexcept;
+
+        friend ExpressionPtr NewExpression();
+        friend ExpressionPtr NewExpression(TensorType i_type, Name i_name,
+            Span<const Tensor> i_arguments, ExpressionMetadata i_metadata);
+
+        friend void IntrusiveAddRef(const Expression * i_expression) noexcept;
+        friend void IntrusiveRelease(const Expression * i_expression) noexcept;
+        friend uint32_t IntrusiveUseCount(const Expression * i_expression) noexcept;
+
+    private:
+        mutable RefCounter<true> m_ref_count; // expressions are shared between threads by hash-consing
+        uint32_t m_argument_count{};
         Hash m_hash;
         Name m_name;
         TensorType m_type;
-        std::vector<Tensor> m_arguments;
         ExpressionMetadata m_metadata;
         #if DJUP_DEBUG_STRING
             std::string m_debug_string;
         #endif
+        // the arguments follow
     };
 
+    /** Creates an empty expression in the expression arena */
+    ExpressionPtr NewExpression();
+
+    /** Creates an expression in the expression arena */
+    ExpressionPtr NewExpression(TensorType i_type, Name i_name,
+        Span<const Tensor> i_arguments, ExpressionMetadata i_metadata);
+
     inline Hash & operator << (Hash & i_dest, const Expression & i_src)
     {
         return i_dest << i_src.GetHash();
@@ -0,0 +1,242 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/expression_arena.h>
+#include <core/memory.h>
+#include <atomic>
+#include <mutex>
+
+namespace djup
+{
+    namespace
+    {
+        constexpr size_t s_chunk_size = 64 * 1024;
+        constexpr size_t s_max_small_size = 512;
+        constexpr size_t s_size_class_count = s_max_small_size / expression_arena_alignment;
+
+        struct FreeBlock
+        {
+            FreeBlock * m_next;
+        };
+
+        size_t SizeClassOf(size_t i_size)
+        {
+            DJUP_ASSERT(i_size > 0 && i_size <= s_max_small_size);
+            return (i_size - 1) / expression_arena_alignment;
+        }
+
+        size_t SizeOfClass(size_t i_size_class)
+        {
+            return (i_size_class + 1) * expression_arena_alignment;
+        }
+
+        /** State shared by all the threads. When a thread exits its free-lists are
+            moved here, and they are adopted by threads with an empty free-list. */
+        class Depot
+        {
+        public:
+
+            void * NewChunk()
+            {
+                m_chunk_count.fetch_add(1, std::memory_order_relaxed);
+                return aligned_allocate(s_chunk_size, expression_arena_alignment);
+            }
+
+            /** Adds a list of blocks, from i_first to i_last, to the free-list of a size class */
+            void PushList(size_t i_size_class, FreeBlock * i_first, FreeBlock * i_last)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_free_lists[i_size_class] == nullptr)
+                    m_non_empty_lists.fetch_add(1, std::memory_order_relaxed);
+                i_last->m_next = m_free_lists[i_size_class];
+                m_free_lists[i_size_class] = i_first;
+            }
+
+            /** Removes and returns the whole free-list of a size class. Returns
+                nullptr if it's empty. */
+            FreeBlock * TakeList(size_t i_size_class)
+            {
+                if (m_non_empty_lists.load(std::memory_order_relaxed) == 0)
+                    return nullptr;
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                FreeBlock * const list = m_free_lists[i_size_class];
+                if (list != nullptr)
+                {
+                    m_free_lists[i_size_class] = nullptr;
+                    m_non_empty_lists.fetch_sub(1, std::memory_order_relaxed);
+                }
+                return list;
+            }
+
+            size_t GetChunkCount() const
+            {
+                return m_chunk_count.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::mutex m_mutex;
+            FreeBlock * m_free_lists[s_size_class_count]{};
+            std::atomic<size_t> m_non_empty_lists{0};
+            std::atomic<size_t> m_chunk_count{0};
+        };
+
+        Depot & GetDepot()
+        {
+            // never destroyed, as expressions may be released during the static destruction
+            static Depot & depot = *new Depot;
+            return depot;
+        }
+
+        class ThreadCache
+        {
+        public:
+
+            ThreadCache() = default;
+
+            ThreadCache(const ThreadCache &) = delete;
+            ThreadCache & operator = (const ThreadCache &) = delete;
+
+            void * Allocate(size_t i_size_class)
+            {
+                FreeBlock * & free_list = m_free_lists[i_size_class];
+                if (free_list != nullptr)
+                {
+                    FreeBlock * const block = free_list;
+                    free_list = block->m_next;
+                    return block;
+                }
+
+                if (FreeBlock * const adopted = GetDepot().TakeList(i_size_class))
+                {
+                    free_list = adopted->m_next;
+                    return adopted;
+                }
+
+                // the remainder of the current chunk, if any, is wasted
+                const size_t size = SizeOfClass(i_size_class);
+                if (static_cast<size_t>(m_bump_end - m_bump) < size)
+                {
+                    m_bump = static_cast<char*>(GetDepot().NewChunk());
+                    m_bump_end = m_bump + s_chunk_size;
+                }
+                void * const block = m_bump;
+                m_bump += size;
+                return block;
+            }
+
+            void Deallocate(void * i_block, size_t i_size_class) noexcept
+            {
+                FreeBlock * const block = static_cast<FreeBlock*>(i_block);
+                block->m_next = m_free_lists[i_size_class];
+                m_free_lists[i_size_class] = block;
+            }
+
+            ~ThreadCache()
+            {
+                for (size_t size_class = 0; size_class < s_size_class_count; size_class++)
+                {
+                    FreeBlock * const first = m_free_lists[size_class];
+                    if (first != nullptr)
+                    {
+                        FreeBlock * last = first;
+                        while (last->m_next != nullptr)
+                            last = last->m_next;
+                        GetDepot().PushList(size_class, first, last);
+                    }
+                }
+            }
+
+        private:
+            FreeBlock * m_free_lists[s_size_class_count]{};
+            char * m_bump = nullptr;
+            char * m_bump_end = nullptr;
+        };
+
+        thread_local ThreadCache * t_thread_cache = nullptr;
+        thread_local bool t_thread_cache_destroyed = false;
+
+        struct ThreadCacheOwner
+        {
+            ThreadCache m_cache;
+
+            ThreadCacheOwner()
+            {
+                t_thread_cache = &m_cache;
+            }
+
+            ~ThreadCacheOwner()
+            {
+                t_thread_cache = nullptr;
+                t_thread_cache_destroyed = true;
+            }
+        };
+
+        /** Returns nullptr if the cache of the thread has already been destroyed */
+        ThreadCache * GetThreadCache()
+        {
+            if (t_thread_cache == nullptr && !t_thread_cache_destroyed)
+            {
+                thread_local ThreadCacheOwner owner;
+            }
+            return t_thread_cache;
+        }
+
+    } // anonymous namespace
+
+    void * AllocateExpressionStorage(size_t i_size)
+    {
+        if (i_size > s_max_small_size)
+            return aligned_allocate(i_size, expression_arena_alignment);
+
+        const size_t size_class = SizeClassOf(i_size);
+        if (ThreadCache * const cache = GetThreadCache())
+            return cache->Allocate(size_class);
+
+        // the thread is exiting: don't use the cache
+        if (FreeBlock * const list = GetDepot().TakeList(size_class))
+        {
+            if (list->m_next != nullptr)
+            {
+                FreeBlock * last = list->m_next;
+                while (last->m_next != nullptr)
+                    last = last->m_next;
+                GetDepot().PushList(size_class, list->m_next, last);
+            }
+            return list;
+        }
+        return aligned_allocate(SizeOfClass(size_class), expression_arena_alignment);
+    }
+
+    void DeallocateExpressionStorage(void * i_block, size_t i_size) noexcept
+    {
+        if (i_size > s_max_small_size)
+        {
+            aligned_deallocate(i_block, i_size, expression_arena_alignment);
+            return;
+        }
+
+        const size_t size_class = SizeClassOf(i_size);
+        if (ThreadCache * const cache = GetThreadCache())
+        {
+            cache->Deallocate(i_block, size_class);
+        }
+        else
+        {
+            FreeBlock * const block = static_cast<FreeBlock*>(i_block);
+            GetDepot().PushList(size_class, block, block);
+        }
+    }
+
+    ExpressionArenaStats GetExpressionArenaStats()
+    {
+        ExpressionArenaStats stats;
+        stats.m_chunk_count = GetDepot().GetChunkCount();
+        stats.m_reserved_bytes = stats.m_chunk_count * s_chunk_size;
+        return stats;
+    }
+
+} // namespace djup
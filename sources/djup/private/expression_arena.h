@@ -0,0 +1,33 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <cstddef>
+
+namespace djup
+{
+    /** Alignment of all the blocks returned by AllocateExpressionStorage */
+    constexpr size_t expression_arena_alignment = 16;
+
+    /** Allocates a memory block for an expression node. Small sizes are rounded up
+        to a size class, and served by a per-thread free-list of the class or, if it
+        is empty, by a bump-pointer in a per-thread chunk. Bigger sizes are forwarded
+        to aligned_allocate. Chunks are never returned to the system, so the memory of
+        deallocated blocks can only be reused by other expressions. Thread safe. */
+    [[nodiscard]] void * AllocateExpressionStorage(size_t i_size);
+
+    /** Deallocates a block returned by AllocateExpressionStorage, possibly from
+        another thread. i_size must be the same passed to the allocation. */
+    void DeallocateExpressionStorage(void * i_block, size_t i_size) noexcept;
+
+    struct ExpressionArenaStats
+    {
+        size_t m_chunk_count{}; /**< number of chunks allocated by all the threads */
+        size_t m_reserved_bytes{}; /**< total size of the chunks */
+    };
+
+    ExpressionArenaStats GetExpressionArenaStats();
+
+} // namespace djup
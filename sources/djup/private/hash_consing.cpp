@@ -0,0 +1,191 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/hash_consing.h>
+#include <private/expression.h>
+#include <core/algorithms.h>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+
+namespace djup
+{
+    namespace
+    {
+        bool StructurallyIdentical(const Expression & i_first, const Expression & i_second)
+        {
+            if (i_first.GetHash() != i_second.GetHash() ||
+                i_first.GetName() != i_second.GetName())
+                return false;
+
+            const ExpressionMetadata & first_metadata = i_first.GetMetadata();
+            const ExpressionMetadata & second_metadata = i_second.GetMetadata();
+            if (first_metadata.m_is_literal != second_metadata.m_is_literal ||
+                first_metadata.m_is_identifier != second_metadata.m_is_identifier)
+                return false;
+
+            const size_t argument_count = i_first.GetArguments().size();
+            if (argument_count != i_second.GetArguments().size())
+                return false;
+
+            // arguments are compared by identity, as they are supposed to be already shared
+            for (size_t argument_index = 0; argument_index < argument_count; argument_index++)
+                if (i_first.GetArgument(argument_index).GetExpression() !=
+                        i_second.GetArgument(argument_index).GetExpression())
+                    return false;
+
+            return i_first.GetType() == i_second.GetType();
+        }
+
+        /** Global table of shared expressions. The table is split in shards, each
+            protected by its own mutex, so that threads creating unrelated expressions
+            rarely contend. The table holds a strong reference to every expression, and
+            expressions not referenced anywhere else are purged when a shard grows. */
+        class HashConsingTable
+        {
+        public:
+
+            ExpressionPtr Intern(ExpressionPtr && i_expression)
+            {
+                const uint64_t hash = i_expression->GetHash().GetValue();
+                Shard & shard = m_shards[ShardIndex(hash)];
+
+                std::lock_guard<std::mutex> lock(shard.m_mutex);
+
+                const auto range = shard.m_expressions.equal_range(hash);
+                for (auto it = range.first; it != range.second; ++it)
+                {
+                    if (StructurallyIdentical(*it->second, *i_expression))
+                    {
+                        shard.m_hits++;
+                        return it->second;
+                    }
+                }
+
+                shard.m_misses++;
+                if (shard.m_expressions.size() >= shard.m_purge_threshold)
+                {
+                    PurgeShard(shard);
+                    shard.m_purge_threshold = Max(s_min_purge_threshold, shard.m_expressions.size() * 2);
+                }
+
+                shard.m_expressions.insert({ hash, i_expression });
+                return std::move(i_expression);
+            }
+
+            HashConsingStats GetStats()
+            {
+                HashConsingStats stats;
+                for (Shard & shard : m_shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard.m_mutex);
+                    stats.m_expression_count += shard.m_expressions.size();
+                    stats.m_hits += shard.m_hits;
+                    stats.m_misses += shard.m_misses;
+                }
+                return stats;
+            }
+
+            void Purge()
+            {
+                /* releasing an expression may leave its arguments referenced only by
+                   the table, possibly in another shard, so loop until nothing changes */
+                size_t removed;
+                do {
+                    removed = 0;
+                    for (Shard & shard : m_shards)
+                    {
+                        std::lock_guard<std::mutex> lock(shard.m_mutex);
+                        removed += PurgeShard(shard);
+                    }
+                } while (removed != 0);
+            }
+
+        private:
+
+            struct Shard
+            {
+                std::mutex m_mutex;
+                std::unordered_multimap<uint64_t, ExpressionPtr> m_expressions;
+                size_t m_purge_threshold{ s_min_purge_threshold };
+                size_t m_hits{};
+                size_t m_misses{};
+            };
+
+            static size_t ShardIndex(uint64_t i_hash)
+            {
+                // the highest bit of expression hashes tells constants, so it's skipped
+                return static_cast<size_t>((i_hash * 0x9E3779B97F4A7C15ull) >> 59) % s_shard_count;
+            }
+
+            /** Removes all the expressions referenced only by the table. The mutex
+                of the shard must be locked by the caller. Returns the removed count. */
+            static size_t PurgeShard(Shard & i_shard)
+            {
+                size_t removed = 0, removed_in_pass;
+                do {
+                    removed_in_pass = 0;
+                    for (auto it = i_shard.m_expressions.begin(); it != i_shard.m_expressions.end(); )
+                    {
+                        if (it->second.use_count() == 1)
+                        {
+                            it = i_shard.m_expressions.erase(it);
+                            removed_in_pass++;
+                        }
+                        else
+                            ++it;
+                    }
+                    removed += removed_in_pass;
+                } while (removed_in_pass != 0);
+                return removed;
+            }
+
+        private:
+            constexpr static size_t s_shard_count = 16;
+            constexpr static size_t s_min_purge_threshold = 1024;
+            Shard m_shards[s_shard_count];
+        };
+
+        HashConsingTable & GetHashConsingTable()
+        {
+            static HashConsingTable table;
+            return table;
+        }
+
+        std::atomic<bool> g_hash_consing_enabled{ false };
+
+    } // anonymous namespace
+
+    void EnableHashConsing(bool i_enable)
+    {
+        g_hash_consing_enabled.store(i_enable, std::memory_order_relaxed);
+    }
+
+    bool IsHashConsingEnabled()
+    {
+        return g_hash_consing_enabled.load(std::memory_order_relaxed);
+    }
+
+    ExpressionPtr HashConsExpression(
+        ExpressionPtr && i_expression)
+    {
+        if (!IsHashConsingEnabled())
+            return std::move(i_expression);
+
+        return GetHashConsingTable().Intern(std::move(i_expression));
+    }
+
+    HashConsingStats GetHashConsingStats()
+    {
+        return GetHashConsingTable().GetStats();
+    }
+
+    void PurgeHashConsingTable()
+    {
+        GetHashConsingTable().Purge();
+    }
+
+} // namespace djup
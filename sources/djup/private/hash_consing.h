@@ -0,0 +1,44 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <djup/tensor.h>
+
+namespace djup
+{
+    class Expression;
+
+    /** Enables or disables hash-consing. While hash-consing is enabled, MakeExpression
+        shares a single Expression among all the structurally identical nodes it creates,
+        so that equal expressions are also identical, and AlwaysEqual on them reduces to
+        a pointer comparison. Two nodes are structurally identical if they have the same
+        name, type, literal and identifier flags, and their arguments are the same objects.
+        Hash-consing is disabled by default. Expressions created while it was disabled are
+        never shared. */
+    void EnableHashConsing(bool i_enable);
+
+    bool IsHashConsingEnabled();
+
+    /** If hash-consing is enabled, returns the shared instance structurally identical to
+        the given expression, inserting it in the global table if not already present. If
+        hash-consing is disabled the input expression is returned. Thread safe. */
+    [[nodiscard]] ExpressionPtr HashConsExpression(
+        ExpressionPtr && i_expression);
+
+    struct HashConsingStats
+    {
+        size_t m_expression_count{}; /**< number of expressions currently in the table */
+        size_t m_hits{}; /**< number of lookups that have found an existing expression */
+        size_t m_misses{}; /**< number of lookups that have inserted a new expression */
+    };
+
+    HashConsingStats GetHashConsingStats();
+
+    /** Removes from the table all the expressions not referenced outside it.
+        This is done automatically when the table grows. */
+    void PurgeHashConsingTable();
+
+} // namespace djup
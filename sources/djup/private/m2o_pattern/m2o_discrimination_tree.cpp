@@ -1,4 +1,3 @@
-
 //   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
 // Distributed under the Boost Software License, Version 1.0.
 //        (See accompanying file LICENSE or copy at
@@ -6,147 +5,310 @@
 
 #include <private/common.h>
 #include <private/m2o_pattern/m2o_discrimination_tree.h>
-#include <private/m2o_pattern/m2o_pattern_info.h>
-#include <private/m2o_pattern/m2o_debug_utils.h>
-#include <private/builtin_names.h>
+#include <private/m2o_pattern/m2o_substitution_graph.h>
+#include <private/namespace.h>
 #include <private/expression.h>
-#include <private/substitute_by_predicate.h>
 #include <core/flags.h>
 #include <core/to_string.h>
+#include <algorithm>
+#include <memory>
 
 namespace djup
 {
     namespace m2o_pattern
     {
-        namespace
+        DiscriminationTree::DiscriminationTree(const Namespace & i_namespace)
+            : m_namespace(i_namespace)
         {
-            Tensor PreprocessPattern(const Tensor& i_pattern)
-            {
-                return SubstituteByPredicate(i_pattern, [](const Tensor& i_candidate) {
-                    FunctionFlags flags = GetFunctionFlags(*i_candidate.GetExpression());
+            NewBuildNode(); // root
+        }
 
-                    bool some_substitution = false;
-                    std::vector<Tensor> new_arguments;
+        uint32_t DiscriminationTree::NewBuildNode()
+        {
+            const uint32_t new_node = NumericCast<uint32_t>(m_build_nodes.size());
+            m_build_nodes.emplace_back();
+            return new_node;
+        }
 
-                    const std::vector<Tensor>& arguments = i_candidate.GetExpression()->GetArguments();
-                    const size_t argument_count = arguments.size();
+        bool DiscriminationTree::FunctionEdgeLess(uintptr_t i_first_name_id, uint32_t i_first_arity,
+            uintptr_t i_second_name_id, uint32_t i_second_arity)
+        {
+            if (i_first_name_id != i_second_name_id)
+                return i_first_name_id < i_second_name_id;
+            return i_first_arity < i_second_arity;
+        }
 
-                    // substitute identifiers in associative functions with AssociativeIdentifier()
-                    if (HasFlag(flags, FunctionFlags::Associative))
-                    {
-                        size_t index = 0;
-
-                        for (; index < argument_count; index++)
-                        {
-                            const Tensor& argument = arguments[index];
-                            if (!IsConstant(argument))
-                            {
-                                new_arguments = arguments;
-                                some_substitution = true;
-                                break;
-                            }
-                        }
-
-                        for (; index < argument_count; index++)
-                        {
-                            const Tensor& argument = arguments[index];
-                            if (!IsConstant(argument))
-                            {
-                                new_arguments[index] = MakeExpression(
-                                    argument.GetExpression()->GetType(),
-                                    builtin_names::AssociativeIdentifier,
-                                    { argument },
-                                    argument.GetExpression()->GetMetadata());
-                            }
-                        }
-                    }
+        bool DiscriminationTree::IsSupportedByAutomaton(const Tensor & i_pattern)
+        {
+            const Expression & expression = *i_pattern.GetExpression();
+            const ExpressionKind kind = GetExpressionKind(expression);
+            if (kind == ExpressionKind::Constant || kind == ExpressionKind::Identifier)
+                return true;
+            if (kind == ExpressionKind::Variadic)
+                return false;
 
-                    if (some_substitution)
-                        return MakeExpression(
-                            i_candidate.GetExpression()->GetType(),
-                            i_candidate.GetExpression()->GetName(), 
-                            new_arguments, i_candidate.GetExpression()->GetMetadata());
-                    else
-                        return i_candidate;
-                    });
-                }
+            /* o2o_pattern::Pattern matches identifiers in associative functions with sequences of
+               arguments, while the automaton matches every argument of the pattern with a single
+               argument of the target */
+            const FunctionFlags flags = GetFunctionFlags(expression);
+            if (HasFlag(flags, FunctionFlags::Associative))
+                return false;
+            if (HasFlag(flags, FunctionFlags::Commutative) &&
+                    expression.GetArguments().size() > s_max_commutative_arity)
+                return false;
+
+            for (const Tensor & argument : expression.GetArguments())
+                if (!IsSupportedByAutomaton(argument))
+                    return false;
+            return true;
         }
 
-        DiscriminationTree::DiscriminationTree()
+        /** This is the entry point to add a pattern */
+        void DiscriminationTree::AddPattern(uint32_t i_pattern_id,
+            const Tensor & i_pattern, const Tensor & i_condition)
         {
-            
+            m_compiled = false;
+            m_pattern_count++;
+
+            if (!IsSupportedByAutomaton(i_pattern))
+            {
+                if (IsEmpty(i_condition))
+                    m_fallback_patterns.push_back({ i_pattern_id, o2o_pattern::Pattern(m_namespace, i_pattern) });
+                else
+                    m_fallback_patterns.push_back({ i_pattern_id, o2o_pattern::Pattern(m_namespace, i_pattern, i_condition) });
+                return;
+            }
+
+            Leaf leaf;
+            leaf.m_pattern_id = i_pattern_id;
+            leaf.m_condition = i_condition;
+            const uint32_t leaf_node = AddPatternNode(s_root_node_index, i_pattern, leaf.m_slot_names);
+            m_build_nodes[leaf_node].m_leaves.push_back(std::move(leaf));
         }
 
-        uint32_t DiscriminationTree::NewNode()
+        /* Adds the edges to match a pattern starting from a node, and returns the destination
+           node. Edges equal to existing ones are shared. */
+        uint32_t DiscriminationTree::AddPatternNode(uint32_t i_build_node,
+            const Tensor & i_pattern, std::vector<Name> & io_slot_names)
         {
-            const uint32_t new_node = m_node_count++;
-            return new_node;
+            const Expression & expression = *i_pattern.GetExpression();
+            const ExpressionKind kind = GetExpressionKind(expression);
+
+            if (kind == ExpressionKind::Constant)
+            {
+                for (const ConstantEdge & edge : m_build_nodes[i_build_node].m_constant_edges)
+                    if (AlwaysEqual(edge.m_value, i_pattern))
+                        return edge.m_dest_node;
+
+                const uint32_t dest_node = NewBuildNode();
+                m_build_nodes[i_build_node].m_constant_edges.push_back(
+                    { expression.GetHash().GetValue(), dest_node, i_pattern });
+                return dest_node;
+            }
+            else if (kind == ExpressionKind::Identifier)
+            {
+                VariableEdge new_edge;
+                new_edge.m_type = expression.GetType();
+                const auto slot_it = std::find(io_slot_names.begin(), io_slot_names.end(), expression.GetName());
+                new_edge.m_slot = NumericCast<uint32_t>(slot_it - io_slot_names.begin());
+                new_edge.m_bound = slot_it != io_slot_names.end();
+                if (!new_edge.m_bound)
+                    io_slot_names.push_back(expression.GetName());
+
+                for (const VariableEdge & edge : m_build_nodes[i_build_node].m_variable_edges)
+                    if (edge.m_slot == new_edge.m_slot && edge.m_bound == new_edge.m_bound &&
+                            edge.m_type == new_edge.m_type)
+                        return edge.m_dest_node;
+
+                new_edge.m_dest_node = NewBuildNode();
+                m_build_nodes[i_build_node].m_variable_edges.push_back(new_edge);
+                return new_edge.m_dest_node;
+            }
+            else
+            {
+                DJUP_ASSERT(kind == ExpressionKind::VariableFunction);
+
+                const Span<const Tensor> arguments = expression.GetArguments();
+                const uint32_t arity = NumericCast<uint32_t>(arguments.size());
+
+                uint32_t node = std::numeric_limits<uint32_t>::max();
+                for (const FunctionEdge & edge : m_build_nodes[i_build_node].m_function_edges)
+                    if (edge.m_name == expression.GetName() && edge.m_arity == arity)
+                        node = edge.m_dest_node;
+
+                if (node == std::numeric_limits<uint32_t>::max())
+                {
+                    node = NewBuildNode();
+                    // with less than two arguments the order does not matter
+                    const bool commutative = arity >= 2 &&
+                        HasFlag(GetFunctionFlags(expression), FunctionFlags::Commutative);
+                    m_build_nodes[i_build_node].m_function_edges.push_back(
+                        { expression.GetName().GetId(), arity, node, commutative, expression.GetName() });
+                }
+
+                for (const Tensor & argument : arguments)
+                    node = AddPatternNode(node, argument, io_slot_names);
+                return node;
+            }
         }
 
-        /** This is the entry point to add a pattern */
-        void DiscriminationTree::AddPattern(uint32_t i_pattern_id,
-            const Tensor& i_pattern, const Tensor& i_condition)
+        void DiscriminationTree::Compile()
         {
-            const Tensor preprocessed = PreprocessPattern(i_pattern);
+            m_nodes.clear();
+            m_function_edges.clear();
+            m_constant_edges.clear();
+            m_variable_edges.clear();
+            m_leaves.clear();
+
+            // the nodes of the automaton have the same indices of the nodes of the trie
+            m_nodes.resize(m_build_nodes.size());
+            for (size_t node_index = 0; node_index < m_build_nodes.size(); node_index++)
+            {
+                const BuildNode & source = m_build_nodes[node_index];
+                Node & dest = m_nodes[node_index];
+
+                dest.m_first_function_edge = NumericCast<uint32_t>(m_function_edges.size());
+                dest.m_function_edge_count = NumericCast<uint32_t>(source.m_function_edges.size());
+                m_function_edges.insert(m_function_edges.end(),
+                    source.m_function_edges.begin(), source.m_function_edges.end());
+                std::sort(m_function_edges.begin() + dest.m_first_function_edge, m_function_edges.end(),
+                    [](const FunctionEdge & i_first, const FunctionEdge & i_second) {
+                        return FunctionEdgeLess(i_first.m_name_id, i_first.m_arity,
+                            i_second.m_name_id, i_second.m_arity);
+                    });
+
+                dest.m_first_constant_edge = NumericCast<uint32_t>(m_constant_edges.size());
+                dest.m_constant_edge_count = NumericCast<uint32_t>(source.m_constant_edges.size());
+                m_constant_edges.insert(m_constant_edges.end(),
+                    source.m_constant_edges.begin(), source.m_constant_edges.end());
+                std::sort(m_constant_edges.begin() + dest.m_first_constant_edge, m_constant_edges.end(),
+                    [](const ConstantEdge & i_first, const ConstantEdge & i_second) {
+                        return i_first.m_hash < i_second.m_hash;
+                    });
+
+                dest.m_first_variable_edge = NumericCast<uint32_t>(m_variable_edges.size());
+                dest.m_variable_edge_count = NumericCast<uint32_t>(source.m_variable_edges.size());
+                m_variable_edges.insert(m_variable_edges.end(),
+                    source.m_variable_edges.begin(), source.m_variable_edges.end());
 
-            // AddEdje(GetRootNodeIndex(), preprocessed);
+                dest.m_first_leaf = NumericCast<uint32_t>(m_leaves.size());
+                dest.m_leaf_count = NumericCast<uint32_t>(source.m_leaves.size());
+                m_leaves.insert(m_leaves.end(), source.m_leaves.begin(), source.m_leaves.end());
+            }
+
+            m_compiled = true;
         }
 
-        /*const DiscriminationTree::Edge & DiscriminationTree::AddEdje(uint32_t i_source_node, const Tensor & i_pattern)
+        bool DiscriminationTree::IsConditionSatisfied(const Tensor & i_condition,
+            Span<const Substitution> i_substitutions) const
         {
-            const PatternInfo pattern_info = BuildPatternInfo(i_pattern);
-            const ExpressionKind expression_kind = GetExpressionKind(*i_pattern.GetExpression());
+            if (IsEmpty(i_condition))
+                return true;
+            return Always(o2o_pattern::ApplySubstitutions(m_namespace, i_condition, i_substitutions));
+        }
 
-            auto range = m_edges.equal_range(i_source_node);
-            for (auto it = range.first; it != range.second; ++it)
+        namespace
+        {
+            /* Takes a graph from a thread-local free list, and gives it back when destroyed, so
+               that the buffers of the graph are allocated once per thread. Conditions may match
+               other trees, so every nested call gets its own graph. */
+            class ScopedSubstitutionGraph
             {
-                const Edge & existing_edge = it->second;
+            public:
 
-                switch (expression_kind)
+                ScopedSubstitutionGraph(const DiscriminationTree & i_discrimination_tree)
                 {
-                case ExpressionKind::Constant:
-                    if (AlwaysEqual(existing_edge.m_pattern, i_pattern))
+                    std::vector<std::unique_ptr<SubstitutionGraph>> & free_graphs = GetFreeGraphs();
+                    if (free_graphs.empty())
+                        m_graph = std::make_unique<SubstitutionGraph>(i_discrimination_tree);
+                    else
                     {
-                        return existing_edge;
+                        m_graph = std::move(free_graphs.back());
+                        free_graphs.pop_back();
+                        m_graph->SetDiscriminationTree(i_discrimination_tree);
                     }
-                    break;
+                }
 
-                case ExpressionKind::Identifier:
-                    if (existing_edge.m_pattern.GetExpression()->GetType() == 
-                        i_pattern.GetExpression()->GetType())
-                    {
-                        return existing_edge;
-                    }
-                    break;
+                ScopedSubstitutionGraph(const ScopedSubstitutionGraph &) = delete;
+                ScopedSubstitutionGraph & operator = (const ScopedSubstitutionGraph &) = delete;
 
-                case ExpressionKind::VariableFunction:
-                    if (existing_edge.m_pattern.GetExpression()->GetName() ==
-                        i_pattern.GetExpression()->GetName())
-                    {
+                ~ScopedSubstitutionGraph()
+                {
+                    // the graph must not keep alive the expressions of the target
+                    m_graph->Clear();
+                    GetFreeGraphs().push_back(std::move(m_graph));
+                }
 
-                    }
-                    break;
+                SubstitutionGraph & Get() { return *m_graph; }
 
-                case ExpressionKind::Variadic:
-                    break;
+            private:
 
-                default:
-                    DJUP_ASSERT(false);
-                    break;
+                static std::vector<std::unique_ptr<SubstitutionGraph>> & GetFreeGraphs()
+                {
+                    thread_local std::vector<std::unique_ptr<SubstitutionGraph>> free_graphs;
+                    return free_graphs;
                 }
-               
-            }
 
-            const uint32_t new_node = NewNode();
-            return new_node;
+            private:
+                std::unique_ptr<SubstitutionGraph> m_graph;
+            };
+        }
 
-        }*/
+        std::vector<MatchResult> DiscriminationTree::FindMatches(const Tensor & i_target) const
+        {
+            ScopedSubstitutionGraph scoped_graph(*this);
+            SubstitutionGraph & substitution_graph = scoped_graph.Get();
+            substitution_graph.FindMatches(m_namespace, i_target);
+
+            std::vector<MatchResult> results;
+            results.reserve(substitution_graph.GetSolutionCount());
+            for (const SubstitutionGraph::Solution & solution : substitution_graph.GetSolutions())
+            {
+                MatchResult & result = results.emplace_back();
+                result.m_pattern_id = NumericCast<uint32_t>(solution.m_pattern_id);
+                result.m_substitutions = solution.m_substitutions.GetSubstitutions();
+            }
+            return results;
+        }
 
         GraphWizGraph DiscriminationTree::ToGraphWiz(std::string_view i_graph_name) const
         {
             GraphWizGraph graph(i_graph_name);
 
+            for (size_t node_index = 0; node_index < m_nodes.size(); node_index++)
+            {
+                const Node & node = m_nodes[node_index];
 
+                std::string label = node_index == s_root_node_index ? "Root" : ToString("Node ", node_index);
+                for (uint32_t leaf_index = 0; leaf_index < node.m_leaf_count; leaf_index++)
+                    label += ToString("\nPattern ", m_leaves[node.m_first_leaf + leaf_index].m_pattern_id);
+                graph.AddNode(label);
+            }
+
+            for (size_t node_index = 0; node_index < m_nodes.size(); node_index++)
+            {
+                const Node & node = m_nodes[node_index];
+
+                for (uint32_t i = 0; i < node.m_function_edge_count; i++)
+                {
+                    const FunctionEdge & edge = m_function_edges[node.m_first_function_edge + i];
+                    graph.AddEdge(node_index, edge.m_dest_node, ToString(edge.m_name, "/", edge.m_arity,
+                        edge.m_commutative ? " any order" : ""));
+                }
+
+                for (uint32_t i = 0; i < node.m_constant_edge_count; i++)
+                {
+                    const ConstantEdge & edge = m_constant_edges[node.m_first_constant_edge + i];
+                    graph.AddEdge(node_index, edge.m_dest_node, ToSimplifiedString(edge.m_value));
+                }
+
+                for (uint32_t i = 0; i < node.m_variable_edge_count; i++)
+                {
+                    const VariableEdge & edge = m_variable_edges[node.m_first_variable_edge + i];
+                    std::string label = ToString(edge.m_bound ? "= $" : "$", edge.m_slot);
+                    graph.AddEdge(node_index, edge.m_dest_node, label).SetStyle(GraphWizGraph::EdgeStyle::Dashed);
+                }
+            }
 
             return graph;
         }
@@ -1,4 +1,3 @@
-
 //   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
 // Distributed under the Boost Software License, Version 1.0.
 //        (See accompanying file LICENSE or copy at
@@ -8,72 +7,174 @@
 #include <private/common.h>
 #include <core/graph_wiz.h>
 #include <djup/tensor.h>
-#include <private/old_pattern_match.h>
-#include <private/m2o_pattern/m2o_pattern_info.h>
-#include <private/m2o_pattern/m2o_debug_utils.h>
-#include <unordered_map>
+#include <private/expression.h>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <vector>
 #include <limits>
 
-#define DJUP_DEBUG_DISCRIMINATION_TREE true
-
 namespace djup
 {
+    class Namespace;
+
     namespace m2o_pattern
     {
+        using o2o_pattern::Substitution;
+
+        struct MatchResult
+        {
+            uint32_t m_pattern_id{};
+            std::vector<Substitution> m_substitutions;
+        };
+
         /** A discrimination tree represent a series of patterns to be tested against
             a target expression. Patterns are identified by ids, whose value is picked
-            by the user. */
+            by the user.
+            Patterns are added to a trie keyed by their pre-order sequence of symbols, and
+            Compile() turns the trie in a flat automaton: nodes and edges are stored in
+            contiguous arrays, and the function edges of every node are sorted by symbol, so
+            that transitions are binary searches. Targets are matched by SubstitutionGraph,
+            against all the patterns with a single traversal of the automaton. The edges of
+            commutative functions are order-independent: every argument of the pattern can
+            match any argument of the target not matched yet.
+            Patterns with repetitions or associative functions can't be represented as a
+            sequence of symbols, so they are matched one by one with o2o_pattern::Pattern. */
         class DiscriminationTree
         {
         public:
 
-            DiscriminationTree();
+            DiscriminationTree(const Namespace & i_namespace);
+
+            DiscriminationTree(const DiscriminationTree &) = delete;
+            DiscriminationTree & operator = (const DiscriminationTree &) = delete;
 
-            // the pattern id must be positive
+            /** Adds a pattern to the tree. Compile() must be called before matching. */
             void AddPattern(uint32_t i_pattern_id, const Tensor & i_pattern,
-                const Tensor & i_condition = true);
-            
+                const Tensor & i_condition = {});
+
+            /** Builds the automaton from the patterns added so far */
+            void Compile();
+
+            bool IsCompiled() const { return m_compiled; }
+
+            /** Returns all the patterns matching the target, with their substitutions,
+                sorted by pattern id. A pattern may match in more than one way. This is a
+                shortcut for SubstitutionGraph::FindMatches. */
+            std::vector<MatchResult> FindMatches(const Tensor & i_target) const;
+
+            size_t GetPatternCount() const { return m_pattern_count; }
+
+            /** Returns the number of patterns not supported by the automaton, that are
+                matched one by one with o2o_pattern::Pattern */
+            size_t GetFallbackPatternCount() const { return m_fallback_patterns.size(); }
+
+            size_t GetNodeCount() const { return m_nodes.size(); }
+
             static uint32_t GetRootNodeIndex() { return s_root_node_index; }
 
-            /** Converts the discrimination net to a string processable with GraphWiz */
+            /** Converts the automaton to a graph processable with GraphWiz */
             GraphWizGraph ToGraphWiz(std::string_view i_graph_name) const;
 
-            #if DJUP_DEBUG_DISCRIMINATION_TREE
-                /*const auto & DbgGetFullPattern(uint32_t i_node) const
-                {
-                    const auto full_pattern_it = m_dbg_full_patterns.find(m_leaf_pattern_id[i_node]);
-                    DJUP_ASSERT(full_pattern_it != m_dbg_full_patterns.end());
-                    return full_pattern_it->second;
-                }*/
-            #endif
-
         private:
 
-            struct Edge
+            friend class SubstitutionGraph;
+
+            constexpr static uint32_t s_root_node_index = 0;
+
+            /** Commutative functions with more arguments are matched by o2o_pattern::Pattern, so
+                that the arguments already matched fit in a 64-bit mask */
+            constexpr static uint32_t s_max_commutative_arity = 64;
+
+            /** A function with a given name and argument count. The target
+                node is consumed, and the matching goes on with its arguments. If
+                m_commutative is true, the arguments of the target are matched in any order. */
+            struct FunctionEdge
             {
-                Tensor m_pattern;
-                PatternInfo m_pattern_info;
-                std::vector<uint32_t> m_dest_nodes;
+                uintptr_t m_name_id{};
+                uint32_t m_arity{};
+                uint32_t m_dest_node{};
+                bool m_commutative{};
+                Name m_name;
             };
 
-            constexpr static uint32_t s_root_node_index = 0;
+            /** A constant expression. The whole target sub-expression is consumed. */
+            struct ConstantEdge
+            {
+                uint64_t m_hash{};
+                uint32_t m_dest_node{};
+                Tensor m_value;
+            };
+
+            /** An identifier. The whole target sub-expression is consumed and bound
+                to a slot. Slots are numbered in pre-order of first occurrence, so that
+                patterns with the same prefix use the same slots. If m_bound is true, the
+                identifier occurs again, and the target must be equal to the bound value. */
+            struct VariableEdge
+            {
+                uint32_t m_slot{};
+                bool m_bound{};
+                uint32_t m_dest_node{};
+                TensorType m_type;
+            };
+
+            struct Leaf
+            {
+                uint32_t m_pattern_id{};
+                std::vector<Name> m_slot_names; /**< names of the identifiers, indexed by slot */
+                Tensor m_condition;
+            };
+
+            struct Node
+            {
+                uint32_t m_first_function_edge{}, m_function_edge_count{};
+                uint32_t m_first_constant_edge{}, m_constant_edge_count{};
+                uint32_t m_first_variable_edge{}, m_variable_edge_count{};
+                uint32_t m_first_leaf{}, m_leaf_count{};
+            };
+
+            /** Node of the trie, used before compilation */
+            struct BuildNode
+            {
+                std::vector<FunctionEdge> m_function_edges;
+                std::vector<ConstantEdge> m_constant_edges;
+                std::vector<VariableEdge> m_variable_edges;
+                std::vector<Leaf> m_leaves;
+            };
+
+            struct FallbackPattern
+            {
+                uint32_t m_pattern_id{};
+                o2o_pattern::Pattern m_pattern;
+            };
+
+            static bool IsSupportedByAutomaton(const Tensor & i_pattern);
 
-            void ProcessPattern(const Tensor & i_pattern);
+            static bool FunctionEdgeLess(uintptr_t i_first_name_id, uint32_t i_first_arity,
+                uintptr_t i_second_name_id, uint32_t i_second_arity);
 
-            const Edge & AddEdje(uint32_t i_source_node, const Tensor & i_pattern);
+            uint32_t AddPatternNode(uint32_t i_build_node, const Tensor & i_pattern,
+                std::vector<Name> & io_slot_names);
 
-            uint32_t NewNode();
+            uint32_t NewBuildNode();
+
+            bool IsConditionSatisfied(const Tensor & i_condition,
+                Span<const Substitution> i_substitutions) const;
 
         private:
+            const Namespace & m_namespace;
+            size_t m_pattern_count{};
+            bool m_compiled{ false };
+
+            // trie
+            std::vector<BuildNode> m_build_nodes;
 
-            std::unordered_multimap<uint32_t, Edge> m_edges;
+            // automaton
+            std::vector<Node> m_nodes;
+            std::vector<FunctionEdge> m_function_edges;
+            std::vector<ConstantEdge> m_constant_edges;
+            std::vector<VariableEdge> m_variable_edges;
+            std::vector<Leaf> m_leaves;
 
-            uint32_t m_node_count{};
-            
-            #if DJUP_DEBUG_DISCRIMINATION_TREE
-                // the key is the pattern id
-                std::unordered_map<uint32_t, std::string> m_dbg_full_patterns;
-            #endif
+            std::vector<FallbackPattern> m_fallback_patterns;
         };
 
     } // namespace m2o_pattern
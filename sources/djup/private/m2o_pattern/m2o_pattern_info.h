@@ -15,8 +15,14 @@
 
 /* Warning: this flags will alter the layout of classes, adding
    string where it is useful for debug purpose. They can also
-   enable some Print. */
-#define DJUP_DEBUG_PATTERN_INFO                         true
+   enable some Print. By default they are enabled only in debug builds. */
+#ifndef DJUP_DEBUG_PATTERN_INFO
+    #ifdef NDEBUG
+        #define DJUP_DEBUG_PATTERN_INFO                 false
+    #else
+        #define DJUP_DEBUG_PATTERN_INFO                 true
+    #endif
+#endif
 
 namespace djup
 {
@@ -1,3 +1,4 @@
+
 //   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
 // Distributed under the Boost Software License, Version 1.0.
 //        (See accompanying file LICENSE or copy at
@@ -6,9 +7,7 @@
 #include <private/common.h>
 #include <private/m2o_pattern/m2o_substitution_graph.h>
 #include <private/m2o_pattern/m2o_discrimination_tree.h>
-#include <private/m2o_pattern/m2o_pattern_info.h>
 #include <private/namespace.h>
-#include <private/substitute_by_predicate.h>
 #include <private/builtin_names.h>
 #include <algorithm>
 
@@ -18,72 +17,320 @@ namespace djup
     {
         SubstitutionGraph::SubstitutionGraph(const DiscriminationTree& i_discrimination_net,
                 SolutionType i_solution_type)
-            : m_discrimination_tree(i_discrimination_net),
+            : m_discrimination_tree(&i_discrimination_net),
               m_solution_type(i_solution_type)
         {
         }
 
-        SubstitutionGraph::~SubstitutionGraph() = default;
+        void SubstitutionGraph::SetDiscriminationTree(const DiscriminationTree & i_discrimination_tree)
+        {
+            Clear();
+            m_discrimination_tree = &i_discrimination_tree;
+        }
+
+        SubstitutionGraph::~SubstitutionGraph()
+        {
+            FlushCandidates();
+        }
+
+        void SubstitutionGraph::FlattenTarget(const Tensor & i_target,
+            std::vector<const Tensor *> & io_stack, std::vector<FlatTargetNode> & o_nodes)
+        {
+            o_nodes.clear();
+
+            io_stack.clear();
+            io_stack.push_back(&i_target);
+            while (!io_stack.empty())
+            {
+                const Tensor * node = io_stack.back();
+                io_stack.pop_back();
+                o_nodes.push_back({ node, 0 });
+
+                const Span<const Tensor> arguments = node->GetExpression()->GetArguments();
+                for (size_t i = arguments.size(); i-- > 0; )
+                    io_stack.push_back(&arguments[i]);
+            }
+
+            // the arguments of a node follow it, one after the other
+            for (size_t i = o_nodes.size(); i-- > 0; )
+            {
+                uint32_t end = NumericCast<uint32_t>(i + 1);
+                const size_t argument_count = o_nodes[i].m_tensor->GetExpression()->GetArguments().size();
+                for (size_t argument = 0; argument < argument_count; argument++)
+                    end = o_nodes[end].m_end;
+                o_nodes[i].m_end = end;
+            }
+        }
 
         void SubstitutionGraph::FindMatches(
             const Namespace& i_namespace, const Tensor& i_target,
             std::function<void()> i_step_callback)
         {
+            if (!m_discrimination_tree->IsCompiled())
+                Error("SubstitutionGraph::FindMatches - the discrimination tree must be compiled after adding patterns");
+
+            FlushCandidates();
+            m_solution_nodes.clear();
+            m_commutative_frames.clear();
+            m_solutions.clear();
+
+            FlattenTarget(i_target, m_flatten_stack, m_flat_target);
+            DescendContext context{ i_namespace, m_flat_target };
+
+            // the root of the solution graph binds nothing
+            m_solution_nodes.emplace_back();
+            NewCandidate(0, DiscriminationTree::GetRootNodeIndex(), 0, std::numeric_limits<uint32_t>::max());
+
+            /* Candidates are processed depth-first, so that the first solution is reached
+               as soon as possible, and the queue does not grow with the size of the target. */
+            while (!m_candidate_edges_queue.empty())
+            {
+                if (i_step_callback)
+                    i_step_callback();
+
+                const CandHandle handle = m_candidate_edges_queue.back();
+                m_candidate_edges_queue.pop_back();
+                const CandidateEdge candidate = m_candidate_edges.GetObject(handle);
+                m_candidate_edges.Delete(handle);
+
+                ProcessCandidate(context, candidate);
+
+                if (m_solution_type == SolutionType::Any && !m_solutions.empty())
+                {
+                    FlushCandidates();
+                    return;
+                }
+            }
+
+            for (const DiscriminationTree::FallbackPattern & fallback : m_discrimination_tree->m_fallback_patterns)
+            {
+                if (m_solution_type == SolutionType::Any)
+                {
+                    if (std::optional<o2o_pattern::MatchResult> match = fallback.m_pattern.MatchOne(i_target, nullptr))
+                    {
+                        Solution & solution = m_solutions.emplace_back();
+                        solution.m_pattern_id = NumericCast<int32_t>(fallback.m_pattern_id);
+                        solution.m_substitutions.Add(match->m_substitutions);
+                        return;
+                    }
+                }
+                else
+                {
+                    for (const o2o_pattern::MatchResult & match : fallback.m_pattern.MatchAll(i_target, nullptr))
+                    {
+                        Solution & solution = m_solutions.emplace_back();
+                        solution.m_pattern_id = NumericCast<int32_t>(fallback.m_pattern_id);
+                        solution.m_substitutions.Add(match.m_substitutions);
+                    }
+                }
+            }
+
+            std::stable_sort(m_solutions.begin(), m_solutions.end(),
+                [](const Solution & i_first, const Solution & i_second) {
+                    return i_first.m_pattern_id < i_second.m_pattern_id;
+                });
         }
 
-        UIntInterval GetUsableCount(const ArgumentInfo & i_argument_info,
-            uint32_t i_target_remaining_targets, uint32_t i_pattern_size)
+        void SubstitutionGraph::ProcessCandidate(DescendContext & i_context, CandidateEdge i_candidate)
         {
-            // number of total parameters usable for the repeated pattern
-            UIntInterval usable;
+            const DiscriminationTree & tree = *m_discrimination_tree;
+            const DiscriminationTree::Node & node = tree.m_nodes[i_candidate.m_discrimination_node];
 
-            DJUP_ASSERT(i_target_remaining_targets >= static_cast<uint32_t>(
-                i_argument_info.m_remaining.m_min) );
-            usable.m_max = i_target_remaining_targets - i_argument_info.m_remaining.m_min;
-            if (i_argument_info.m_remaining.m_max == UIntInterval::s_infinite)
+            // an argument of a commutative function has been consumed
+            while (i_candidate.m_commutative_frame != std::numeric_limits<uint32_t>::max())
             {
-                usable.m_min = 0;
+                const CommutativeFrame frame = m_commutative_frames[i_candidate.m_commutative_frame];
+                if (i_candidate.m_target_index != frame.m_argument_end)
+                    break;
+
+                const size_t arity = i_context.m_target[frame.m_target_index].m_tensor->GetExpression()->GetArguments().size();
+                const uint64_t all_arguments = ~uint64_t{} >> (64 - arity);
+                if (frame.m_used_arguments != all_arguments)
+                {
+                    MatchCommutativeArguments(i_context, i_candidate.m_source_node, i_candidate.m_discrimination_node,
+                        frame.m_parent, frame.m_target_index, frame.m_used_arguments);
+                    return;
+                }
+
+                // all the arguments are matched, so the matching goes on after the function
+                i_candidate.m_target_index = i_context.m_target[frame.m_target_index].m_end;
+                i_candidate.m_commutative_frame = frame.m_parent;
             }
-            else
+
+            // every pattern consumes the whole target, so only leaves can be reached here
+            if (i_candidate.m_target_index == i_context.m_target.size())
             {
-                DJUP_ASSERT(i_target_remaining_targets >= static_cast<uint32_t>(
-                    i_argument_info.m_remaining.m_max));
-                usable.m_min = i_target_remaining_targets - i_argument_info.m_remaining.m_max;
+                AddSolutions(i_candidate.m_source_node, i_candidate.m_discrimination_node);
+                return;
             }
 
-            usable = i_argument_info.m_cardinality.ClampRange(usable);
+            const FlatTargetNode & target_node = i_context.m_target[i_candidate.m_target_index];
+            const Expression & target_expression = *target_node.m_tensor->GetExpression();
 
-            /* align the usable range to be a multiple of sub_pattern_count.
-               usable.m_min is aligned to the highest multiple, while usable.m_max
-               to the lowest. */
-            usable.m_min += i_pattern_size - 1;
-            usable.m_min -= usable.m_min % i_pattern_size;
-            usable.m_max -= usable.m_max % i_pattern_size;
+            // function edges
+            if (node.m_function_edge_count != 0)
+            {
+                const uintptr_t name_id = target_expression.GetName().GetId();
+                const uint32_t arity = NumericCast<uint32_t>(target_expression.GetArguments().size());
+                const auto begin = tree.m_function_edges.begin() + node.m_first_function_edge;
+                const auto end = begin + node.m_function_edge_count;
+                const auto it = std::lower_bound(begin, end, name_id,
+                    [arity](const DiscriminationTree::FunctionEdge & i_edge, uintptr_t i_name_id) {
+                        return DiscriminationTree::FunctionEdgeLess(i_edge.m_name_id, i_edge.m_arity, i_name_id, arity);
+                    });
+                if (it != end && it->m_name_id == name_id && it->m_arity == arity)
+                {
+                    if (it->m_commutative)
+                        MatchCommutativeArguments(i_context, i_candidate.m_source_node, it->m_dest_node,
+                            i_candidate.m_commutative_frame, i_candidate.m_target_index, 0);
+                    else
+                        NewCandidate(i_candidate.m_source_node, it->m_dest_node,
+                            i_candidate.m_target_index + 1, i_candidate.m_commutative_frame);
+                }
+            }
+
+            // constant edges
+            if (node.m_constant_edge_count != 0 && target_expression.GetMetadata().m_is_constant)
+            {
+                const uint64_t hash = target_expression.GetHash().GetValue();
+                const auto begin = tree.m_constant_edges.begin() + node.m_first_constant_edge;
+                const auto end = begin + node.m_constant_edge_count;
+                auto it = std::lower_bound(begin, end, hash,
+                    [](const DiscriminationTree::ConstantEdge & i_edge, uint64_t i_hash) { return i_edge.m_hash < i_hash; });
+                for (; it != end && it->m_hash == hash; ++it)
+                    if (AlwaysEqual(it->m_value, *target_node.m_tensor))
+                        NewCandidate(i_candidate.m_source_node, it->m_dest_node,
+                            target_node.m_end, i_candidate.m_commutative_frame);
+            }
 
-            return usable;
+            // variable edges
+            for (uint32_t edge_index = 0; edge_index < node.m_variable_edge_count; edge_index++)
+            {
+                const DiscriminationTree::VariableEdge & edge = tree.m_variable_edges[node.m_first_variable_edge + edge_index];
+                if (edge.m_bound)
+                {
+                    if (AlwaysEqual(GetBinding(i_candidate.m_source_node, edge.m_slot), *target_node.m_tensor))
+                        NewCandidate(i_candidate.m_source_node, edge.m_dest_node,
+                            target_node.m_end, i_candidate.m_commutative_frame);
+                }
+                else if (i_context.m_namespace.TypeBelongsTo(target_expression.GetType(), edge.m_type))
+                {
+                    const uint32_t solution_node = NewSolutionNode(
+                        i_candidate.m_source_node, edge.m_slot, target_node.m_tensor);
+                    NewCandidate(solution_node, edge.m_dest_node, target_node.m_end, i_candidate.m_commutative_frame);
+                }
+            }
         }
 
-        
-        Tensor ApplySubstitutions(const Tensor& i_where,
-            Span<const Substitution> i_substitutions)
+        void SubstitutionGraph::NewCandidate(uint32_t i_source_node,
+            uint32_t i_discrimination_node, uint32_t i_target_index, uint32_t i_commutative_frame)
         {
-            return SubstituteByPredicate(i_where, [i_substitutions](const Tensor i_tensor) {
-                for (const Substitution & subst : i_substitutions)
-                {
-                    /*if (!i_tensor.GetExpression()->GetType().IsSupercaseOf(
-                        subst.m_value.GetExpression()->GetType(), )
-                    {
-                        Error();
-                    } */
+            CandidateEdge candidate;
+            candidate.m_source_node = i_source_node;
+            candidate.m_discrimination_node = i_discrimination_node;
+            candidate.m_target_index = i_target_index;
+            candidate.m_commutative_frame = i_commutative_frame;
+            m_candidate_edges_queue.push_back(m_candidate_edges.New(candidate));
+        }
 
-                    if (//IsIdentifier(i_tensor) &&
-                        i_tensor.GetExpression()->GetName() == subst.m_identifier_name)
-                    {
-                        return subst.m_value;
-                    }
+        /* Adds a candidate for every argument of the commutative function of the target not used
+           yet, to be matched against the next argument of the pattern. An argument equal to a
+           previous unused one would lead to the same solutions, so it is skipped. */
+        void SubstitutionGraph::MatchCommutativeArguments(const DescendContext & i_context,
+            uint32_t i_source_node, uint32_t i_discrimination_node, uint32_t i_parent_frame,
+            uint32_t i_function_index, uint64_t i_used_arguments)
+        {
+            const Span<const Tensor> arguments = i_context.m_target[i_function_index].m_tensor->GetExpression()->GetArguments();
+
+            // the arguments of a node follow it, one after the other
+            uint32_t argument_index = i_function_index + 1;
+            for (size_t i = 0; i < arguments.size(); argument_index = i_context.m_target[argument_index].m_end, i++)
+            {
+                if ((i_used_arguments & (uint64_t(1) << i)) != 0)
+                    continue;
+
+                bool duplicate = false;
+                for (size_t prev = 0; prev < i && !duplicate; prev++)
+                    duplicate = (i_used_arguments & (uint64_t(1) << prev)) == 0 &&
+                        AlwaysEqual(arguments[prev], arguments[i]);
+                if (duplicate)
+                    continue;
+
+                const uint32_t frame = NumericCast<uint32_t>(m_commutative_frames.size());
+                m_commutative_frames.push_back({ i_parent_frame, i_function_index,
+                    i_context.m_target[argument_index].m_end, i_used_arguments | (uint64_t(1) << i) });
+                NewCandidate(i_source_node, i_discrimination_node, argument_index, frame);
+            }
+        }
+
+        uint32_t SubstitutionGraph::NewSolutionNode(uint32_t i_parent, uint32_t i_slot, const Tensor * i_value)
+        {
+            const uint32_t new_node = NumericCast<uint32_t>(m_solution_nodes.size());
+            m_solution_nodes.push_back({ i_parent, i_slot, i_value });
+            return new_node;
+        }
+
+        // slots are bound only once along a path, so the first binding found going to the root is the only one
+        const Tensor & SubstitutionGraph::GetBinding(uint32_t i_solution_node, uint32_t i_slot) const
+        {
+            uint32_t node = i_solution_node;
+            while (m_solution_nodes[node].m_slot != i_slot)
+            {
+                DJUP_ASSERT(node != 0);
+                node = m_solution_nodes[node].m_parent;
+            }
+            return *m_solution_nodes[node].m_value;
+        }
+
+        void SubstitutionGraph::AddSolutions(uint32_t i_solution_node, uint32_t i_discrimination_node)
+        {
+            const DiscriminationTree & tree = *m_discrimination_tree;
+            const DiscriminationTree::Node & node = tree.m_nodes[i_discrimination_node];
+
+            std::vector<Substitution> & substitutions = m_leaf_substitutions;
+            for (uint32_t leaf_index = 0; leaf_index < node.m_leaf_count; leaf_index++)
+            {
+                const DiscriminationTree::Leaf & leaf = tree.m_leaves[node.m_first_leaf + leaf_index];
+
+                // the bindings are collected from the leaf of the solution graph to the root
+                substitutions.assign(leaf.m_slot_names.size(), {});
+                for (uint32_t solution_node = i_solution_node; solution_node != 0;
+                    solution_node = m_solution_nodes[solution_node].m_parent)
+                {
+                    const SolutionNode & binding = m_solution_nodes[solution_node];
+                    DJUP_ASSERT(binding.m_slot < substitutions.size());
+                    substitutions[binding.m_slot] = { leaf.m_slot_names[binding.m_slot], *binding.m_value };
                 }
-                return i_tensor;
-            });
+
+                if (!tree.IsConditionSatisfied(leaf.m_condition, substitutions))
+                    continue;
+
+                Solution & solution = m_solutions.emplace_back();
+                solution.m_curr_node = i_solution_node;
+                solution.m_pattern_id = NumericCast<int32_t>(leaf.m_pattern_id);
+                // every slot is bound once, so there can't be contradictions
+                solution.m_substitutions.Add(substitutions);
+
+                if (m_solution_type == SolutionType::Any)
+                    return;
+            }
+        }
+
+        void SubstitutionGraph::Clear()
+        {
+            FlushCandidates();
+            m_flat_target.clear();
+            m_leaf_substitutions.clear();
+            m_solution_nodes.clear();
+            m_commutative_frames.clear();
+            m_solutions.clear();
+        }
+
+        void SubstitutionGraph::FlushCandidates()
+        {
+            for (const CandHandle handle : m_candidate_edges_queue)
+                m_candidate_edges.Delete(handle);
+            m_candidate_edges_queue.clear();
         }
 
     } // namespace m2o_pattern
@@ -9,8 +9,8 @@
 #include <private/m2o_pattern/m2o_substitutions_builder.h>
 #include <core/pool.h>
 #include <core/graph_wiz.h>
-#include <unordered_map>
-#include <unordered_set>
+#include <functional>
+#include <limits>
 #include <vector>
 
 namespace djup
@@ -21,6 +21,17 @@ namespace djup
     {
         class DiscriminationTree;
 
+        /** Matches a target against all the patterns of a compiled DiscriminationTree.
+            The target is flattened in pre-order and consumed by candidate edges, that
+            are transitions of the automaton still to be tried. A candidate edge is shared
+            by all the patterns with the same prefix, so the common part of the patterns is
+            expanded once. Identifiers are bound by the edges of the solution graph, a tree
+            whose root is the empty substitution: a path from the root is the set of bindings
+            of a partial match, and branches share the bindings of their common prefix.
+            The arguments of a commutative function are matched one by one, each against any
+            argument of the target not used yet: the arguments used are tracked by a tree of
+            commutative frames, that branches like the solution graph.
+            Patterns not supported by the automaton are matched by o2o_pattern::Pattern. */
         class SubstitutionGraph
         {
 
@@ -28,8 +39,8 @@ namespace djup
 
             enum class SolutionType
             {
-                All,
-                Any
+                All, /**< finds all the solutions, sorted by pattern id */
+                Any  /**< stops at the first solution found, whatever the pattern */
             };
 
             SubstitutionGraph(const DiscriminationTree & i_discrimination_net, 
@@ -37,6 +48,9 @@ namespace djup
 
             ~SubstitutionGraph();
 
+            /** Finds the solutions of the target. The solutions of a previous call are
+                discarded. The callback, if any, is invoked before processing every
+                candidate edge. */
             void FindMatches(
                 const Namespace& i_namespace, const Tensor& i_target,
                 std::function<void()> i_step_callback = {});
@@ -56,67 +70,106 @@ namespace djup
 
             const std::vector<Solution>& GetSolutions() const { return m_solutions; }
 
+            /** Discards the solutions, so that the graph does not keep alive the expressions
+                of the target. The buffers are kept for the next call to FindMatches. */
+            void Clear();
+
+            /** Makes the graph match against another tree, reusing its buffers */
+            void SetDiscriminationTree(const DiscriminationTree & i_discrimination_tree);
+
         private:
 
+            /** Transition of the automaton to be tried from a node of the solution graph,
+                starting from an element of the flattened target */
             struct CandidateEdge
             {
                 uint32_t m_source_node = std::numeric_limits<uint32_t>::max();
-                uint32_t m_dest_node = std::numeric_limits<uint32_t>::max();
                 uint32_t m_discrimination_node = std::numeric_limits<uint32_t>::max();
-
-                Span<const Tensor> m_targets;
-
-                uint32_t m_repetitions{ 1 };
-
-                uint32_t m_open{ 0 };
-                uint32_t m_close{ 0 };
-
-                std::vector<Substitution> m_substitutions;
+                uint32_t m_target_index{};
+                uint32_t m_commutative_frame = std::numeric_limits<uint32_t>::max();
             };
 
             using CandHandle = Pool<CandidateEdge>::Handle;
 
+            /** Element of the target flattened in pre-order. m_end is the index of the
+                first element after the sub-expression. */
+            struct FlatTargetNode
+            {
+                const Tensor * m_tensor;
+                uint32_t m_end;
+            };
+
             struct DescendContext
             {
                 const Namespace & m_namespace;
+                Span<const FlatTargetNode> m_target;
+            };
+
+            /** Node of the solution graph. The edge from the parent binds a slot of the
+                discrimination tree to a sub-expression of the target. */
+            struct SolutionNode
+            {
+                uint32_t m_parent{ std::numeric_limits<uint32_t>::max() };
+                uint32_t m_slot{ std::numeric_limits<uint32_t>::max() };
+                const Tensor * m_value{};
             };
 
-            /** Edge that may be a part of a solution-path, given that variable
-                substitution in the path is not contradictory. */
-            struct SolutionEdge
+            /** A commutative function of the target whose arguments are being matched. When the
+                target index reaches m_argument_end, the next argument of the pattern is matched
+                against one of the arguments of the target not in m_used_arguments, or, if all
+                of them are used, the matching goes on after the function in the parent frame. */
+            struct CommutativeFrame
             {
-                uint32_t m_dest{ std::numeric_limits<uint32_t>::max() };
-                std::vector<Substitution> m_substitutions;
-                uint32_t m_open{ 0 };
-                uint32_t m_close{ 0 };
+                uint32_t m_parent{ std::numeric_limits<uint32_t>::max() };
+                uint32_t m_target_index{}; // index of the function in the flattened target
+                uint32_t m_argument_end{};
+                uint64_t m_used_arguments{};
             };
 
         private:
 
+            static void FlattenTarget(const Tensor & i_target,
+                std::vector<const Tensor *> & io_stack, std::vector<FlatTargetNode> & o_nodes);
+
             void ProcessCandidate(DescendContext & i_context, CandidateEdge i_candidate);
 
-            uint32_t NewSolutionNode();
+            void NewCandidate(uint32_t i_source_node, uint32_t i_discrimination_node,
+                uint32_t i_target_index, uint32_t i_commutative_frame);
+
+            void MatchCommutativeArguments(const DescendContext & i_context, uint32_t i_source_node,
+                uint32_t i_discrimination_node, uint32_t i_parent_frame,
+                uint32_t i_function_index, uint64_t i_used_arguments);
+
+            uint32_t NewSolutionNode(uint32_t i_parent, uint32_t i_slot, const Tensor * i_value);
 
-            void FlushSolutions();
+            const Tensor & GetBinding(uint32_t i_solution_node, uint32_t i_slot) const;
+
+            void AddSolutions(uint32_t i_solution_node, uint32_t i_discrimination_node);
+
+            void FlushCandidates();
 
         private:
-            const DiscriminationTree & m_discrimination_tree;
+            const DiscriminationTree * m_discrimination_tree;
             const SolutionType m_solution_type;
 
+            /* flattened target and scratch buffers, kept to reuse their storage
+               when FindMatches is called again */
+            std::vector<FlatTargetNode> m_flat_target;
+            std::vector<const Tensor *> m_flatten_stack;
+            std::vector<Substitution> m_leaf_substitutions;
+
             // candidate edges
             Pool<CandidateEdge> m_candidate_edges;
             std::vector<CandHandle> m_candidate_edges_queue;
-            std::unordered_set<uint32_t> m_reached_leaf_nodes;
 
             // solutions graph
-            uint32_t m_solution_node_count{0};
-            std::unordered_multimap<uint32_t, SolutionEdge> m_solution_graph;
+            std::vector<SolutionNode> m_solution_nodes;
+
+            // arguments of the commutative functions of the target already matched
+            std::vector<CommutativeFrame> m_commutative_frames;
 
             std::vector<Solution> m_solutions;
         };
-
-        Tensor ApplySubstitutions(const Tensor & i_where,
-            Span<const Substitution> i_substitutions);
     
     } // namespace m2o_pattern
 
@@ -8,20 +8,18 @@
 #include <private/common.h>
 #include <djup/tensor.h>
 #include <core/name.h>
-#include <unordered_map>
-#include <unordered_set>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <private/o2o_pattern/o2o_substitutions_builder.h>
 #include <vector>
 
 namespace djup
 {
     namespace m2o_pattern
     {
-        struct Substitution
-        {
-            Name m_identifier_name;
-            Tensor m_value;
-        };
+        using o2o_pattern::Substitution;
 
+        /** Accumulates the substitutions of a match. Values captured inside variadic
+            groups are stored flat, and their tuples are built by GetSubstitutions. */
         class SubstitutionsBuilder
         {
         public:
@@ -32,35 +30,21 @@ namespace djup
 
             bool Close(uint32_t i_depth);
 
-            const std::vector<Substitution>& GetSubstitutions() const;
+            /** Materializes the substitutions, in the order they were added */
+            std::vector<Substitution> GetSubstitutions() const;
 
         private:
 
-            struct VariadicValue
-            {
-                std::vector<std::vector<Tensor>> m_stack;
-            };
-
-        private:
+            const Tensor * FindBinding(const Name & i_identifier_name) const;
 
             bool AddToBottomLayer(const Substitution & i_solution);
 
             bool AddToBottomLayer(
                 const std::vector<Substitution>& i_source_substitutions);
 
-            void AddToVariadic(
-                const std::vector<Substitution>& i_source_substitutions);
-
-            static Tensor VariadicClear(VariadicValue& i_dest);
-
-            static void VariadicReduceDepth(VariadicValue& i_dest);
-
-            static Tensor ToTuple(const std::vector<Tensor>& i_source);
-
         private:
-            uint32_t m_curr_depth{};
             std::vector<Substitution> m_substitutions;
-            std::unordered_map<Name, VariadicValue> m_variadic_substitutions;
+            o2o_pattern::VariadicCaptures m_variadic_captures;
         };
     
     } // namespace m2o_pattern
@@ -6,6 +6,7 @@
 
 #include <private/common.h>
 #include <private/make_expr.h>
+#include <private/hash_consing.h>
 #include <private/namespace.h>
 #include <private/builtin_names.h>
 
@@ -17,8 +18,8 @@ namespace djup
         Span<const Tensor> i_arguments,
         ExpressionMetadata i_metadata)
     {
-        Tensor expr = { std::make_shared<Expression>(std::move(i_tensor_type),
-            std::move(i_name), i_arguments, std::move(i_metadata)) };
+        Tensor expr = { HashConsExpression(NewExpression(std::move(i_tensor_type),
+            std::move(i_name), i_arguments, std::move(i_metadata))) };
 
         expr = i_namespace.Canonicalize(expr);
 
@@ -41,7 +42,7 @@ namespace djup
 
     Tensor MakeLiteral(const Namespace & i_namespace, int64_t i_integer_value)
     {
-        char buffer[std::numeric_limits<int64_t>::max_digits10 + 4];
+        char buffer[std::numeric_limits<int64_t>::digits10 + 3];
         Name name = ToCharsView(buffer, i_integer_value);
 
         ExpressionMetadata metadata;
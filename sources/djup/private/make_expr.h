@@ -11,6 +11,24 @@
 
 namespace djup
 {
+    /** How SubstituteByPredicate and SubstitutionTemplate::Instantiate build the nodes whose
+        arguments have been substituted */
+    enum class SubstitutionRebuild
+    {
+        /** Every rebuilt node is canonicalized as soon as it is built */
+        CanonicalizeEachNode,
+
+        /** Nodes are rebuilt without canonicalization, and the result is canonicalized once
+            at the end, so that every rebuilt node is rewritten only once. Unlike
+            CanonicalizeEachNode, the axioms of the namespace are applied also to the nodes
+            that were not rebuilt, so the source should be canonical already. */
+        CanonicalizeResult,
+
+        /** Nodes are rebuilt without canonicalization. The result may not be canonical: the
+            caller is supposed to canonicalize it, or to discard it. */
+        Raw
+    };
+
     [[nodiscard]] Tensor MakeExpression(
         const Namespace & i_namespace,
         TensorType i_tensor_type, Name i_name, 
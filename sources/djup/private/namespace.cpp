@@ -9,7 +9,10 @@
 #include <private/make_expr.h>
 #include <private/expression.h>
 #include <private/builtin_names.h>
+#include <private/hash_consing.h>
+#include <private/m2o_pattern/m2o_substitution_graph.h>
 #include <core/algorithms.h>
+#include <core/pointer_map.h>
 
 namespace djup
 {
@@ -21,12 +24,12 @@ namespace djup
     }
 
     Namespace::Namespace(Namespace::TagRoot)
-        : m_parent(nullptr), m_name("Root")
+        : m_type_inference_axioms_tree(*this), m_parent(nullptr), m_name("Root")
     {
     }
 
     Namespace::Namespace(Name i_name, const std::shared_ptr<const Namespace> & i_parent)
-        : m_parent(i_parent), m_name(std::move(i_name))
+        : m_type_inference_axioms_tree(*this), m_parent(i_parent), m_name(std::move(i_name))
     {
         if (m_parent == nullptr)
             m_parent = Root();
@@ -104,26 +107,79 @@ namespace djup
 
     void Namespace::AddSubstitutionAxiom(const Tensor & i_what, const Tensor & i_with, const Tensor & i_when)
     {
-        m_substitution_axioms_rhss.push_back(i_with);
-        m_substitution_axioms_patterns.emplace_back(*this, i_what, i_when);
+        const uint32_t axiom_index = NumericCast<uint32_t>(m_substitution_axioms_patterns.size());
+        const o2o_pattern::Pattern & pattern = 
+            m_substitution_axioms_patterns.emplace_back(*this, i_what, i_when);
+        m_substitution_axioms_rhss.emplace_back(i_with);
+
+        if (pattern.RootMatchesAnyName())
+            m_substitution_axioms_with_any_root.push_back(axiom_index);
+        else
+            m_substitution_axioms_by_root_name[pattern.GetRootName()].push_back(
+                { axiom_index, pattern.GetRootArity() });
+
+        m_canonicalization_cache.Clear();
     }
 
     void Namespace::AddTypeInferenceAxiom(const Tensor & i_what, const Tensor & i_type, const Tensor & i_when)
     {
-        m_type_inference_axioms_rhss.push_back(i_type);
-        m_type_inference_axioms_patterns.emplace_back(*this, i_what, i_when);
+        if (i_type.GetExpression()->GetType().IsEmpty())
+            Error("AddTypeInferenceAxiom - ", ToSimplifiedString(i_type), " is not a type");
+
+        {
+            std::lock_guard<std::mutex> lock(m_type_inference_axioms_mutex);
+            const uint32_t axiom_index = NumericCast<uint32_t>(m_type_inference_axioms_rhss.size());
+            m_type_inference_axioms_tree.AddPattern(axiom_index, i_what, i_when);
+            m_type_inference_axioms_rhss.push_back(i_type);
+            m_type_inference_axioms_compiled.store(false, std::memory_order_relaxed);
+        }
+
+        m_canonicalization_cache.Clear();
     }
 
     Tensor Namespace::ApplySubstitutionAxioms(const Tensor & i_source) const
     {
-        for (size_t i = 0; i < m_substitution_axioms_patterns.size(); ++i)
+        const Expression & source = *i_source.GetExpression();
+        const size_t argument_count = source.GetArguments().size();
+
+        Span<const SubstitutionAxiomRef> by_root_name;
+        const auto by_name_it = m_substitution_axioms_by_root_name.find(source.GetName());
+        if (by_name_it != m_substitution_axioms_by_root_name.end())
+            by_root_name = by_name_it->second;
+        const Span<const uint32_t> with_any_root = m_substitution_axioms_with_any_root;
+
+        // merge the two lists, so that axioms are tried in the order they were added
+        const uint32_t no_axiom = std::numeric_limits<uint32_t>::max();
+        size_t by_root_name_index = 0, with_any_root_index = 0;
+        for (;;)
         {
-            const o2o_pattern::Pattern & pattern = m_substitution_axioms_patterns[i];
+            const uint32_t next_by_root_name = by_root_name_index < by_root_name.size() ?
+                by_root_name[by_root_name_index].m_axiom_index : no_axiom;
+            const uint32_t next_with_any_root = with_any_root_index < with_any_root.size() ?
+                with_any_root[with_any_root_index] : no_axiom;
+
+            uint32_t axiom_index;
+            if (next_by_root_name < next_with_any_root)
+            {
+                const SubstitutionAxiomRef & ref = by_root_name[by_root_name_index++];
+                if (!ref.m_arity.IsValaueWithin(NumericCast<uint32_t>(argument_count)))
+                    continue;
+                axiom_index = ref.m_axiom_index;
+            }
+            else if (next_with_any_root != no_axiom)
+                axiom_index = with_any_root[with_any_root_index++];
+            else
+                break;
+
+            const o2o_pattern::Pattern & pattern = m_substitution_axioms_patterns[axiom_index];
             std::optional<o2o_pattern::MatchResult> solution = pattern.MatchOne(i_source, nullptr);
             if (solution)
             {
-                Tensor substitution_result = o2o_pattern::ApplySubstitutions(*this,
-                    m_substitution_axioms_rhss[i], solution->m_substitutions);
+                /* the values of the identifiers are subexpressions of the source, that is already
+                   canonical but for the root, so the nodes of the right-hand side are built
+                   without canonicalization and the result is canonicalized once */
+                Tensor substitution_result = m_substitution_axioms_rhss[axiom_index].Instantiate(
+                    *this, solution->m_substitutions, SubstitutionRebuild::CanonicalizeResult);
                 return substitution_result;
             }
         }
@@ -131,37 +187,51 @@ namespace djup
         return i_source;
     }
 
-    /*
-    Tensor Namespace::ApplyTypeInferenceAxioms(const Tensor & i_source) const
+    void Namespace::CompileTypeInferenceAxioms() const
     {
-        std::vector<PatternMatch> matches;
+        if (m_type_inference_axioms_compiled.load(std::memory_order_acquire))
+            return;
 
-        m2o_pattern::SubstitutionGraph substitution_graph(m_type_inference_axioms_patterns);
+        std::lock_guard<std::mutex> lock(m_type_inference_axioms_mutex);
+        if (!m_type_inference_axioms_tree.IsCompiled())
+            m_type_inference_axioms_tree.Compile();
+        m_type_inference_axioms_compiled.store(true, std::memory_order_release);
+    }
 
-        substitution_graph.FindMatches(i_source);
+    Tensor Namespace::ApplyTypeInferenceAxioms(const Tensor & i_source,
+        m2o_pattern::SubstitutionGraph & i_type_inference_graph) const
+    {
+        const Expression & source = *i_source.GetExpression();
+        if (m_type_inference_axioms_rhss.empty() || !source.GetType().IsEmpty())
+            return i_source;
 
-        if(!matches.empty())
-        {
-            const PatternMatch & match = matches[0];
-            const Tensor & pattern_type = m_type_inference_axioms_rhss[match.m_pattern_id];
-            Tensor type = SubstitutePatternMatch(pattern_type, match);
-            const Expression & source = *i_source.GetExpression();
-            // to do: check compatibility with the previous type
-            return MakeExpression(source.GetName(), source.GetArguments(), ExpressionMetadata{type});
-        }
-        else
+        i_type_inference_graph.FindMatches(*this, i_source);
+        if (i_type_inference_graph.GetSolutionCount() == 0)
             return i_source;
+
+        // solutions are sorted by pattern id, so the first axiom added has precedence
+        const m2o_pattern::SubstitutionGraph::Solution & solution = i_type_inference_graph.GetSolutionAt(0);
+        const TensorType & axiom_type = m_type_inference_axioms_rhss[solution.m_pattern_id].GetExpression()->GetType();
+
+        // the identifiers of the pattern can be used in the shape
+        TensorType type = axiom_type;
+        if (axiom_type.HasVariableShape())
+            type = TensorType(axiom_type.GetScalarType(), o2o_pattern::ApplySubstitutions(*this,
+                axiom_type.GetVariableShape(), solution.m_substitutions.GetSubstitutions()));
+
+        return { HashConsExpression(NewExpression(std::move(type),
+            source.GetName(), source.GetArguments(), source.GetMetadata())) };
     }
-    */
 
-    Tensor Namespace::Canonicalize(const Tensor & i_source) const
+    Tensor Namespace::RewriteRoot(const Tensor & i_source,
+        m2o_pattern::SubstitutionGraph & i_type_inference_graph) const
     {
         Tensor result(i_source);
 
         // loop until the expression does not change
         const Expression * prev_expr = result.GetExpression().get();
         do {
-            //result = ApplyTypeInferenceAxioms(result);
+            result = ApplyTypeInferenceAxioms(result, i_type_inference_graph);
 
             prev_expr = result.GetExpression().get();
             result = ApplySubstitutionAxioms(result);
@@ -169,4 +239,171 @@ namespace djup
 
         return result;
     }
+
+    namespace
+    {
+        // buffers used by a canonicalization, reused by the following ones on the same thread
+        struct CanonicalizationScratch
+        {
+            struct StackFrame
+            {
+                const Tensor * m_node;
+                size_t m_next_argument;
+            };
+
+            PointerMap<Expression, ExpressionPtr> m_canonical_forms;
+            std::vector<StackFrame> m_stack;
+            std::vector<const Tensor *> m_dirty_nodes;
+            std::vector<Tensor> m_new_arguments;
+        };
+
+        /* Takes a scratch from a thread-local free list, and gives it back when destroyed.
+           Canonicalize is reentrant (the right-hand side of a substitution axiom is built
+           with MakeExpression), so every nested call gets its own scratch. */
+        class ScopedCanonicalizationScratch
+        {
+        public:
+
+            ScopedCanonicalizationScratch()
+            {
+                std::vector<std::unique_ptr<CanonicalizationScratch>> & free_scratches = GetFreeScratches();
+                if (free_scratches.empty())
+                    m_scratch = std::make_unique<CanonicalizationScratch>();
+                else
+                {
+                    m_scratch = std::move(free_scratches.back());
+                    free_scratches.pop_back();
+                }
+            }
+
+            ScopedCanonicalizationScratch(const ScopedCanonicalizationScratch &) = delete;
+            ScopedCanonicalizationScratch & operator = (const ScopedCanonicalizationScratch &) = delete;
+
+            ~ScopedCanonicalizationScratch()
+            {
+                /* the scratch must not keep alive the expressions. Clearing the map visits all
+                   its slots, so a map grown by a big expression is released instead. */
+                if (m_scratch->m_canonical_forms.size() > s_max_retained_map_size)
+                    m_scratch->m_canonical_forms = {};
+                else
+                    m_scratch->m_canonical_forms.clear();
+                m_scratch->m_stack.clear();
+                m_scratch->m_dirty_nodes.clear();
+                m_scratch->m_new_arguments.clear();
+                GetFreeScratches().push_back(std::move(m_scratch));
+            }
+
+            CanonicalizationScratch & Get() { return *m_scratch; }
+
+        private:
+
+            static constexpr size_t s_max_retained_map_size = 64;
+
+            static std::vector<std::unique_ptr<CanonicalizationScratch>> & GetFreeScratches()
+            {
+                thread_local std::vector<std::unique_ptr<CanonicalizationScratch>> free_scratches;
+                return free_scratches;
+            }
+
+        private:
+            std::unique_ptr<CanonicalizationScratch> m_scratch;
+        };
+    }
+
+    Tensor Namespace::Canonicalize(const Tensor & i_source) const
+    {
+        // without axioms every expression is canonical
+        if (m_substitution_axioms_patterns.empty() && m_type_inference_axioms_rhss.empty())
+            return i_source;
+
+        /* The DAG is normalized bottom-up. The nodes reachable from the source that are not in
+           the cache are collected in post-order, without recursion and visiting every shared node
+           once, so every node is processed after its arguments. A node is rebuilt only if some
+           of its arguments have been rewritten, and then the axioms are applied to its root. */
+        ScopedCanonicalizationScratch scoped_scratch;
+        CanonicalizationScratch & scratch = scoped_scratch.Get();
+        PointerMap<Expression, ExpressionPtr> & canonical_forms = scratch.m_canonical_forms;
+        std::vector<CanonicalizationScratch::StackFrame> & stack = scratch.m_stack;
+        std::vector<const Tensor *> & dirty_nodes = scratch.m_dirty_nodes;
+
+        auto visit = [&](const Tensor & i_node) {
+            const auto [canonical_form, inserted] = canonical_forms.TryEmplace(i_node.GetExpression().get());
+            if (!inserted)
+                return;
+            if (ExpressionPtr cached = m_canonicalization_cache.Find(i_node.GetExpression()))
+                canonical_form = std::move(cached);
+            else
+                stack.push_back({ &i_node, 0 });
+        };
+
+        visit(i_source);
+        while (!stack.empty())
+        {
+            CanonicalizationScratch::StackFrame & frame = stack.back();
+            const Span<const Tensor> arguments = frame.m_node->GetExpression()->GetArguments();
+            if (frame.m_next_argument < arguments.size())
+                visit(arguments[frame.m_next_argument++]);
+            else
+            {
+                dirty_nodes.push_back(frame.m_node);
+                stack.pop_back();
+            }
+        }
+
+        // the source was in the cache
+        if (dirty_nodes.empty())
+            return Tensor(*canonical_forms.Find(i_source.GetExpression().get()));
+
+        if (!m_type_inference_axioms_rhss.empty())
+            CompileTypeInferenceAxioms();
+
+        // the graph is reused for all the nodes, so that its buffers are allocated once
+        m2o_pattern::SubstitutionGraph type_inference_graph(m_type_inference_axioms_tree,
+            m2o_pattern::SubstitutionGraph::SolutionType::All);
+
+        std::vector<Tensor> & new_arguments = scratch.m_new_arguments;
+        for (const Tensor * node : dirty_nodes)
+        {
+            const Expression & expression = *node->GetExpression();
+
+            bool arguments_rewritten = false;
+            new_arguments.clear();
+            for (const Tensor & argument : expression.GetArguments())
+            {
+                const ExpressionPtr * canonical_argument = canonical_forms.Find(argument.GetExpression().get());
+                DJUP_ASSERT(canonical_argument != nullptr && *canonical_argument != nullptr);
+                arguments_rewritten |= *canonical_argument != argument.GetExpression();
+                new_arguments.emplace_back(*canonical_argument);
+            }
+
+            Tensor canonical;
+            if (arguments_rewritten)
+            {
+                const Tensor rebuilt = { HashConsExpression(NewExpression(expression.GetType(),
+                    expression.GetName(), new_arguments, expression.GetMetadata())) };
+                if (ExpressionPtr cached = m_canonicalization_cache.Find(rebuilt.GetExpression()))
+                    canonical = Tensor(std::move(cached));
+                else
+                {
+                    canonical = RewriteRoot(rebuilt, type_inference_graph);
+                    m_canonicalization_cache.Insert(rebuilt.GetExpression(), canonical.GetExpression());
+                }
+            }
+            else
+                canonical = RewriteRoot(*node, type_inference_graph);
+
+            m_canonicalization_cache.Insert(node->GetExpression(), canonical.GetExpression());
+            if (canonical.GetExpression() != node->GetExpression())
+                m_canonicalization_cache.Insert(canonical.GetExpression(), canonical.GetExpression());
+
+            *canonical_forms.Find(&expression) = canonical.GetExpression();
+        }
+
+        return Tensor(*canonical_forms.Find(i_source.GetExpression().get()));
+    }
+
+    CanonicalizationCacheStats Namespace::GetCanonicalizationCacheStats() const
+    {
+        return m_canonicalization_cache.GetStats();
+    }
 }
@@ -7,11 +7,21 @@
 #pragma once
 #include <private/common.h>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <private/o2o_pattern/o2o_pattern_match.h>
+#include <private/o2o_pattern/o2o_substitution_template.h>
+#include <private/m2o_pattern/m2o_discrimination_tree.h>
+#include <private/canonicalization_cache.h>
 #include <core/name.h>
 
 namespace djup
 {
+    namespace m2o_pattern
+    {
+        class SubstitutionGraph;
+    }
+
     /** A namespace is a named object which contains declarations (axioms and types).
         Every namespace has a parent namespace, from which inherits all declarations 
         with recursion. There is a global root immutable namespace, which does not 
@@ -42,15 +52,23 @@ namespace djup
 
         void AddSubstitutionAxiom(const Tensor & i_what, const Tensor & i_with, const Tensor & i_when = {});
 
+        /** Adds an axiom that gives a type to the expressions matching i_what, which
+            don't have one. i_type is a type expression, like real or real[n], whose
+            shape can use the identifiers of the pattern. Like the other axioms, it must be
+            added before the namespace is used by other threads. */
         void AddTypeInferenceAxiom(const Tensor & i_what, const Tensor & i_type, const Tensor & i_when = {});
 
         void SetDescribingExpression(const Tensor & i_expr) { m_describing_expression = i_expr; }
 
         const Tensor & GetDescribingExpression() const { return m_describing_expression; }
 
-        /* Applies type inference and substitutions axioms to an expr until 
-           the result doesn't chance anymore */
+        /* Applies type inference and substitutions axioms to every node of an expr, from the
+           leaves to the root, until the result doesn't chance anymore */
         Tensor Canonicalize(const Tensor & i_source) const;
+
+        /* Canonical forms are cached by expression identity. The cache is cleared
+           when an axiom is added. */
+        CanonicalizationCacheStats GetCanonicalizationCacheStats() const;
     
     private:
         
@@ -62,12 +80,33 @@ namespace djup
         };
         std::vector<ScalarType> m_scalar_types;
 
-        // substitution axioms: patterns and right-hand-side expressions
+        /* substitution axioms: patterns and right-hand-side expressions, compiled
+           when the axiom is added */
         std::vector<o2o_pattern::Pattern> m_substitution_axioms_patterns;
-        std::vector<Tensor> m_substitution_axioms_rhss;
+        std::vector<o2o_pattern::SubstitutionTemplate> m_substitution_axioms_rhss;
 
-        // type-inference axioms: patterns and right-hand-side expressions
-        std::vector<o2o_pattern::Pattern> m_type_inference_axioms_patterns;
+        /* index of the substitution axioms: an expression is only tried against the axioms
+           whose pattern root has the same name and a compatible argument count, and against
+           the axioms whose pattern root is an identifier. Indices are in ascending order. */
+        struct SubstitutionAxiomRef
+        {
+            uint32_t m_axiom_index;
+            UIntInterval m_arity;
+        };
+        std::unordered_map<Name, std::vector<SubstitutionAxiomRef>> m_substitution_axioms_by_root_name;
+        std::vector<uint32_t> m_substitution_axioms_with_any_root;
+
+        mutable CanonicalizationCache m_canonicalization_cache;
+
+        /* type-inference axioms: the patterns are in a single discrimination tree, so
+           that all of them are tried against a node in one pass. The id of a pattern
+           is the index of its type expression. The tree is compiled when it is first
+           used after adding axioms, so adding many axioms compiles it only once. The flag
+           is checked before taking the mutex, so canonicalizations running in parallel
+           don't contend once the tree is compiled. */
+        mutable m2o_pattern::DiscriminationTree m_type_inference_axioms_tree;
+        mutable std::mutex m_type_inference_axioms_mutex;
+        mutable std::atomic<bool> m_type_inference_axioms_compiled{ false };
         std::vector<Tensor> m_type_inference_axioms_rhss;
 
         // identifiers
@@ -90,7 +129,19 @@ namespace djup
 
         Tensor ApplySubstitutionAxioms(const Tensor & i_source) const;
 
-        // Tensor ApplyTypeInferenceAxioms(const Tensor & i_source) const;
+        /* Applies the axioms to the root of an expression until it does not change anymore.
+           The arguments are supposed to be already canonical. */
+        Tensor RewriteRoot(const Tensor & i_source,
+            m2o_pattern::SubstitutionGraph & i_type_inference_graph) const;
+
+        // compiles the tree of the type-inference axioms, if an axiom was added since the last use
+        void CompileTypeInferenceAxioms() const;
+
+        /* If the root of the expression has no type, gives it the type of the first
+           matching type-inference axiom. The type is stored in the new expression, so
+           it is inferred only once. */
+        Tensor ApplyTypeInferenceAxioms(const Tensor & i_source,
+            m2o_pattern::SubstitutionGraph & i_type_inference_graph) const;
     };
 
     std::shared_ptr<const Namespace> GetStandardNamespace();
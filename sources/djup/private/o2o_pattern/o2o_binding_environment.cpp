@@ -0,0 +1,49 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/o2o_pattern/o2o_binding_environment.h>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <private/expression_arena.h>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        void * BindingEnvironment::Binding::operator new(size_t i_size)
+        {
+            static_assert(alignof(Binding) <= expression_arena_alignment);
+            return AllocateExpressionStorage(i_size);
+        }
+
+        void BindingEnvironment::Binding::operator delete(void * i_block, size_t i_size) noexcept
+        {
+            DeallocateExpressionStorage(i_block, i_size);
+        }
+
+        BindingEnvironment BindingEnvironment::Bind(const Name & i_identifier, const Tensor & i_value) const
+        {
+            Binding * binding = new Binding{ { m_top }, i_identifier, i_value, GetSize() + 1 };
+            BindingEnvironment result;
+            result.m_top = IntrusivePtr<const Binding>(binding);
+            return result;
+        }
+
+        std::vector<Substitution> BindingEnvironment::ToSubstitutions() const
+        {
+            std::vector<Substitution> substitutions(GetSize());
+            auto dest = substitutions.rbegin();
+            for (const Binding * binding = m_top.get(); binding != nullptr; binding = binding->m_parent.get())
+            {
+                dest->m_identifier_name = binding->m_identifier;
+                dest->m_value = binding->m_value;
+                ++dest;
+            }
+            return substitutions;
+        }
+
+    } // namespace o2o_pattern
+
+} // namespace djup
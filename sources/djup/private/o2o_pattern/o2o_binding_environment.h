@@ -0,0 +1,105 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <djup/tensor.h>
+#include <core/name.h>
+#include <core/immutable_chain.h>
+#include <vector>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        struct Substitution;
+
+        /** Immutable set of identifier bindings. Binding an identifier creates a new environment
+            that shares all the bindings of the source one, so it is O(1), and copying an
+            environment only copies a pointer. Environments can be shared between threads.
+            Identifiers are compared by their interned name. */
+        class BindingEnvironment
+        {
+        public:
+
+            bool IsEmpty() const { return !m_top; }
+
+            size_t GetSize() const { return m_top ? m_top->m_size : 0; }
+
+            /** Returns the value bound to an identifier, or null */
+            const Tensor * Find(const Name & i_identifier) const
+            {
+                for (const Binding * binding = m_top.get(); binding != nullptr; binding = binding->m_parent.get())
+                    if (binding->m_identifier == i_identifier)
+                        return &binding->m_value;
+                return nullptr;
+            }
+
+            /** Returns an environment with all the bindings of this one, and a new one */
+            BindingEnvironment Bind(const Name & i_identifier, const Tensor & i_value) const;
+
+            /** Returns the bindings in the order they were added */
+            std::vector<Substitution> ToSubstitutions() const;
+
+            /** Calls a function with the identifier and the value of every binding, in the order
+                they were added. The function returns false to stop, and in this case ForEach
+                returns false too. */
+            template <typename FUNCTION>
+                bool ForEach(FUNCTION && i_function) const
+            {
+                // the chain goes from the last binding, so it is reversed in a small buffer
+                constexpr size_t local_capacity = 16;
+                const Binding * local_bindings[local_capacity];
+                std::vector<const Binding*> heap_bindings;
+                const Binding ** bindings = local_bindings;
+                const size_t size = GetSize();
+                if (size > local_capacity)
+                {
+                    heap_bindings.resize(size);
+                    bindings = heap_bindings.data();
+                }
+
+                size_t index = size;
+                for (const Binding * binding = m_top.get(); binding != nullptr; binding = binding->m_parent.get())
+                    bindings[--index] = binding;
+
+                for (index = 0; index < size; index++)
+                    if (!i_function(bindings[index]->m_identifier, bindings[index]->m_value))
+                        return false;
+                return true;
+            }
+
+            friend bool operator == (const BindingEnvironment & i_first, const BindingEnvironment & i_second)
+            {
+                return i_first.m_top == i_second.m_top;
+            }
+
+            friend bool operator != (const BindingEnvironment & i_first, const BindingEnvironment & i_second)
+            {
+                return !(i_first == i_second);
+            }
+
+        private:
+
+            // the bindings form an immutable chain, shared by all the environments derived from this one
+            struct Binding : ImmutableChainNode<Binding>
+            {
+                Name m_identifier;
+                Tensor m_value;
+                size_t m_size{}; // number of bindings in the chain
+
+                // bindings are allocated by the expression arena, that has a free-list per thread
+                static void * operator new(size_t i_size);
+                static void operator delete(void * i_block, size_t i_size) noexcept;
+            };
+
+        private:
+            IntrusivePtr<const Binding> m_top;
+        };
+
+    } // namespace o2o_pattern
+
+} // namespace djup
@@ -0,0 +1,317 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/o2o_pattern/o2o_match_trace.h>
+#include <core/graph_wiz.h>
+#include <core/to_string.h>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        namespace
+        {
+            constexpr char g_trace_magic[8] = "djuptrc";
+            constexpr uint32_t g_trace_version = 1;
+
+            template <typename TYPE>
+                void WriteRaw(std::ofstream & i_stream, const TYPE & i_value)
+            {
+                i_stream.write(reinterpret_cast<const char*>(&i_value), sizeof(i_value));
+            }
+
+            template <typename TYPE>
+                TYPE ReadRaw(std::ifstream & i_stream)
+            {
+                TYPE value{};
+                i_stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+                if (!i_stream)
+                    Error("Truncated trace file");
+                return value;
+            }
+        }
+
+        MatchTrace::MatchTrace(size_t i_capacity)
+        {
+            size_t capacity = 1;
+            while (capacity < i_capacity)
+                capacity *= 2;
+            m_records.resize(capacity);
+            m_mask = capacity - 1;
+        }
+
+        void MatchTrace::Clear()
+        {
+            m_written = 0;
+            m_strings.clear();
+            m_string_indices.clear();
+        }
+
+        uint32_t MatchTrace::AddString(const Tensor & i_expression)
+        {
+            auto res = m_string_indices.insert({ i_expression.GetExpression().get(),
+                NumericCast<uint32_t>(m_strings.size()) });
+            if (res.second)
+                m_strings.push_back(ToSimplifiedString(i_expression));
+            return res.first->second;
+        }
+
+        uint32_t MatchTrace::AddString(const Name & i_name)
+        {
+            // names are interned, so the characters identify the name
+            auto res = m_string_indices.insert({ i_name.AsStringView().data(),
+                NumericCast<uint32_t>(m_strings.size()) });
+            if (res.second)
+                m_strings.push_back(i_name.AsString());
+            return res.first->second;
+        }
+
+        void MatchTrace::Save(const std::filesystem::path & i_path) const
+        {
+            std::ofstream stream(i_path, std::ios::binary);
+            if (!stream)
+                Error("Could not write file ", i_path.string());
+
+            const uint64_t record_count = m_written - GetDroppedCount();
+
+            stream.write(g_trace_magic, sizeof(g_trace_magic));
+            WriteRaw(stream, g_trace_version);
+            WriteRaw(stream, NumericCast<uint32_t>(m_strings.size()));
+            WriteRaw(stream, record_count);
+            WriteRaw(stream, GetDroppedCount());
+
+            for (const std::string & string : m_strings)
+            {
+                WriteRaw(stream, NumericCast<uint32_t>(string.size()));
+                stream.write(string.data(), string.size());
+            }
+
+            for (uint64_t index = m_written - record_count; index < m_written; index++)
+                WriteRaw(stream, m_records[index & m_mask]);
+
+            if (!stream)
+                Error("Could not write file ", i_path.string());
+        }
+
+        namespace
+        {
+            struct ReplayEdge
+            {
+                uint32_t m_dest_node{};
+                uint32_t m_repetitions{};
+                uint8_t m_open{};
+                uint8_t m_close{};
+                bool m_matched{ false };
+                std::string m_label;
+                std::vector<std::string> m_substitutions;
+            };
+
+            class TraceReplayer
+            {
+            public:
+
+                TraceReplayer(std::vector<std::string> i_strings, std::filesystem::path i_dest_dir)
+                    : m_strings(std::move(i_strings)), m_dest_dir(std::move(i_dest_dir))
+                {
+                }
+
+                void Apply(const TraceRecord & i_record)
+                {
+                    const uint32_t * values = i_record.m_values;
+                    switch (i_record.m_event)
+                    {
+                    case TraceEvent::Step:
+                        SaveImage(values[0] == 0 ? "Initial" : ToString("Step_", values[0]));
+                        break;
+
+                    case TraceEvent::NewNode:
+                        // nodes are implied by the edges
+                        break;
+
+                    case TraceEvent::RemoveNode:
+                        // the outgoing edges of the node are removed with it
+                        for (auto it = m_edges.lower_bound({ values[0], 0 });
+                            it != m_edges.end() && it->first.first == values[0]; )
+                            it = m_edges.erase(it);
+                        m_last_edge = nullptr;
+                        break;
+
+                    case TraceEvent::NewEdge:
+                    {
+                        ReplayEdge & edge = m_edges[{ values[0], values[1] }];
+                        edge = ReplayEdge{};
+                        edge.m_dest_node = values[2];
+                        edge.m_repetitions = values[3];
+                        edge.m_open = i_record.m_open;
+                        edge.m_close = i_record.m_close;
+                        m_last_edge = &edge;
+                        break;
+                    }
+
+                    case TraceEvent::EdgeLabel:
+                        if (m_last_edge != nullptr)
+                        {
+                            const std::string target = SpanLabel(values[0], values[1], values[2]);
+                            const std::string pattern = SpanLabel(values[3], values[4], values[5]);
+                            if (!target.empty() && !pattern.empty())
+                            {
+                                m_last_edge->m_label = target + "\nis\n" + pattern;
+                                if (m_last_edge->m_repetitions != 1)
+                                    m_last_edge->m_label += ToString(" (", m_last_edge->m_repetitions, " times)");
+                            }
+                        }
+                        break;
+
+                    case TraceEvent::MatchEdge:
+                        if (ReplayEdge * edge = FindEdge(values[0], values[1]))
+                            edge->m_matched = true;
+                        break;
+
+                    case TraceEvent::Substitution:
+                        if (ReplayEdge * edge = FindEdge(values[0], values[1]))
+                            edge->m_substitutions.push_back(GetString(values[2]) + " = " + GetString(values[3]));
+                        break;
+
+                    case TraceEvent::RemoveEdge:
+                        m_edges.erase({ values[0], values[1] });
+                        m_last_edge = nullptr;
+                        break;
+
+                    default:
+                        Error("Unknown trace event ", static_cast<int>(i_record.m_event));
+                    }
+                }
+
+            private:
+
+                ReplayEdge * FindEdge(uint32_t i_node, uint32_t i_edge_index)
+                {
+                    auto it = m_edges.find({ i_node, i_edge_index });
+                    return it != m_edges.end() ? &it->second : nullptr;
+                }
+
+                std::string GetString(uint32_t i_index) const
+                {
+                    if (i_index == MatchTrace::s_no_string)
+                        return {};
+                    if (i_index >= m_strings.size())
+                        Error("Invalid string index in trace: ", i_index);
+                    return m_strings[i_index];
+                }
+
+                std::string SpanLabel(uint32_t i_first, uint32_t i_last, uint32_t i_count) const
+                {
+                    switch (i_count)
+                    {
+                    case 0: return {};
+                    case 1: return GetString(i_first);
+                    case 2: return GetString(i_first) + ", " + GetString(i_last);
+                    default: return GetString(i_first) + ", ..., " + GetString(i_last) +
+                        ToString(" (", i_count, " arguments)");
+                    }
+                }
+
+                void SaveImage(const std::string & i_title) const
+                {
+                    GraphWizGraph graph(i_title);
+
+                    std::map<uint32_t, size_t> graph_nodes;
+                    auto GetGraphNode = [&](uint32_t i_node) {
+                        auto res = graph_nodes.insert({ i_node, graph_nodes.size() });
+                        if (res.second)
+                        {
+                            if (i_node == 0)
+                                graph.AddNode("Initial (0)");
+                            else if (i_node == 1)
+                                graph.AddNode("Final (1)");
+                            else
+                                graph.AddNode(ToString("Node ", i_node));
+                        }
+                        return res.first->second;
+                    };
+
+                    for (const auto & [key, edge] : m_edges)
+                    {
+                        const size_t source = GetGraphNode(key.first);
+                        const size_t dest = GetGraphNode(edge.m_dest_node);
+                        GraphWizGraph::Edge & dest_edge = graph.AddEdge(source, dest);
+
+                        if (edge.m_open)
+                            dest_edge.SetTailLabel(std::string(edge.m_open, '+'));
+                        if (edge.m_close)
+                            dest_edge.SetHeadLabel(std::string(edge.m_close, '-'));
+
+                        if (edge.m_matched)
+                        {
+                            std::string label;
+                            for (const std::string & substitution : edge.m_substitutions)
+                            {
+                                if (!label.empty())
+                                    label += "\n";
+                                label += substitution;
+                            }
+                            dest_edge.SetLabel(label);
+                        }
+                        else
+                        {
+                            // still a candidate
+                            dest_edge.SetLabel(edge.m_label);
+                            dest_edge.SetStyle(GraphWizGraph::EdgeStyle::Dashed);
+                        }
+                    }
+
+                    graph.SaveAsImage(m_dest_dir / (i_title + ".png"));
+                }
+
+            private:
+                std::vector<std::string> m_strings;
+                std::filesystem::path m_dest_dir;
+                std::map<std::pair<uint32_t, uint32_t>, ReplayEdge> m_edges;
+                ReplayEdge * m_last_edge{};
+            };
+        }
+
+        void ReplayMatchTrace(const std::filesystem::path & i_trace_path,
+            const std::filesystem::path & i_dest_dir)
+        {
+            std::ifstream stream(i_trace_path, std::ios::binary);
+            if (!stream)
+                Error("Could not read file ", i_trace_path.string());
+
+            char magic[sizeof(g_trace_magic)]{};
+            stream.read(magic, sizeof(magic));
+            if (!stream || std::memcmp(magic, g_trace_magic, sizeof(magic)) != 0)
+                Error(i_trace_path.string(), " is not a match trace");
+            const uint32_t version = ReadRaw<uint32_t>(stream);
+            if (version != g_trace_version)
+                Error("Unsupported trace version ", version);
+
+            const uint32_t string_count = ReadRaw<uint32_t>(stream);
+            const uint64_t record_count = ReadRaw<uint64_t>(stream);
+            const uint64_t dropped_count = ReadRaw<uint64_t>(stream);
+            if (dropped_count != 0)
+                PrintLn("Warning: ", dropped_count, " records were overwritten, the graph is incomplete");
+
+            std::vector<std::string> strings(string_count);
+            for (std::string & string : strings)
+            {
+                string.resize(ReadRaw<uint32_t>(stream));
+                stream.read(string.data(), string.size());
+                if (!stream)
+                    Error("Truncated trace file");
+            }
+
+            TraceReplayer replayer(std::move(strings), i_dest_dir);
+            for (uint64_t index = 0; index < record_count; index++)
+                replayer.Apply(ReadRaw<TraceRecord>(stream));
+        }
+
+    } // namespace o2o_pattern
+
+} // namespace djup
@@ -0,0 +1,97 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <private/expression.h>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        enum class TraceEvent : uint8_t
+        {
+            Step,           /**< m_values: step index. Images are produced at every step */
+            NewNode,        /**< m_values: node */
+            NewEdge,        /**< m_values: source node, edge index, dest node, repetitions */
+            EdgeLabel,      /**< m_values: first target, last target, target count,
+                                 first pattern, last pattern, pattern count (strings) */
+            MatchEdge,      /**< m_values: source node, edge index */
+            Substitution,   /**< m_values: source node, edge index, identifier, value (strings) */
+            RemoveEdge,     /**< m_values: source node, edge index */
+            RemoveNode,     /**< m_values: node */
+        };
+
+        /** Fixed size record of an event of the construction of a substitution graph */
+        struct TraceRecord
+        {
+            TraceEvent m_event{};
+            uint8_t m_open{};
+            uint8_t m_close{};
+            uint8_t m_unused{};
+            uint32_t m_values[6]{};
+        };
+
+        /** Records the steps of MakeSubstitutionsGraph in a ring buffer of binary records,
+            without formatting or rendering anything while matching. When the buffer is full
+            the oldest records are overwritten. Expressions and names are converted to string
+            only the first time they are recorded, and records refer to them by index. The trace
+            can be saved to a file, and ReplayMatchTrace renders it offline. */
+        class MatchTrace
+        {
+        public:
+
+            constexpr static uint32_t s_no_string = std::numeric_limits<uint32_t>::max();
+
+            /** The capacity is rounded up to a power of 2 */
+            explicit MatchTrace(size_t i_capacity = size_t(1) << 16);
+
+            void Clear();
+
+            void Record(const TraceRecord & i_record)
+            {
+                m_records[m_written & m_mask] = i_record;
+                m_written++;
+            }
+
+            /** Returns the index of the string of an expression */
+            uint32_t AddString(const Tensor & i_expression);
+
+            /** Returns the index of the string of an identifier */
+            uint32_t AddString(const Name & i_name);
+
+            /** Number of records overwritten because the buffer was full */
+            uint64_t GetDroppedCount() const
+            {
+                return m_written > m_records.size() ? m_written - m_records.size() : 0;
+            }
+
+            /** Writes the records still in the buffer, from the oldest */
+            void Save(const std::filesystem::path & i_path) const;
+
+        private:
+            std::vector<TraceRecord> m_records;
+            uint64_t m_mask{};
+            uint64_t m_written{};
+            std::vector<std::string> m_strings;
+            std::unordered_map<const void*, uint32_t> m_string_indices;
+        };
+
+        /** Reads a trace saved by MatchTrace::Save, and saves an image of the substitution
+            graph for every step in i_dest_dir. If some records were overwritten, the graph is
+            rebuilt from the oldest record available, so it misses the older nodes and edges. */
+        void ReplayMatchTrace(const std::filesystem::path & i_trace_path,
+            const std::filesystem::path & i_dest_dir);
+
+    } // namespace o2o_pattern
+
+} // namespace djup
@@ -9,6 +9,8 @@
 #include <private/o2o_pattern/o2o_debug_utils.h>
 #include <private/builtin_names.h>
 #include <core/to_string.h>
+#include <algorithm>
+#include <unordered_set>
 
 namespace djup
 {
@@ -57,6 +59,57 @@ namespace djup
             return result;
         }
 
+        PatternInfoTable::PatternInfoTable(const Tensor & i_pattern)
+            : m_pattern(i_pattern)
+        {
+            std::unordered_set<const Expression*> visited;
+            std::vector<const Tensor*> stack;
+            stack.push_back(&m_pattern);
+            while (!stack.empty())
+            {
+                const Tensor & pattern = *stack.back();
+                stack.pop_back();
+
+                if (!visited.insert(pattern.GetExpression().get()).second)
+                    continue;
+
+                const PatternInfo info = BuildPatternInfo(pattern);
+
+                Entry & entry = m_entries.emplace_back();
+                entry.m_expression = pattern.GetExpression().get();
+                entry.m_flags = info.m_flags;
+                entry.m_arguments_range = info.m_arguments_range;
+                entry.m_first_argument = NumericCast<uint32_t>(m_arguments_info.size());
+                entry.m_argument_count = NumericCast<uint32_t>(info.m_arguments_info.size());
+                m_arguments_info.insert(m_arguments_info.end(),
+                    info.m_arguments_info.begin(), info.m_arguments_info.end());
+                for (ArgumentInfo argument_info : info.m_arguments_info)
+                {
+                    argument_info.m_remaining = { 0, 0 };
+                    m_isolated_arguments_info.push_back(argument_info);
+                }
+
+                for (const Tensor & argument : pattern.GetExpression()->GetArguments())
+                    stack.push_back(&argument);
+            }
+
+            std::sort(m_entries.begin(), m_entries.end(), [](const Entry & i_first, const Entry & i_second) {
+                return std::less<const Expression*>()(i_first.m_expression, i_second.m_expression);
+            });
+        }
+
+        const PatternInfoTable::Entry & PatternInfoTable::GetEntry(const Tensor & i_sub_pattern) const
+        {
+            const Expression * expression = i_sub_pattern.GetExpression().get();
+            auto it = std::lower_bound(m_entries.begin(), m_entries.end(), expression,
+                [](const Entry & i_entry, const Expression * i_expression) {
+                    return std::less<const Expression*>()(i_entry.m_expression, i_expression);
+                });
+            if (it == m_entries.end() || it->m_expression != expression)
+                Error("PatternInfoTable::GetEntry - ", ToSimplifiedString(i_sub_pattern), " is not a sub-pattern");
+            return *it;
+        }
+
         bool operator == (const PatternInfo & i_first, const PatternInfo & i_second)
         {
             if (i_first.m_arguments_range != i_second.m_arguments_range ||
@@ -15,8 +15,14 @@
 
 /* Warning: this flags will alter the layout of classes, adding
    string where it is useful for debug purpose. They can also
-   enable some Print. */
-#define DJUP_DEBUG_PATTERN_INFO                         true
+   enable some Print. By default they are enabled only in debug builds. */
+#ifndef DJUP_DEBUG_PATTERN_INFO
+    #ifdef NDEBUG
+        #define DJUP_DEBUG_PATTERN_INFO                 false
+    #else
+        #define DJUP_DEBUG_PATTERN_INFO                 true
+    #endif
+#endif
 
 namespace djup
 {
@@ -81,6 +87,55 @@ namespace djup
         /** Constructs a PatternInfo (static pattern information) given a pattern */
         PatternInfo BuildPatternInfo(const Tensor & i_pattern);
 
+        /** Static information of all the sub-patterns of a pattern, computed once when
+            the table is constructed. Entries are stored in a flat array sorted by the
+            address of the expression, and the arguments of all the entries are stored
+            contiguously in another array. While hash-consing is enabled equal sub-expressions
+            are shared, so repeated sub-patterns have a single entry; otherwise every occurrence
+            has its own entry. */
+        class PatternInfoTable
+        {
+        public:
+
+            struct Entry
+            {
+                const Expression * m_expression{};
+                FunctionFlags m_flags{};
+                UIntInterval m_arguments_range;
+                uint32_t m_first_argument{};
+                uint32_t m_argument_count{};
+            };
+
+            PatternInfoTable() = default;
+
+            explicit PatternInfoTable(const Tensor & i_pattern);
+
+            /** Returns the entry of a sub-pattern. Fails with an error if the pattern is not a
+                sub-expression of the one the table was built from. */
+            const Entry & GetEntry(const Tensor & i_sub_pattern) const;
+
+            Span<const ArgumentInfo> GetArgumentsInfo(const Entry & i_entry) const
+            {
+                return Span<const ArgumentInfo>(m_arguments_info.data() + i_entry.m_first_argument,
+                    i_entry.m_argument_count);
+            }
+
+            /** Like GetArgumentsInfo, but every argument is described as if it were alone in its
+                segment (m_remaining is zero). Used to match arguments one by one, like in
+                commutative functions. */
+            Span<const ArgumentInfo> GetIsolatedArgumentsInfo(const Entry & i_entry) const
+            {
+                return Span<const ArgumentInfo>(m_isolated_arguments_info.data() + i_entry.m_first_argument,
+                    i_entry.m_argument_count);
+            }
+
+        private:
+            Tensor m_pattern; // keeps alive the expressions the entries point to
+            std::vector<Entry> m_entries;
+            std::vector<ArgumentInfo> m_arguments_info;
+            std::vector<ArgumentInfo> m_isolated_arguments_info;
+        };
+
     } // namespace o2o_pattern
 
 } // namespace djup
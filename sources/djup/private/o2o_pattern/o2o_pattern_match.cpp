@@ -12,10 +12,17 @@
 #include <private/o2o_pattern/o2o_pattern_info.h>
 #include <private/o2o_pattern/o2o_debug_utils.h>
 #include <private/o2o_pattern/o2o_substitutions_builder.h>
+#include <private/o2o_pattern/o2o_match_trace.h>
 #include <private/builtin_names.h>
 #include <core/flags.h>
 #include <core/pool.h>
-#include <core/graph_wiz.h>
+#include <core/thread_pool.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <algorithm>
+#include <functional>
 
 namespace djup
 {
@@ -23,6 +30,8 @@ namespace djup
     {
         namespace
         {
+            /* Only the rebuilt nodes are canonicalized: SubstitutionRebuild::CanonicalizeResult
+               would apply the axioms of the namespace to the whole pattern */
             Tensor PreprocessPattern(const Namespace & i_namespace, const Tensor & i_pattern)
             {
                 return SubstituteByPredicate(i_namespace, i_pattern, [&i_namespace](const Tensor & i_candidate) {
@@ -31,7 +40,7 @@ namespace djup
                     bool some_substitution = false;
                     std::vector<Tensor> new_arguments;
 
-                    const std::vector<Tensor> & arguments = i_candidate.GetExpression()->GetArguments();
+                    const Span<const Tensor> arguments = i_candidate.GetExpression()->GetArguments();
                     const size_t argument_count = arguments.size();
 
                     // substitute identifiers in associative functions with AssociativeIdentifier()
@@ -44,7 +53,7 @@ namespace djup
                             const Tensor & argument = arguments[index];
                             if (!IsConstant(argument))
                             {
-                                new_arguments = arguments;
+                                new_arguments.assign(arguments.begin(), arguments.end());
                                 some_substitution = true;
                                 break;
                             }
@@ -92,22 +101,18 @@ namespace djup
             }
         };
 
-        struct GraphNode
-        {
-            size_t m_incoming_edges{};
-        };
-
         struct Candidate
         {
             uint32_t m_start_node{};
             uint32_t m_dest_node{};
+            uint32_t m_edge_index{}; // index of the edge in the outgoing edges of the start node
             Span<const Tensor> m_target_arguments;
             PatternSegment m_segment;
             uint32_t m_repetitions = 0;
             uint32_t m_version{};
             uint32_t m_open{};
             uint32_t m_close{};
-            std::vector<Substitution> m_substitutions;
+            BindingEnvironment m_substitutions;
         };
 
         StringBuilder & operator << (StringBuilder & i_dest, const Candidate & i_source)
@@ -124,9 +129,66 @@ namespace djup
         {
             uint32_t m_dest_index{};
             Pool<Candidate>::Handle m_candidate_ref;
-            std::vector<Substitution> m_substitutions;
+            BindingEnvironment m_substitutions;
             uint32_t m_open;
             uint32_t m_close;
+            bool m_removed{ false };
+        };
+
+        /* The outgoing edges of a node are stored contiguously in the node. Removed
+           edges are only marked, so that the index of an edge never changes while the
+           graph is built. When all the outgoing edges are removed, the vector is cleared. */
+        struct GraphNode
+        {
+            size_t m_incoming_edges{};
+            std::vector<Edge> m_outgoing_edges;
+        };
+
+        struct SolutionBuilder
+        {
+            uint32_t m_curr_node;
+            SubstitutionsBuilder m_builder;
+        };
+
+        struct SearchState
+        {
+            std::vector<Candidate> m_pending_edges;
+            SubstitutionsBuilder m_builder;
+        };
+
+        /* Arguments of commutative targets rearranged by the contexts of a parallel match. The
+           paths that refer to them may be explored by other contexts, so they are owned by the
+           match rather than by the context that created them. */
+        struct SharedArrangedTargets
+        {
+            std::mutex m_mutex;
+            std::deque<std::vector<Tensor>> m_targets;
+        };
+
+        /* Containers of CommutativeAssigner, owned by the matching context so that
+           they are reused by all the commutative functions of the matches */
+        struct CommutativeAssignerBuffers
+        {
+            struct Argument
+            {
+                const Expression * m_pattern{};
+                UIntInterval m_cardinality;
+                bool m_fixed{};
+                std::vector<bool> m_accepts;
+                std::vector<uint32_t> m_candidates; // only for fixed arguments
+                uint32_t m_assigned_target{}; // only for fixed arguments
+            };
+
+            std::vector<uint32_t> m_groups;
+            std::vector<Argument> m_arguments;
+            std::vector<uint32_t> m_fixed_arguments;
+            std::vector<uint32_t> m_variadic_arguments;
+            std::vector<bool> m_used;
+            std::vector<bool> m_covered;
+            std::vector<uint32_t> m_owners;
+            std::vector<uint32_t> m_remaining;
+            std::vector<uint32_t> m_counts;
+            bool m_in_use{ false };
         };
 
         struct MatchingContext
@@ -135,137 +197,244 @@ namespace djup
             Pool<Candidate> m_candidates;
             std::vector<Pool<Candidate>::Handle> m_candidate_queue;
             std::vector<GraphNode> m_graph_nodes;
-            std::unordered_multimap<uint32_t, Edge> m_edges; // the key is the source node
-            std::unordered_map<const Expression*, PatternInfo> m_pattern_infos;
+            std::vector<std::vector<Edge>> m_free_edge_vectors; // recycled by NewGraphNode
+            const PatternInfoTable * m_pattern_infos{nullptr};
             const char * m_artifact_path{nullptr};
-        };
-
-        constexpr uint32_t g_start_node_index = 0;
-        constexpr uint32_t g_end_node_index = 1;
 
-        GraphWizGraph MakeSolutionGraphWiz(const MatchingContext & i_source,
-            std::string i_graph_name)
-        {
-            GraphWizGraph graph(i_graph_name);
-            
-            // next_candidate
-            const Candidate * next_candidate = nullptr;
-            for (auto it = i_source.m_candidate_queue.rbegin();
-                it != i_source.m_candidate_queue.rend();
-                ++it)
+            /* not null only if there is an artifact path. The trace is kept with its
+               buffer when the context is cleared, so that it is allocated only once. */
+            MatchTrace * m_trace{nullptr};
+            std::unique_ptr<MatchTrace> m_trace_storage;
+
+            /* if true, LinearPath appends the edges of every path to m_paths,
+               instead of adding them to the graph. Only the first m_path_count paths
+               are used: the others are kept empty, to reuse their capacity. */
+            bool m_collect_paths{false};
+            std::vector<std::vector<Candidate>> m_paths;
+            size_t m_path_count{};
+
+            // scratch containers of RemoveNode, GetAllSolutions and FindFirstSolution
+            std::vector<uint32_t> m_nodes_to_remove;
+            std::vector<SolutionBuilder> m_solution_builders;
+            std::vector<SolutionBuilder> m_next_solution_builders;
+            size_t m_used_solution_builders{}; // builders of both vectors to reset in Clear
+            VariadicCaptures::MaterializeScratch m_materialize_scratch;
+            CommutativeAssignerBuffers m_commutative_assigner_buffers;
+            /* The states of the depth-first search. Only the first m_search_depth states are
+               used: popped states are kept, so that their containers can be reused. */
+            std::vector<SearchState> m_search_stack;
+            size_t m_search_depth{};
+            size_t m_used_search_states{}; // states to reset in Clear
+            SearchState m_search_state; // the state being advanced
+
+            /* arguments of commutative targets rearranged in the order of the pattern. Edges
+               refer to them, so they are kept until the end of the match. */
+            std::deque<std::vector<Tensor>> m_arranged_targets;
+            size_t m_arranged_target_count{}; // the other vectors are kept empty, to be reused
+            SharedArrangedTargets * m_shared_arranged_targets{nullptr}; // used instead if not null
+
+            /* Removes the state of the last match, but keeps the capacity of the
+               containers. Candidates left by a match interrupted by an exception
+               are deleted too. */
+            void Clear()
             {
-                next_candidate = i_source.m_candidates.TryGetObject(*it);
-                if (next_candidate != nullptr)
-                    break;
+                if (m_candidates.GetObjectCount() != 0)
+                {
+                    for (auto it = m_candidates.begin(); it != m_candidates.end(); ++it)
+                        m_candidates.Delete(m_candidates.HandleOf(*it));
+                }
+                m_candidate_queue.clear();
+                for (GraphNode & node : m_graph_nodes)
+                {
+                    node.m_outgoing_edges.clear();
+                    m_free_edge_vectors.push_back(std::move(node.m_outgoing_edges));
+                }
+                m_graph_nodes.clear();
+                m_pattern_infos = nullptr;
+                m_artifact_path = nullptr;
+                m_trace = nullptr;
+                m_collect_paths = false;
+                ClearPaths();
+                m_nodes_to_remove.clear();
+                // the builders are only reset, so that they keep the capacity of their containers
+                for (size_t index = 0; index < m_used_solution_builders; index++)
+                {
+                    if (index < m_solution_builders.size())
+                        m_solution_builders[index].m_builder.Clear();
+                    if (index < m_next_solution_builders.size())
+                        m_next_solution_builders[index].m_builder.Clear();
+                }
+                m_used_solution_builders = 0;
+                for (size_t index = 0; index < m_used_search_states; index++)
+                    ResetSearchState(m_search_stack[index]);
+                m_used_search_states = 0;
+                m_search_depth = 0;
+                ResetSearchState(m_search_state);
+                for (size_t index = 0; index < m_arranged_target_count; index++)
+                    m_arranged_targets[index].clear();
+                m_arranged_target_count = 0;
+                m_shared_arranged_targets = nullptr;
+                m_commutative_assigner_buffers.m_in_use = false; // the constructor may have thrown
             }
 
-            for (size_t i = 0; i < i_source.m_graph_nodes.size(); i++)
+            void ClearPaths()
             {
-                GraphWizGraph::Node & dest_node = graph.AddNode({});
-
-                if (i == g_end_node_index)
-                    dest_node.SetLabel("Final (1)");
-                else if (i == g_start_node_index)
-                    dest_node.SetLabel("Initial (0)");
-                else
-                    dest_node.SetLabel(ToString("Node ", i));
+                for (size_t index = 0; index < m_path_count; index++)
+                    m_paths[index].clear();
+                m_path_count = 0;
             }
 
-            for (const auto & edge : i_source.m_edges)
+            /** Returns a new state on the top of the search stack, possibly with the content of a previous state */
+            SearchState & PushSearchState()
             {
-                GraphWizGraph::Edge & dest_edge = graph.AddEdge(
-                    edge.first, edge.second.m_dest_index);
+                if (m_search_depth == m_search_stack.size())
+                    m_search_stack.emplace_back();
+                m_used_search_states = std::max(m_used_search_states, m_search_depth + 1);
+                return m_search_stack[m_search_depth++];
+            }
 
-                auto Append = [&](std::string & i_dest, const std::string & i_str) {
-                    if (!i_dest.empty())
-                        i_dest += "\n";
-                    i_dest += i_str;
-                };
+            /** Swaps the top of the search stack with m_search_state, and pops it */
+            void PopSearchState()
+            {
+                DJUP_ASSERT(m_search_depth > 0);
+                std::swap(m_search_state, m_search_stack[--m_search_depth]);
+            }
 
-                std::string label, head, tail;
-                if (i_source.m_candidates.IsValid(edge.second.m_candidate_ref))
-                {
-                    const Candidate & candidate = i_source.m_candidates.GetObject(edge.second.m_candidate_ref);
-                    if (HasAllFlags(candidate.m_segment.m_flags, CombineFlags(FunctionFlags::Associative, FunctionFlags::Commutative)))
-                        Append(label, "ac");
-                    else if (HasFlag(candidate.m_segment.m_flags, FunctionFlags::Associative))
-                        Append(label, "a");
-                    else if (HasFlag(candidate.m_segment.m_flags, FunctionFlags::Commutative))
-                        Append(label, "a");
-                }
+        private:
 
-                if (edge.second.m_open)
-                    Append(tail, std::string(edge.second.m_open, '+'));
+            static void ResetSearchState(SearchState & io_state)
+            {
+                io_state.m_pending_edges.clear();
+                io_state.m_builder.Clear();
+            }
+        };
 
-                if (edge.second.m_close)
-                    Append(head, std::string(edge.second.m_close, '-'));
+        std::vector<Tensor> & NewArrangedTargets(MatchingContext & i_context)
+        {
+            if (i_context.m_shared_arranged_targets != nullptr)
+            {
+                // deque::emplace_back does not move the other elements, so no lock is needed to fill it
+                std::lock_guard<std::mutex> lock(i_context.m_shared_arranged_targets->m_mutex);
+                return i_context.m_shared_arranged_targets->m_targets.emplace_back();
+            }
+            if (i_context.m_arranged_target_count == i_context.m_arranged_targets.size())
+                i_context.m_arranged_targets.emplace_back();
+            return i_context.m_arranged_targets[i_context.m_arranged_target_count++];
+        }
 
-                dest_edge.SetHeadLabel(head);
-                dest_edge.SetTailLabel(tail);
+        void Trace(MatchingContext & i_context, TraceEvent i_event,
+            std::initializer_list<uint32_t> i_values, uint32_t i_open = 0, uint32_t i_close = 0)
+        {
+            DJUP_ASSERT(i_context.m_trace != nullptr && i_values.size() <= std::size(TraceRecord{}.m_values));
+            TraceRecord record;
+            record.m_event = i_event;
+            record.m_open = NumericCast<uint8_t>(i_open);
+            record.m_close = NumericCast<uint8_t>(i_close);
+            std::copy(i_values.begin(), i_values.end(), record.m_values);
+            i_context.m_trace->Record(record);
+        }
 
-                // if this edge is associated with an alive candidate
-                if (i_source.m_candidates.IsValid(edge.second.m_candidate_ref))
-                {
-                    const Candidate & candidate = i_source.m_candidates.GetObject(edge.second.m_candidate_ref);
+        void TraceSpan(MatchTrace & i_trace, Span<const Tensor> i_span, uint32_t * o_values)
+        {
+            o_values[0] = i_span.empty() ? MatchTrace::s_no_string : i_trace.AddString(i_span.front());
+            o_values[1] = i_span.empty() ? MatchTrace::s_no_string : i_trace.AddString(i_span.back());
+            o_values[2] = NumericCast<uint32_t>(i_span.size());
+        }
 
-                    std::string label;
-                    if (!candidate.m_target_arguments.empty() && !candidate.m_segment.m_pattern.empty())
-                    {
-                        Append(label, TensorSpanToString(candidate.m_target_arguments));
-                        Append(label, "is" );
-                        Append(label, TensorSpanToString(candidate.m_segment.m_pattern));
-                        if (candidate.m_repetitions != 1)
-                            Append(label, ToString(" (", candidate.m_repetitions, " times)"));
-                    }
+        uint32_t NewGraphNode(MatchingContext & i_context)
+        {
+            const uint32_t node_index = NumericCast<uint32_t>(i_context.m_graph_nodes.size());
+            GraphNode & node = i_context.m_graph_nodes.emplace_back();
+            if (!i_context.m_free_edge_vectors.empty())
+            {
+                node.m_outgoing_edges = std::move(i_context.m_free_edge_vectors.back());
+                i_context.m_free_edge_vectors.pop_back();
+            }
 
-                    for (const auto & substitution : candidate.m_substitutions)
-                    {
-                        Append(label, ToString(substitution.m_identifier_name, 
-                            " = ", ToSimplifiedString(substitution.m_value)));
-                    }
+            if (i_context.m_trace != nullptr)
+                Trace(i_context, TraceEvent::NewNode, { node_index });
 
-                    dest_edge.SetLabel(label);
+            return node_index;
+        }
 
-                    dest_edge.SetStyle(GraphWizGraph::EdgeStyle::Dashed);
+        /* Matching contexts are reused by every thread, so that after the first matches
+           their containers don't need to grow anymore. A match may start other matches
+           (for example applying substitutions may canonicalize an expression), so every
+           thread has a stack of free contexts, rather than a single one. */
+        class ScopedMatchingContext
+        {
+        public:
 
-                    // make the next edge to be processed red
-                    if (&candidate == next_candidate)
-                    {
-                        dest_edge.SetDrawingColor({ 100, 0, 0 });
-                        dest_edge.SetFontColor({ 100, 0, 0 });
-                    }
+            ScopedMatchingContext(const Namespace & i_namespace,
+                const PatternInfoTable & i_pattern_infos, const char * i_artifact_path)
+            {
+                std::vector<std::unique_ptr<MatchingContext>> & free_contexts = GetFreeContexts();
+                if (free_contexts.empty())
+                {
+                    m_context = std::make_unique<MatchingContext>();
                 }
                 else
                 {
-                    std::string label;
-                    for (const auto & substitution : edge.second.m_substitutions)
-                    {
-                        Append(label, ToString(substitution.m_identifier_name,
-                            " = ", ToSimplifiedString(substitution.m_value)));
-                    }
-                    dest_edge.SetLabel(label);
+                    m_context = std::move(free_contexts.back());
+                    free_contexts.pop_back();
+                }
+                m_context->m_namespace = &i_namespace;
+                m_context->m_pattern_infos = &i_pattern_infos;
+                m_context->m_artifact_path = i_artifact_path;
+                if (i_artifact_path != nullptr)
+                {
+                    if (!m_context->m_trace_storage)
+                        m_context->m_trace_storage = std::make_unique<MatchTrace>();
+                    m_context->m_trace_storage->Clear();
+                    m_context->m_trace = m_context->m_trace_storage.get();
                 }
             }
 
-            return graph;
-        }
+            ScopedMatchingContext(const ScopedMatchingContext &) = delete;
+            ScopedMatchingContext & operator = (const ScopedMatchingContext &) = delete;
 
+            ~ScopedMatchingContext()
+            {
+                // the context must not keep alive the expressions of the targets
+                m_context->Clear();
+                GetFreeContexts().push_back(std::move(m_context));
+            }
 
-        const PatternInfo & GetPatternInfo(MatchingContext & i_context, const Tensor & i_pattern)
-        {
-            const Expression * expr = i_pattern.GetExpression().get();
-            auto it = i_context.m_pattern_infos.find(expr);
-            if (it != i_context.m_pattern_infos.end())
-                return it->second;
-            auto res = i_context.m_pattern_infos.insert({ expr, BuildPatternInfo(i_pattern) });
-            DJUP_ASSERT(res.second);
-            return res.first->second;
-        }
+            MatchingContext & Get() { return *m_context; }
+
+            /** Clears the state of the last match, to start another one with the same pattern */
+            void Reset()
+            {
+                const PatternInfoTable * pattern_infos = m_context->m_pattern_infos;
+                const char * artifact_path = m_context->m_artifact_path;
+                MatchTrace * trace = m_context->m_trace;
+                m_context->Clear();
+                m_context->m_pattern_infos = pattern_infos;
+                m_context->m_artifact_path = artifact_path;
+                m_context->m_trace = trace;
+                if (trace != nullptr)
+                    trace->Clear();
+            }
+
+        private:
+
+            static std::vector<std::unique_ptr<MatchingContext>> & GetFreeContexts()
+            {
+                thread_local std::vector<std::unique_ptr<MatchingContext>> free_contexts;
+                return free_contexts;
+            }
+
+        private:
+            std::unique_ptr<MatchingContext> m_context;
+        };
+
+        constexpr uint32_t g_start_node_index = 0;
+        constexpr uint32_t g_end_node_index = 1;
 
         void AddCandidate(MatchingContext & i_context,
             uint32_t i_start_node, uint32_t i_dest_node,
             Span<const Tensor> i_target, PatternSegment i_pattern,
-            std::vector<Substitution> i_substitutions,
+            BindingEnvironment i_substitutions,
             uint32_t i_open, uint32_t i_close,
             uint32_t i_repetitions = 1)
         {
@@ -283,8 +452,22 @@ namespace djup
             new_candidate.m_close = i_close;
             new_candidate.m_substitutions = std::move(i_substitutions);
 
-            i_context.m_edges.insert({ i_start_node, Edge{i_dest_node, cand_handle, {}, i_open, i_close } });
+            std::vector<Edge> & outgoing_edges = i_context.m_graph_nodes[i_start_node].m_outgoing_edges;
+            new_candidate.m_edge_index = NumericCast<uint32_t>(outgoing_edges.size());
+            outgoing_edges.push_back(Edge{i_dest_node, cand_handle, {}, i_open, i_close });
             i_context.m_graph_nodes[i_dest_node].m_incoming_edges++;
+
+            if (i_context.m_trace != nullptr)
+            {
+                Trace(i_context, TraceEvent::NewEdge, { i_start_node, new_candidate.m_edge_index,
+                    i_dest_node, i_repetitions }, i_open, i_close);
+
+                TraceRecord label;
+                label.m_event = TraceEvent::EdgeLabel;
+                TraceSpan(*i_context.m_trace, i_target, label.m_values);
+                TraceSpan(*i_context.m_trace, i_pattern.m_pattern, label.m_values + 3);
+                i_context.m_trace->Record(label);
+            }
         }
 
         class LinearPath
@@ -296,17 +479,23 @@ namespace djup
                 m_start_node(i_source_candidate.m_start_node), m_dest_node(i_source_candidate.m_dest_node),
                 m_open(i_source_candidate.m_open), m_close(i_source_candidate.m_close)
             {
-
+                if (m_context.m_collect_paths)
+                {
+                    m_path_index = m_context.m_path_count++;
+                    if (m_path_index == m_context.m_paths.size())
+                        m_context.m_paths.emplace_back();
+                    DJUP_ASSERT(m_context.m_paths[m_path_index].empty());
+                }
             }
 
             LinearPath(const LinearPath &) = delete;
             LinearPath & operator = (const LinearPath &) = delete;
 
             void AddEdge(Span<const Tensor> i_target, PatternSegment i_pattern,
-                std::vector<Substitution> i_substitutions,
+                BindingEnvironment i_substitutions,
                 bool i_increase_depth = false, uint32_t i_repetitions = 1)
             {
-                bool empty_edge = i_target.empty() && i_substitutions.empty() && !i_increase_depth;
+                bool empty_edge = i_target.empty() && i_substitutions.IsEmpty() && !i_increase_depth;
 
                 empty_edge = empty_edge || i_repetitions == 0;
 
@@ -320,12 +509,18 @@ namespace djup
 
                     if(m_has_edge)
                     {
-                        const uint32_t intermediate_node = NumericCast<uint32_t>(m_context.m_graph_nodes.size());
-                        m_context.m_graph_nodes.emplace_back();
+                        if (m_context.m_collect_paths)
+                        {
+                            FlushPendingEdge(m_dest_node);
+                        }
+                        else
+                        {
+                            const uint32_t intermediate_node = NewGraphNode(m_context);
 
-                        FlushPendingEdge(intermediate_node);
+                            FlushPendingEdge(intermediate_node);
 
-                        m_start_node = intermediate_node;
+                            m_start_node = intermediate_node;
+                        }
                     }
 
                     // store the pending edge
@@ -345,7 +540,7 @@ namespace djup
                 
                 if (!m_any_edge_added)
                 {
-                    AddCandidate(m_context, m_start_node, m_dest_node,
+                    AddEdgeOrCandidate(m_dest_node,
                         {}, {}, std::move(m_substitutions),
                         0, 0, 1);
                 }
@@ -364,13 +559,36 @@ namespace djup
                     i_close++;
                 }
 
-                AddCandidate(m_context, m_start_node, i_dest_node,
+                AddEdgeOrCandidate(i_dest_node,
                     m_target, m_pattern, std::move(m_substitutions),
                     open, i_close, m_repetitions);
                 m_open = 0;
                 m_any_edge_added = true;
             }
 
+            void AddEdgeOrCandidate(uint32_t i_dest_node,
+                Span<const Tensor> i_target, PatternSegment i_pattern,
+                BindingEnvironment i_substitutions,
+                uint32_t i_open, uint32_t i_close, uint32_t i_repetitions)
+            {
+                if (m_context.m_collect_paths)
+                {
+                    Candidate & edge = m_context.m_paths[m_path_index].emplace_back();
+                    edge.m_target_arguments = i_target;
+                    edge.m_segment = i_pattern;
+                    edge.m_repetitions = i_repetitions;
+                    edge.m_open = i_open;
+                    edge.m_close = i_close;
+                    edge.m_substitutions = std::move(i_substitutions);
+                }
+                else
+                {
+                    AddCandidate(m_context, m_start_node, i_dest_node,
+                        i_target, i_pattern, std::move(i_substitutions),
+                        i_open, i_close, i_repetitions);
+                }
+            }
+
         private:
             MatchingContext & m_context;
             uint32_t m_start_node;
@@ -385,7 +603,288 @@ namespace djup
             bool m_increase_depth{ false };
             bool m_has_edge{ false };
             bool m_any_edge_added{ false };
-            std::vector<Substitution> m_substitutions;
+            BindingEnvironment m_substitutions;
+            size_t m_path_index{};
+        };
+
+        /* Assigns the arguments of a commutative target to the arguments of a pattern. Instead
+           of trying all the permutations, the target arguments are first filtered by the root
+           of every pattern argument (constant value, name and arity, or type), and if a target
+           argument can't be matched by any pattern argument there is no assignment at all.
+           Pattern arguments with cardinality [1, 1] are assigned first, the most constrained
+           first, and only the target arguments left by them are distributed among the variadic
+           arguments. Equal target arguments are interchangeable, so only the first unused one
+           is tried, and equal pattern arguments take their targets in increasing order: this
+           way no assignment is produced twice. The full match of every argument is left to
+           MatchCandidate. */
+        class CommutativeAssigner
+        {
+        public:
+
+            CommutativeAssigner(MatchingContext & i_context,
+                Span<const Tensor> i_pattern_arguments, Span<const Tensor> i_target_arguments)
+                : m_context(i_context), m_targets(i_target_arguments),
+                  m_buffers(i_context.m_commutative_assigner_buffers),
+                  m_groups(m_buffers.m_groups),
+                  m_arguments(m_buffers.m_arguments),
+                  m_fixed_arguments(m_buffers.m_fixed_arguments),
+                  m_variadic_arguments(m_buffers.m_variadic_arguments),
+                  m_used(m_buffers.m_used),
+                  m_owners(m_buffers.m_owners),
+                  m_remaining(m_buffers.m_remaining),
+                  m_counts(m_buffers.m_counts)
+            {
+                // the handler only adds edges, so assigners are never nested
+                DJUP_ASSERT(!m_buffers.m_in_use);
+                m_buffers.m_in_use = true;
+
+                const uint32_t target_count = NumericCast<uint32_t>(m_targets.size());
+                m_used.assign(target_count, false);
+                m_owners.assign(target_count, 0);
+                m_counts.assign(i_pattern_arguments.size(), 0);
+                m_fixed_arguments.clear();
+                m_variadic_arguments.clear();
+
+                // targets are sorted, so equal targets are adjacent
+                m_groups.resize(target_count);
+                for (uint32_t target_index = 0; target_index < target_count; target_index++)
+                {
+                    m_groups[target_index] = target_index > 0 &&
+                        AlwaysEqual(m_targets[target_index], m_targets[target_index - 1]) ?
+                            m_groups[target_index - 1] : target_index;
+                }
+
+                std::vector<bool> & covered = m_buffers.m_covered;
+                covered.assign(target_count, false);
+                uint32_t min_variadic_targets = 0;
+                m_arguments.resize(i_pattern_arguments.size());
+                for (uint32_t argument_index = 0; argument_index < m_arguments.size(); argument_index++)
+                {
+                    Argument & argument = m_arguments[argument_index];
+                    argument.m_candidates.clear();
+                    argument.m_assigned_target = 0;
+                    const Tensor & pattern = i_pattern_arguments[argument_index];
+                    argument.m_pattern = pattern.GetExpression().get();
+                    argument.m_cardinality = GetCardinality(pattern);
+                    argument.m_fixed = argument.m_cardinality == UIntInterval{ 1, 1 };
+
+                    // the pattern that every assigned target must match, if known
+                    const Tensor * element = nullptr;
+                    if (argument.m_fixed)
+                        element = &pattern;
+                    else if (pattern.GetExpression()->GetArguments().size() == 1)
+                        element = &pattern.GetExpression()->GetArguments()[0];
+
+                    argument.m_accepts.resize(target_count);
+                    for (uint32_t target_index = 0; target_index < target_count; target_index++)
+                    {
+                        const bool accepts = element == nullptr || MayMatch(*element, m_targets[target_index]);
+                        argument.m_accepts[target_index] = accepts;
+                        if (accepts)
+                        {
+                            covered[target_index] = true;
+                            if (argument.m_fixed)
+                                argument.m_candidates.push_back(target_index);
+                        }
+                    }
+
+                    if (argument.m_fixed)
+                    {
+                        if (argument.m_candidates.empty())
+                            m_impossible = true;
+                        m_fixed_arguments.push_back(argument_index);
+                    }
+                    else
+                    {
+                        min_variadic_targets += argument.m_cardinality.m_min;
+                        m_variadic_arguments.push_back(argument_index);
+                    }
+                }
+
+                if (std::find(covered.begin(), covered.end(), false) != covered.end() ||
+                    m_fixed_arguments.size() + min_variadic_targets > target_count)
+                {
+                    m_impossible = true;
+                }
+
+                std::sort(m_fixed_arguments.begin(), m_fixed_arguments.end(), [this](uint32_t i_first, uint32_t i_second) {
+                    const Argument & first = m_arguments[i_first];
+                    const Argument & second = m_arguments[i_second];
+                    if (first.m_candidates.size() != second.m_candidates.size())
+                        return first.m_candidates.size() < second.m_candidates.size();
+                    if (first.m_pattern != second.m_pattern)
+                        return std::less<const Expression*>()(first.m_pattern, second.m_pattern);
+                    return i_first < i_second;
+                });
+            }
+
+            CommutativeAssigner(const CommutativeAssigner &) = delete;
+            CommutativeAssigner & operator = (const CommutativeAssigner &) = delete;
+
+            ~CommutativeAssigner()
+            {
+                m_buffers.m_in_use = false;
+            }
+
+            /* The handler receives the target arguments in the order of the pattern arguments, and
+               the number of target arguments assigned to every pattern argument. It is called
+               through a plain function pointer, as a std::function may allocate. */
+            template <typename HANDLER>
+                void ForEachAssignment(HANDLER && i_handler)
+            {
+                if (m_impossible)
+                    return;
+                m_handler_object = &i_handler;
+                m_handler = [](void * i_object, Span<const Tensor> i_arranged_targets, Span<const uint32_t> i_counts) {
+                    (*static_cast<std::remove_reference_t<HANDLER>*>(i_object))(i_arranged_targets, i_counts);
+                };
+                AssignFixed(0);
+            }
+
+        private:
+
+            using Argument = CommutativeAssignerBuffers::Argument;
+
+            /* Returns whether a target may be matched by a pattern. Only the root of the
+               pattern is checked. */
+            bool MayMatch(const Tensor & i_pattern, const Tensor & i_target) const
+            {
+                if (IsConstant(i_pattern))
+                    return AlwaysEqual(i_pattern, i_target);
+                if (IsIdentifier(i_pattern))
+                    return m_context.m_namespace->TypeBelongsTo(
+                        i_target.GetExpression()->GetType(), i_pattern.GetExpression()->GetType());
+                if (GetCardinality(i_pattern) != UIntInterval{ 1, 1 })
+                    return true; // nested repetition
+                if (i_pattern.GetExpression()->GetName() != i_target.GetExpression()->GetName())
+                    return false;
+                const PatternInfoTable::Entry & pattern_info = m_context.m_pattern_infos->GetEntry(i_pattern);
+                const size_t arity = i_target.GetExpression()->GetArguments().size();
+                return arity >= pattern_info.m_arguments_range.m_min &&
+                    arity <= pattern_info.m_arguments_range.m_max;
+            }
+
+            void AssignFixed(size_t i_fixed_index)
+            {
+                if (i_fixed_index == m_fixed_arguments.size())
+                {
+                    m_remaining.clear();
+                    for (uint32_t target_index = 0; target_index < m_targets.size(); target_index++)
+                        if (!m_used[target_index])
+                            m_remaining.push_back(target_index);
+                    for (uint32_t argument_index : m_variadic_arguments)
+                        m_counts[argument_index] = 0;
+                    AssignVariadic(0);
+                    return;
+                }
+
+                const uint32_t argument_index = m_fixed_arguments[i_fixed_index];
+                Argument & argument = m_arguments[argument_index];
+                const Argument * previous = i_fixed_index > 0 ? &m_arguments[m_fixed_arguments[i_fixed_index - 1]] : nullptr;
+                const bool same_as_previous = previous != nullptr && previous->m_pattern == argument.m_pattern;
+
+                uint32_t last_group = std::numeric_limits<uint32_t>::max();
+                for (uint32_t target_index : argument.m_candidates)
+                {
+                    if (m_used[target_index] || m_groups[target_index] == last_group)
+                        continue;
+                    if (same_as_previous && target_index < previous->m_assigned_target)
+                        continue;
+                    last_group = m_groups[target_index];
+
+                    m_used[target_index] = true;
+                    m_owners[target_index] = argument_index;
+                    argument.m_assigned_target = target_index;
+                    AssignFixed(i_fixed_index + 1);
+                    m_used[target_index] = false;
+                }
+            }
+
+            void AssignVariadic(size_t i_remaining_index)
+            {
+                if (i_remaining_index == m_remaining.size())
+                {
+                    for (uint32_t argument_index : m_variadic_arguments)
+                        if (!m_arguments[argument_index].m_cardinality.IsValaueWithin(m_counts[argument_index]))
+                            return;
+                    Emit();
+                    return;
+                }
+
+                // targets still needed to reach the minimum cardinality
+                uint32_t missing = 0;
+                for (uint32_t argument_index : m_variadic_arguments)
+                {
+                    const uint32_t min = m_arguments[argument_index].m_cardinality.m_min;
+                    if (m_counts[argument_index] < min)
+                        missing += min - m_counts[argument_index];
+                }
+                if (missing > m_remaining.size() - i_remaining_index)
+                    return;
+
+                const uint32_t target_index = m_remaining[i_remaining_index];
+
+                // equal targets are assigned in non-decreasing order of argument
+                uint32_t first_owner = 0;
+                if (i_remaining_index > 0)
+                {
+                    const uint32_t previous_target = m_remaining[i_remaining_index - 1];
+                    if (m_groups[previous_target] == m_groups[target_index])
+                        first_owner = m_owners[previous_target];
+                }
+
+                for (uint32_t argument_index : m_variadic_arguments)
+                {
+                    const Argument & argument = m_arguments[argument_index];
+                    if (argument_index < first_owner || !argument.m_accepts[target_index] ||
+                            m_counts[argument_index] >= argument.m_cardinality.m_max)
+                        continue;
+
+                    m_owners[target_index] = argument_index;
+                    m_counts[argument_index]++;
+                    AssignVariadic(i_remaining_index + 1);
+                    m_counts[argument_index]--;
+                }
+            }
+
+            void Emit()
+            {
+                std::vector<Tensor> & arranged = NewArrangedTargets(m_context);
+                arranged.reserve(m_targets.size());
+                for (uint32_t argument_index = 0; argument_index < m_arguments.size(); argument_index++)
+                {
+                    if (m_arguments[argument_index].m_fixed)
+                    {
+                        arranged.push_back(m_targets[m_arguments[argument_index].m_assigned_target]);
+                        m_counts[argument_index] = 1;
+                    }
+                    else
+                    {
+                        for (uint32_t target_index = 0; target_index < m_targets.size(); target_index++)
+                            if (!m_used[target_index] && m_owners[target_index] == argument_index)
+                                arranged.push_back(m_targets[target_index]);
+                    }
+                }
+                DJUP_ASSERT(arranged.size() == m_targets.size());
+
+                m_handler(m_handler_object, arranged, m_counts);
+            }
+
+        private:
+            MatchingContext & m_context;
+            Span<const Tensor> m_targets;
+            CommutativeAssignerBuffers & m_buffers;
+            std::vector<uint32_t> & m_groups; // index of the first equal target
+            std::vector<Argument> & m_arguments;
+            std::vector<uint32_t> & m_fixed_arguments; // indices of arguments, the most constrained first
+            std::vector<uint32_t> & m_variadic_arguments;
+            std::vector<bool> & m_used; // targets assigned to fixed arguments
+            std::vector<uint32_t> & m_owners; // the argument every target is assigned to
+            std::vector<uint32_t> & m_remaining;
+            std::vector<uint32_t> & m_counts;
+            bool m_impossible{ false };
+            void * m_handler_object{};
+            void (*m_handler)(void * i_object, Span<const Tensor> i_arranged_targets, Span<const uint32_t> i_counts){};
         };
 
         /** Returns false if the matching has failed */
@@ -425,7 +924,7 @@ namespace djup
                         usable.m_min -= usable.m_min % sub_pattern_count;
                         usable.m_max -= usable.m_max % sub_pattern_count;
 
-                        const PatternInfo & pattern_info = GetPatternInfo(i_context, pattern);
+                        const PatternInfoTable::Entry & pattern_info = i_context.m_pattern_infos->GetEntry(pattern);
 
                         uint32_t rep = NumericCast<uint32_t>(usable.m_min / sub_pattern_count);
                         for (uint32_t used = usable.m_min; used <= usable.m_max; used += sub_pattern_count, rep++)
@@ -436,7 +935,7 @@ namespace djup
                             PatternSegment pre_segment;
                             pre_segment.m_flags = pattern_info.m_flags;
                             pre_segment.m_pattern = pattern.GetExpression()->GetArguments();
-                            pre_segment.m_arg_infos = pattern_info.m_arguments_info;
+                            pre_segment.m_arg_infos = i_context.m_pattern_infos->GetArgumentsInfo(pattern_info);
                             path.AddEdge(
                                 i_candidate.m_target_arguments.subspan(target_index, used),
                                 pre_segment, std::move(i_candidate.m_substitutions), 
@@ -470,42 +969,77 @@ namespace djup
                             pattern.GetExpression()->GetType()))
                             return false;
 
-                        i_candidate.m_substitutions.push_back({ 
-                            pattern.GetExpression()->GetName(), target });
+                        i_candidate.m_substitutions = i_candidate.m_substitutions.Bind(
+                            pattern.GetExpression()->GetName(), target);
                     }
                     else
                     {
                         if (pattern.GetExpression()->GetName() != target.GetExpression()->GetName())
                             return false;
 
-                        // build pattern info
-                        const PatternInfo & pattern_info = GetPatternInfo(i_context, pattern);
+                        const PatternInfoTable::Entry & pattern_info = i_context.m_pattern_infos->GetEntry(pattern);
 
                         // if the target does not have enough arguments, early reject
                         size_t target_arguments = target.GetExpression()->GetArguments().size();
                         if (target_arguments >= pattern_info.m_arguments_range.m_min &&
                             target_arguments <= pattern_info.m_arguments_range.m_max)
                         {
-                            LinearPath path(i_context, i_candidate);
+                            auto AddRest = [&](LinearPath & io_path) {
+
+                                // rest of this repetition
+                                const size_t remaining_in_pattern = i_candidate.m_segment.m_pattern.size() - (pattern_index + 1);
+                                io_path.AddEdge(i_candidate.m_target_arguments.subspan(target_index + 1, remaining_in_pattern),
+                                    PatternSegment{ pattern_info.m_flags,
+                                        i_candidate.m_segment.m_pattern.subspan(pattern_index + 1),
+                                        i_candidate.m_segment.m_arg_infos.subspan(pattern_index + 1) }, {});
+
+                                // remaining repetitions
+                                const size_t target_start = target_index + 1 + remaining_in_pattern;
+                                io_path.AddEdge(i_candidate.m_target_arguments.subspan(target_start),
+                                    i_candidate.m_segment, {}, false, repetitions - (repetition + 1));
+                            };
+
+                            const Span<const Tensor> pattern_arguments = pattern.GetExpression()->GetArguments();
+
+                            if (HasFlag(pattern_info.m_flags, FunctionFlags::Commutative))
+                            {
+                                // a path for every assignment, matching every argument by itself
+                                const Span<const ArgumentInfo> arguments_info =
+                                    i_context.m_pattern_infos->GetIsolatedArgumentsInfo(pattern_info);
+                                CommutativeAssigner assigner(i_context, pattern_arguments, target.GetExpression()->GetArguments());
+                                assigner.ForEachAssignment([&](Span<const Tensor> i_arranged_targets, Span<const uint32_t> i_counts) {
+                                    LinearPath path(i_context, i_candidate);
+
+                                    // the bindings are shared by all the assignments, only a pointer is copied
+                                    BindingEnvironment substitutions = i_candidate.m_substitutions;
+                                    size_t first_target = 0;
+                                    for (size_t argument_index = 0; argument_index < pattern_arguments.size(); argument_index++)
+                                    {
+                                        path.AddEdge(i_arranged_targets.subspan(first_target, i_counts[argument_index]),
+                                            PatternSegment{ pattern_info.m_flags,
+                                                pattern_arguments.subspan(argument_index, 1),
+                                                arguments_info.subspan(argument_index, 1) },
+                                            std::move(substitutions));
+                                        substitutions = {};
+                                        first_target += i_counts[argument_index];
+                                    }
+
+                                    AddRest(path);
+                                });
+                            }
+                            else
+                            {
+                                LinearPath path(i_context, i_candidate);
+
+                                // match content
+                                path.AddEdge(target.GetExpression()->GetArguments(),
+                                    PatternSegment{ pattern_info.m_flags,
+                                        pattern_arguments,
+                                        i_context.m_pattern_infos->GetArgumentsInfo(pattern_info) },
+                                        std::move(i_candidate.m_substitutions));
 
-                            // match content
-                            path.AddEdge(target.GetExpression()->GetArguments(),
-                                PatternSegment{ pattern_info.m_flags,
-                                    pattern.GetExpression()->GetArguments(),
-                                    pattern_info.m_arguments_info },
-                                    std::move(i_candidate.m_substitutions));
-
-                            // rest of this repetition
-                            const size_t remaining_in_pattern = i_candidate.m_segment.m_pattern.size() - (pattern_index + 1);
-                            path.AddEdge(i_candidate.m_target_arguments.subspan(target_index + 1, remaining_in_pattern),
-                                PatternSegment{ pattern_info.m_flags,
-                                    i_candidate.m_segment.m_pattern.subspan(pattern_index + 1),
-                                    i_candidate.m_segment.m_arg_infos.subspan(pattern_index + 1) }, {});
-
-                            // remaining repetitions
-                            const size_t target_start = target_index + 1 + remaining_in_pattern;
-                            path.AddEdge(i_candidate.m_target_arguments.subspan(target_start),
-                                i_candidate.m_segment, {}, false, repetitions - (repetition + 1));
+                                AddRest(path);
+                            }
                         }
                         return false;
                     }
@@ -517,7 +1051,8 @@ namespace djup
 
         void RemoveNode(MatchingContext & i_context, uint32_t i_node_index)
         {
-            std::vector<uint32_t> nodes_to_remove;
+            std::vector<uint32_t> & nodes_to_remove = i_context.m_nodes_to_remove;
+            DJUP_ASSERT(nodes_to_remove.empty());
             nodes_to_remove.push_back(i_node_index);
 
             while (!nodes_to_remove.empty())
@@ -525,29 +1060,33 @@ namespace djup
                 const uint32_t node = nodes_to_remove.back();
                 nodes_to_remove.pop_back();
 
+                if (i_context.m_trace != nullptr)
+                    Trace(i_context, TraceEvent::RemoveNode, { node });
+
                 // for all nodes outgoing from this node...
-                const auto range = i_context.m_edges.equal_range(node);
-                for (auto it = range.first; it != range.second;)
+                std::vector<Edge> & outgoing_edges = i_context.m_graph_nodes[node].m_outgoing_edges;
+                for (Edge & edge : outgoing_edges)
                 {
-                    // we are going to delete the edge from this node to it->dest
-                    const uint32_t dest_node = it->second.m_dest_index;
+                    if (edge.m_removed)
+                        continue;
+
+                    // we are going to delete the edge from this node to edge.m_dest_index
+                    const uint32_t dest_node = edge.m_dest_index;
 
                     // if the edge has an associated candidate, delete it
-                    if (i_context.m_candidates.IsValid(it->second.m_candidate_ref))
+                    if (i_context.m_candidates.IsValid(edge.m_candidate_ref))
                     {
-                        Candidate & candidate = i_context.m_candidates.GetObject(it->second.m_candidate_ref);
-                        if (candidate.m_start_node == it->first && 
-                            candidate.m_dest_node == it->second.m_dest_index)
+                        Candidate & candidate = i_context.m_candidates.GetObject(edge.m_candidate_ref);
+                        if (candidate.m_start_node == node && 
+                            candidate.m_dest_node == edge.m_dest_index)
                         {
-                            i_context.m_candidates.Delete(it->second.m_candidate_ref);
+                            i_context.m_candidates.Delete(edge.m_candidate_ref);
                         }
                     }
 
                     // decrement the incoming edge on the dest
-                    DJUP_ASSERT(i_context.m_graph_nodes[it->second.m_dest_index].m_incoming_edges > 0);
-                    i_context.m_graph_nodes[it->second.m_dest_index].m_incoming_edges--;
-                    
-                    it = i_context.m_edges.erase(it);
+                    DJUP_ASSERT(i_context.m_graph_nodes[dest_node].m_incoming_edges > 0);
+                    i_context.m_graph_nodes[dest_node].m_incoming_edges--;
 
                     // if this was the last incoming edge to the dest node, delete it
                     if (i_context.m_graph_nodes[dest_node].m_incoming_edges == 0)
@@ -555,28 +1094,33 @@ namespace djup
                         nodes_to_remove.push_back(dest_node);
                     }
                 }
+
+                // all the outgoing edges are removed, so no index is needed anymore
+                outgoing_edges.clear();
             }
         }
 
+        Edge & GetCandidateEdge(MatchingContext & i_context,
+            const Candidate & i_candidate, [[maybe_unused]] Pool<Candidate>::Handle i_candidate_ref)
+        {
+            Edge & edge = i_context.m_graph_nodes[i_candidate.m_start_node].m_outgoing_edges[i_candidate.m_edge_index];
+            DJUP_ASSERT(!edge.m_removed &&
+                edge.m_dest_index == i_candidate.m_dest_node &&
+                edge.m_candidate_ref == i_candidate_ref);
+            return edge;
+        }
+
         void RemoveEdge(MatchingContext & i_context,
-            uint32_t i_start_node, uint32_t i_dest_node,
-            Pool<Candidate>::Handle i_candidate_ref)
+            const Candidate & i_candidate, Pool<Candidate>::Handle i_candidate_ref)
         {
-            bool found = false;
-            const auto range = i_context.m_edges.equal_range(i_start_node);
-            for (auto it = range.first; it != range.second; it++)
-            {
-                if (it->second.m_dest_index == i_dest_node &&
-                    it->second.m_candidate_ref == i_candidate_ref)
-                {
-                    DJUP_ASSERT(i_context.m_graph_nodes[i_dest_node].m_incoming_edges > 0);
-                    i_context.m_graph_nodes[i_dest_node].m_incoming_edges--;
-                    i_context.m_edges.erase(it);
-                    found = true;
-                    break;
-                }
-            }
-            DJUP_ASSERT(found);
+            const uint32_t i_dest_node = i_candidate.m_dest_node;
+
+            if (i_context.m_trace != nullptr)
+                Trace(i_context, TraceEvent::RemoveEdge, { i_candidate.m_start_node, i_candidate.m_edge_index });
+
+            GetCandidateEdge(i_context, i_candidate, i_candidate_ref).m_removed = true;
+            DJUP_ASSERT(i_context.m_graph_nodes[i_dest_node].m_incoming_edges > 0);
+            i_context.m_graph_nodes[i_dest_node].m_incoming_edges--;
 
             if (i_context.m_graph_nodes[i_dest_node].m_incoming_edges == 0)
             {
@@ -585,18 +1129,19 @@ namespace djup
             }
         }
                 
+        // i_pattern must be already preprocessed
         void MakeSubstitutionsGraph(MatchingContext & i_context, 
             const Tensor & i_target, const Tensor & i_pattern)
         {
-            Tensor pattern = PreprocessPattern(*i_context.m_namespace, i_pattern);
+            const Tensor & pattern = i_pattern;
             const Tensor & target = i_target;
 
             UIntInterval single_range = {1, 1};
             UIntInterval single_remaining = {0, 0};
 
             static_assert(g_start_node_index == 0 && g_end_node_index == 1);
-            i_context.m_graph_nodes.emplace_back(); // start node
-            i_context.m_graph_nodes.emplace_back(); // final node
+            NewGraphNode(i_context); // start node
+            NewGraphNode(i_context); // final node
 
             PatternSegment segment;
             segment.m_flags = FunctionFlags::None;
@@ -605,13 +1150,10 @@ namespace djup
             segment.m_arg_infos = {&arg_info, 1};
             AddCandidate(i_context, g_start_node_index, g_end_node_index, { &target, 1 }, segment, {}, {}, {});
 
-            if (i_context.m_artifact_path != nullptr)
-            {
-                GraphWizGraph graph = MakeSolutionGraphWiz(i_context, "Initial");
-                graph.SaveAsImage(std::filesystem::path(i_context.m_artifact_path) / "Initial.png");
-            }
+            if (i_context.m_trace != nullptr)
+                Trace(i_context, TraceEvent::Step, { 0 });
 
-            int dbg_step = 0;
+            uint32_t step = 0;
             do {
                 Pool<Candidate>::Handle candidate_handle = std::move(i_context.m_candidate_queue.back());
                 i_context.m_candidate_queue.pop_back();
@@ -620,127 +1162,328 @@ namespace djup
                     Candidate candidate = i_context.m_candidates.GetObject(candidate_handle);
                     i_context.m_candidates.Delete(candidate_handle);
 
-                    dbg_step++;
-                    
+                    step++;
+
                     const bool match = MatchCandidate(i_context, candidate);
 
                     if(!match)
                     {
-                        RemoveEdge(i_context, 
-                            candidate.m_start_node, candidate.m_dest_node,
-                            candidate_handle);
+                        RemoveEdge(i_context, candidate, candidate_handle);
                     }
                     else
                     {
-                        // find the edge and sets the substitutions
-                        bool found = false;
-                        const auto range = i_context.m_edges.equal_range(candidate.m_start_node);
-                        for(auto it = range.first; it != range.second; it++)
-                        {
-                            // the candidate has just been removed from the stack
-                            // DJUP_ASSERT(IsCandidateRefValid(i_context, it->second.m_candidate_ref));
+                        // sets the substitutions of the edge
+                        Edge & edge = GetCandidateEdge(i_context, candidate, candidate_handle);
+                        edge.m_candidate_ref = {};
+                        DJUP_ASSERT(edge.m_substitutions.IsEmpty());
+                        edge.m_substitutions = std::move(candidate.m_substitutions);
 
-                            if(it->second.m_dest_index == candidate.m_dest_node &&
-                                it->second.m_candidate_ref == candidate_handle)
-                            {
-                                it->second.m_candidate_ref = {};
-
-                                DJUP_ASSERT(it->second.m_substitutions.empty());
-                                it->second.m_substitutions = std::move(candidate.m_substitutions);
-                                found = true;
-                                break;
-                            }
+                        if (i_context.m_trace != nullptr)
+                        {
+                            Trace(i_context, TraceEvent::MatchEdge, { candidate.m_start_node, candidate.m_edge_index });
+                            edge.m_substitutions.ForEach([&](const Name & i_identifier_name, const Tensor & i_value) {
+                                Trace(i_context, TraceEvent::Substitution, { candidate.m_start_node, candidate.m_edge_index,
+                                    i_context.m_trace->AddString(i_identifier_name),
+                                    i_context.m_trace->AddString(i_value) });
+                                return true;
+                            });
                         }
-                        DJUP_ASSERT(found);
                     }
 
-                    if (i_context.m_artifact_path != nullptr)
-                    {
-                        std::string title = ToString("Step_", dbg_step);
-                        GraphWizGraph graph = MakeSolutionGraphWiz(i_context, title);
-                        graph.SaveAsImage(std::filesystem::path(i_context.m_artifact_path) / (title + ".png"));
-                    }
+                    if (i_context.m_trace != nullptr)
+                        Trace(i_context, TraceEvent::Step, { step });
                 }
 
             } while(!i_context.m_candidate_queue.empty());
-        }
 
-        struct SolutionBuilder
-        {
-            uint32_t m_curr_node;
-            SubstitutionsBuilder m_builder;
-        };
+            // images are rendered offline from the trace, see ReplayMatchTrace
+            if (i_context.m_trace != nullptr)
+                i_context.m_trace->Save(std::filesystem::path(i_context.m_artifact_path) / "match.djuptrace");
+        }
 
-        std::vector<MatchResult> GetAllSolutions(const MatchingContext & i_context)
+        /* The builders of a step are advanced along every outgoing edge of their node, and the
+           results are the builders of the next step. The builders of the two steps are kept in
+           the context and only assigned, so after the first matches their containers don't need
+           to grow anymore. The context resets them when it is cleared. */
+        std::vector<MatchResult> GetAllSolutions(MatchingContext & i_context)
         {
-            std::vector<SolutionBuilder> builders;
+            std::vector<SolutionBuilder> & builders = i_context.m_solution_builders;
+            std::vector<SolutionBuilder> & next_builders = i_context.m_next_solution_builders;
             std::vector<MatchResult> solutions;
 
-            builders.emplace_back().m_curr_node = g_start_node_index;
+            if (builders.empty())
+                builders.emplace_back();
+            builders[0].m_curr_node = g_start_node_index;
+            i_context.m_used_solution_builders = std::max<size_t>(i_context.m_used_solution_builders, 1);
+            size_t builder_count = 1;
 
             do {
-                for (auto bld_it = builders.begin(); bld_it != builders.end(); )
+                size_t next_builder_count = 0;
+                for (size_t builder_index = 0; builder_index < builder_count; builder_index++)
                 {
-                    SolutionBuilder copy;
-                    uint32_t outgoing_edges = 0;
-
-                    // for all edges starting from bld_it->m_curr_node
-                    const auto equal_range = i_context.m_edges.equal_range(bld_it->m_curr_node);
-                    for (auto edge_it = equal_range.first; edge_it != equal_range.second;
-                        ++edge_it, ++outgoing_edges)
+                    // for all edges starting from the node of the builder
+                    for (const Edge & edge : i_context.m_graph_nodes[builders[builder_index].m_curr_node].m_outgoing_edges)
                     {
-                        /* if this is the first edge, save a copy of it and remove it. For each edge
-                           we use it as starting point and add the encountered substitutions */
+                        if (edge.m_removed)
+                            continue;
 
-                        if (outgoing_edges == 0)
-                        {
-                            copy = *bld_it;
-                            bld_it = builders.erase(bld_it);
-                        }
+                        // each edge is followed by a copy of the builder, that adds the substitutions of the edge
+                        if (next_builder_count == next_builders.size())
+                            next_builders.emplace_back();
+                        SolutionBuilder & next = next_builders[next_builder_count];
+                        next = builders[builder_index];
+                        i_context.m_used_solution_builders = std::max(
+                            i_context.m_used_solution_builders, next_builder_count + 1);
+
+                        if (edge.m_open)
+                            next.m_builder.Open(edge.m_open);
 
-                        bld_it = builders.insert(bld_it, copy);
+                        bool compatible = next.m_builder.Add(edge.m_substitutions);
 
-                        if (edge_it->second.m_open)
-                            bld_it->m_builder.Open(edge_it->second.m_open);
-                        
-                        bool compatible = bld_it->m_builder.Add(edge_it->second.m_substitutions);
-                        bld_it->m_curr_node = edge_it->second.m_dest_index;
+                        if (edge.m_close)
+                            compatible = compatible && next.m_builder.Close(edge.m_close);
+                        next.m_curr_node = edge.m_dest_index;
 
-                        if (edge_it->second.m_close)
-                            compatible = compatible && bld_it->m_builder.Close(edge_it->second.m_close);
-                        bld_it->m_curr_node = edge_it->second.m_dest_index;
-                        
                         if (!compatible)
-                        {
-                            bld_it = builders.erase(bld_it);
-                        }
-                        else if (bld_it->m_curr_node == g_end_node_index)
+                            continue; // the slot is reused by the next edge
+
+                        if (next.m_curr_node == g_end_node_index)
                         {
                             // complete non-contradictory solution, save it
-                            solutions.emplace_back().m_substitutions = 
-                                bld_it->m_builder.StealSubstitutions();
-
-                            bld_it = builders.erase(bld_it);
+                            solutions.emplace_back().m_substitutions =
+                                next.m_builder.GetSubstitutions(i_context.m_materialize_scratch);
                         }
                         else
                         {
-                            ++bld_it;
+                            next_builder_count++;
                         }
                     }
-
-                    if (outgoing_edges == 0)
-                        bld_it = builders.erase(bld_it);
                 }
 
-            } while (!builders.empty());
+                std::swap(builders, next_builders);
+                builder_count = next_builder_count;
+
+            } while (builder_count != 0);
             return solutions;
         }
 
+        /* The edges still to be matched in a path of the substitution graph are kept in a stack,
+           in reverse order, with the substitutions of the edges already matched. Search states
+           don't depend on the context that created them, so they can be moved between threads. */
+        void SetRootSearchState(SearchState & o_state, const Tensor & i_target, const Tensor & i_pattern,
+            const ArgumentInfo & i_root_info)
+        {
+            o_state.m_pending_edges.clear();
+            o_state.m_builder.Clear();
+            Candidate & root = o_state.m_pending_edges.emplace_back();
+            root.m_target_arguments = { &i_target, 1 };
+            root.m_segment = PatternSegment(FunctionFlags::None, { &i_pattern, 1 }, { &i_root_info, 1 });
+            root.m_repetitions = 1;
+        }
+
+        SearchState MakeRootSearchState(const Tensor & i_target, const Tensor & i_pattern,
+            const ArgumentInfo & i_root_info)
+        {
+            SearchState state;
+            SetRootSearchState(state, i_target, i_pattern, i_root_info);
+            return state;
+        }
+
+        // pushes the edges of a path on the pending edges of a search state, in reverse order
+        void AppendPath(std::vector<Candidate> & io_pending_edges, std::vector<Candidate> & i_path)
+        {
+            for (auto it = i_path.rbegin(); it != i_path.rend(); ++it)
+                io_pending_edges.push_back(std::move(*it));
+        }
+
+        /* Follows the path of a search state until it is complete, it fails or it branches. When
+           an edge is split by MatchCandidate, it is replaced by the edges of the first path, while
+           the other paths are passed to i_push_alternative, from the last one, together with the
+           state they branch from. Substitutions are added to the builder in path order, like in
+           GetAllSolutions. Returns true if the path is complete. The context must be collecting paths. */
+        template <typename PUSH_ALTERNATIVE>
+            bool AdvanceSearchState(MatchingContext & i_context, SearchState & io_state,
+                PUSH_ALTERNATIVE && i_push_alternative)
+        {
+            DJUP_ASSERT(i_context.m_collect_paths);
+            std::vector<std::vector<Candidate>> & paths = i_context.m_paths;
+
+            for (;;)
+            {
+                if (io_state.m_pending_edges.empty())
+                    return true;
+
+                Candidate edge = std::move(io_state.m_pending_edges.back());
+                io_state.m_pending_edges.pop_back();
+
+                i_context.ClearPaths();
+                if (MatchCandidate(i_context, edge))
+                {
+                    if (edge.m_open)
+                        io_state.m_builder.Open(edge.m_open);
+                    bool compatible = io_state.m_builder.Add(edge.m_substitutions);
+                    if (edge.m_close)
+                        compatible = compatible && io_state.m_builder.Close(edge.m_close);
+                    if (!compatible)
+                        return false;
+                }
+                else
+                {
+                    const size_t path_count = i_context.m_path_count;
+                    if (path_count == 0)
+                        return false;
+
+                    for (size_t path_index = path_count - 1; path_index > 0; path_index--)
+                        i_push_alternative(static_cast<const SearchState &>(io_state), paths[path_index]);
+                    AppendPath(io_state.m_pending_edges, paths[0]);
+                }
+            }
+        }
+
+        /* Depth-first search of the first solution, used instead of building the whole
+           substitution graph. The alternative paths are tried only if the current path
+           fails. i_pattern must be already preprocessed. */
+        std::optional<MatchResult> FindFirstSolution(MatchingContext & i_context,
+            const Tensor & i_target, const Tensor & i_pattern, const Tensor & i_when)
+        {
+            const ArgumentInfo root_info{ {1, 1}, {0, 0} };
+
+            SetRootSearchState(i_context.PushSearchState(), i_target, i_pattern, root_info);
+
+            i_context.m_collect_paths = true;
+
+            SearchState & state = i_context.m_search_state;
+            while (i_context.m_search_depth != 0)
+            {
+                i_context.PopSearchState();
+
+                const bool complete = AdvanceSearchState(i_context, state,
+                    [&i_context](const SearchState & i_state, std::vector<Candidate> & i_path) {
+                        SearchState & alternative = i_context.PushSearchState();
+                        alternative = i_state;
+                        AppendPath(alternative.m_pending_edges, i_path);
+                    });
+
+                if (complete)
+                {
+                    std::vector<Substitution> substitutions = state.m_builder.GetSubstitutions(i_context.m_materialize_scratch);
+                    if (IsEmpty(i_when) || Always(ApplySubstitutions(*i_context.m_namespace, i_when, substitutions)))
+                        return MatchResult{ std::move(substitutions) };
+                }
+            }
+
+            return {};
+        }
+
+        /* State shared by the tasks of a parallel match. Every task explores the paths of a
+           search state depth-first, like FindFirstSolution, but it doesn't stop at the first
+           solution. When a path branches, the alternatives are submitted as new tasks as long as
+           the pool has few queued tasks, otherwise they are explored by the same task. */
+        struct ParallelMatch
+        {
+            ThreadPool & m_thread_pool;
+            const Namespace & m_namespace;
+            const PatternInfoTable & m_pattern_infos;
+            const Tensor & m_when;
+            size_t m_max_queued_tasks{};
+
+            SharedArrangedTargets m_arranged_targets{};
+            std::atomic<size_t> m_pending_tasks{ 0 };
+            std::atomic<bool> m_cancelled{ false };
+
+            std::mutex m_mutex{}; // guards m_solutions and m_exception
+            std::vector<MatchResult> m_solutions{};
+            std::exception_ptr m_exception{};
+        };
+
+        void SubmitSearchTask(ParallelMatch & i_match, SearchState i_state);
+
+        void RunSearchTask(ParallelMatch & i_match, SearchState i_state)
+        {
+            try
+            {
+                ScopedMatchingContext context(i_match.m_namespace, i_match.m_pattern_infos, nullptr);
+                context.Get().m_collect_paths = true;
+                context.Get().m_shared_arranged_targets = &i_match.m_arranged_targets;
+
+                MatchingContext & match_context = context.Get();
+                match_context.PushSearchState() = std::move(i_state);
+
+                auto PushAlternative = [&](const SearchState & i_state, std::vector<Candidate> & i_path) {
+                    if (i_match.m_thread_pool.GetQueuedTaskCount() < i_match.m_max_queued_tasks)
+                    {
+                        SearchState alternative = i_state;
+                        AppendPath(alternative.m_pending_edges, i_path);
+                        SubmitSearchTask(i_match, std::move(alternative));
+                    }
+                    else
+                    {
+                        SearchState & alternative = match_context.PushSearchState();
+                        alternative = i_state;
+                        AppendPath(alternative.m_pending_edges, i_path);
+                    }
+                };
+
+                SearchState & state = match_context.m_search_state;
+                while (match_context.m_search_depth != 0 && !i_match.m_cancelled.load(std::memory_order_relaxed))
+                {
+                    match_context.PopSearchState();
+
+                    if (AdvanceSearchState(match_context, state, PushAlternative))
+                    {
+                        std::vector<Substitution> substitutions = state.m_builder.GetSubstitutions(
+                            match_context.m_materialize_scratch);
+                        if (IsEmpty(i_match.m_when) ||
+                            Always(ApplySubstitutions(i_match.m_namespace, i_match.m_when, substitutions)))
+                        {
+                            std::lock_guard<std::mutex> lock(i_match.m_mutex);
+                            i_match.m_solutions.push_back(MatchResult{ std::move(substitutions) });
+                        }
+                    }
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(i_match.m_mutex);
+                if (!i_match.m_exception)
+                    i_match.m_exception = std::current_exception();
+                i_match.m_cancelled = true;
+            }
+
+            i_match.m_pending_tasks.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        void SubmitSearchTask(ParallelMatch & i_match, SearchState i_state)
+        {
+            i_match.m_pending_tasks.fetch_add(1, std::memory_order_relaxed);
+            i_match.m_thread_pool.Submit([&i_match, state = std::move(i_state)]() mutable {
+                RunSearchTask(i_match, std::move(state));
+            });
+        }
+
+        void RemoveRejectedByWhen(const Namespace & i_namespace, const Tensor & i_when,
+            std::vector<MatchResult> & io_solutions)
+        {
+            if (IsEmpty(i_when))
+                return;
+
+            for (auto it = io_solutions.begin(); it != io_solutions.end(); )
+            {
+                const Tensor when_result = ApplySubstitutions(i_namespace, i_when, it->m_substitutions);
+                if (Always(when_result))
+                    ++it;
+                else
+                    it = io_solutions.erase(it);
+            }
+        }
+
         Pattern::Pattern(const Namespace & i_namespace,
             const Tensor & i_pattern)
             : m_namespace(i_namespace)
         {
             m_pattern = PreprocessPattern(i_namespace, i_pattern);
+            m_pattern_infos = PatternInfoTable(m_pattern);
+            InitRootInfo();
         }
 
         Pattern::Pattern(const Namespace & i_namespace,
@@ -749,49 +1492,190 @@ namespace djup
         {
             m_pattern = PreprocessPattern(i_namespace, i_pattern);
             m_when = PreprocessPattern(i_namespace, i_when);
+            m_pattern_infos = PatternInfoTable(m_pattern);
+            InitRootInfo();
+        }
+
+        void Pattern::InitRootInfo()
+        {
+            // the root of a target is matched like in MatchCandidate
+            const Expression & root = *m_pattern.GetExpression();
+            const ExpressionKind kind = GetExpressionKind(root);
+            if (kind == ExpressionKind::Constant)
+            {
+                const uint32_t argument_count = NumericCast<uint32_t>(root.GetArguments().size());
+                m_root_matches_any_name = false;
+                m_root_name = root.GetName();
+                m_root_arity = { argument_count, argument_count };
+            }
+            else if (kind == ExpressionKind::VariableFunction)
+            {
+                m_root_matches_any_name = false;
+                m_root_name = root.GetName();
+                m_root_arity = m_pattern_infos.GetEntry(m_pattern).m_arguments_range;
+            }
+            else
+            {
+                m_root_matches_any_name = true;
+                m_root_arity = { 0, UIntInterval::s_infinite };
+            }
         }
 
         std::vector<MatchResult> Pattern::MatchAll(const Tensor & i_target,
             const char * i_artifact_path) const
         {
-            MatchingContext context;
-            context.m_namespace = &m_namespace;
-            context.m_artifact_path = i_artifact_path;
-            MakeSubstitutionsGraph(context, i_target, m_pattern);
+            std::vector<MatchResult> solutions;
+            {
+                ScopedMatchingContext context(m_namespace, m_pattern_infos, i_artifact_path);
+                MakeSubstitutionsGraph(context.Get(), i_target, m_pattern);
+                solutions = GetAllSolutions(context.Get());
+            }
+
+            RemoveRejectedByWhen(m_namespace, m_when, solutions);
+
+            return { solutions };
+        }
+
+        std::vector<MatchResult> Pattern::MatchAll(const Tensor & i_target,
+            ThreadPool & i_thread_pool) const
+        {
+            ParallelMatch match{ i_thread_pool, m_namespace, m_pattern_infos, m_when,
+                i_thread_pool.GetThreadCount() * 4 };
+
+            const ArgumentInfo root_info{ {1, 1}, {0, 0} };
+            SubmitSearchTask(match, MakeRootSearchState(i_target, m_pattern, root_info));
+
+            // the calling thread runs tasks too, so this works even if it is a worker of the pool
+            i_thread_pool.RunUntil([&match] {
+                return match.m_pending_tasks.load(std::memory_order_acquire) == 0; });
+
+            if (match.m_exception)
+                std::rethrow_exception(match.m_exception);
 
-            std::vector<MatchResult> solutions = GetAllSolutions(context);
+            return std::move(match.m_solutions);
+        }
 
-            if (!IsEmpty(m_when))
+        std::optional<MatchResult> Pattern::MatchOne(const Tensor & i_target,
+            const char * i_artifact_path) const
+        {
+            // artifacts are images of the substitution graph, which is built only by MatchAll
+            if (i_artifact_path != nullptr)
             {
-                for (auto it = solutions.begin(); it != solutions.end(); )
+                std::vector<MatchResult> solutions = MatchAll(i_target, i_artifact_path);
+                if (solutions.empty())
+                    return {};
+                else
+                    return solutions[0];
+            }
+
+            ScopedMatchingContext context(m_namespace, m_pattern_infos, nullptr);
+            return FindFirstSolution(context.Get(), i_target, m_pattern, m_when);
+        }
+
+        bool Pattern::RootMayMatch(const Tensor & i_target) const
+        {
+            if (m_root_matches_any_name)
+                return true;
+            const Expression & target = *i_target.GetExpression();
+            return target.GetName() == m_root_name &&
+                m_root_arity.IsValaueWithin(NumericCast<uint32_t>(target.GetArguments().size()));
+        }
+
+        BatchMatchResult Pattern::MatchBatch(Span<const Tensor> i_targets,
+            SolutionType i_solution_type, ThreadPool * i_thread_pool) const
+        {
+            auto AddSolution = [](BatchMatchResult & o_result, size_t i_target_index,
+                    std::vector<Substitution> & i_substitutions) {
+                o_result.m_target_indices.push_back(NumericCast<uint32_t>(i_target_index));
+                for (Substitution & substitution : i_substitutions)
+                    o_result.m_substitutions.push_back(std::move(substitution));
+                o_result.m_substitution_offsets.push_back(NumericCast<uint32_t>(o_result.m_substitutions.size()));
+            };
+
+            // matches a range of targets with the same context
+            auto MatchRange = [&](size_t i_begin, size_t i_end, BatchMatchResult & o_result) {
+                ScopedMatchingContext context(m_namespace, m_pattern_infos, nullptr);
+                for (size_t target_index = i_begin; target_index < i_end; target_index++)
                 {
-                    const std::vector<Substitution> substitutions = it->m_substitutions;
-                    const Tensor when_result = ApplySubstitutions(m_namespace, m_when, substitutions);
-                    if (Always(when_result))
+                    const Tensor & target = i_targets[target_index];
+                    if (!RootMayMatch(target))
+                        continue;
+
+                    if (i_solution_type == SolutionType::Any)
                     {
-                        ++it;
+                        std::optional<MatchResult> solution = FindFirstSolution(context.Get(), target, m_pattern, m_when);
+                        if (solution)
+                            AddSolution(o_result, target_index, solution->m_substitutions);
                     }
                     else
                     {
-                        it = solutions.erase(it);
+                        MakeSubstitutionsGraph(context.Get(), target, m_pattern);
+                        std::vector<MatchResult> solutions = GetAllSolutions(context.Get());
+                        RemoveRejectedByWhen(m_namespace, m_when, solutions);
+                        for (MatchResult & solution : solutions)
+                            AddSolution(o_result, target_index, solution.m_substitutions);
                     }
+
+                    context.Reset();
                 }
+            };
+
+            BatchMatchResult result;
+            if (i_thread_pool == nullptr || i_targets.size() < 2)
+            {
+                MatchRange(0, i_targets.size(), result);
+                return result;
             }
 
-            return { solutions };
-        }
+            /* many chunks per thread, so that threads that get cheap targets steal the
+               remaining chunks. Chunks are concatenated in order, so the result is the
+               same of the sequential match. */
+            const size_t chunk_count = std::min(i_targets.size(), i_thread_pool->GetThreadCount() * 8);
+            const size_t chunk_size = (i_targets.size() + chunk_count - 1) / chunk_count;
+            std::vector<BatchMatchResult> chunks(chunk_count);
+            std::atomic<size_t> pending_chunks{ chunk_count };
+            std::mutex exception_mutex;
+            std::exception_ptr exception;
+
+            for (size_t chunk_index = 0; chunk_index < chunk_count; chunk_index++)
+            {
+                i_thread_pool->Submit([&, chunk_index] {
+                    try
+                    {
+                        const size_t begin = std::min(chunk_index * chunk_size, i_targets.size());
+                        const size_t end = std::min(begin + chunk_size, i_targets.size());
+                        MatchRange(begin, end, chunks[chunk_index]);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(exception_mutex);
+                        if (!exception)
+                            exception = std::current_exception();
+                    }
+                    pending_chunks.fetch_sub(1, std::memory_order_acq_rel);
+                });
+            }
 
-        std::optional<MatchResult> Pattern::MatchOne(const Tensor & i_target,
-            const char * i_artifact_path) const
-        {
-            std::vector<MatchResult> solutions = MatchAll(i_target, i_artifact_path);
-            if (solutions.empty())
-                return {};
-            else
-                return solutions[0];
+            i_thread_pool->RunUntil([&pending_chunks] {
+                return pending_chunks.load(std::memory_order_acquire) == 0; });
+
+            if (exception)
+                std::rethrow_exception(exception);
+
+            for (BatchMatchResult & chunk : chunks)
+            {
+                const uint32_t offset = NumericCast<uint32_t>(result.m_substitutions.size());
+                result.m_target_indices.insert(result.m_target_indices.end(),
+                    chunk.m_target_indices.begin(), chunk.m_target_indices.end());
+                for (size_t solution_index = 1; solution_index < chunk.m_substitution_offsets.size(); solution_index++)
+                    result.m_substitution_offsets.push_back(offset + chunk.m_substitution_offsets[solution_index]);
+                std::move(chunk.m_substitutions.begin(), chunk.m_substitutions.end(),
+                    std::back_inserter(result.m_substitutions));
+            }
+
+            return result;
         }
 
     } // namespace o2o_pattern
 
 } // namespace djup
-
@@ -7,10 +7,16 @@
 #pragma once
 #include <private/common.h>
 #include <private/expression.h>
+#include <private/o2o_pattern/o2o_pattern_info.h>
 #include <core/to_chars.h>
 #include <vector>
 #include <optional>
 
+namespace core
+{
+    class ThreadPool;
+}
+
 namespace djup
 {
     class Namespace;
@@ -28,10 +34,38 @@ namespace djup
             std::vector<Substitution> m_substitutions;
         };
 
+        /** Solutions of a batch of targets, stored in columns rather than in a vector
+            per solution. Solutions are sorted by target index. */
+        struct BatchMatchResult
+        {
+            /** Index of the target of every solution */
+            std::vector<uint32_t> m_target_indices;
+
+            /** The substitutions of the i-th solution are in the range
+                [m_substitution_offsets[i], m_substitution_offsets[i + 1]) */
+            std::vector<uint32_t> m_substitution_offsets{ 0 };
+
+            std::vector<Substitution> m_substitutions;
+
+            size_t GetSolutionCount() const { return m_target_indices.size(); }
+
+            Span<const Substitution> GetSubstitutions(size_t i_solution) const
+            {
+                return Span<const Substitution>(m_substitutions.data() + m_substitution_offsets[i_solution],
+                    m_substitution_offsets[i_solution + 1] - m_substitution_offsets[i_solution]);
+            }
+        };
+
         class Pattern
         {
         public:
 
+            enum class SolutionType
+            {
+                All,
+                Any
+            };
+
             Pattern(const Namespace & i_namespace, const Tensor & i_pattern);
 
             Pattern(const Namespace & i_namespace, 
@@ -43,10 +77,45 @@ namespace djup
             std::vector<MatchResult> MatchAll(const Tensor & i_target,
                 const char * i_artifact_path) const;
 
+            /** Like MatchAll, but the alternative paths of the substitution graph are explored
+                in parallel by the tasks of i_thread_pool, without building the graph. Useful
+                for big variadic patterns. The order of the solutions is unspecified. */
+            std::vector<MatchResult> MatchAll(const Tensor & i_target,
+                ThreadPool & i_thread_pool) const;
+
+            /** Matches every target of a batch. With SolutionType::All the solutions of every
+                target are the same of MatchAll, with SolutionType::Any every target has at most a
+                solution, like with MatchOne. If i_thread_pool is not null, the targets are split
+                in chunks matched in parallel. The result does not depend on the thread pool. */
+            BatchMatchResult MatchBatch(Span<const Tensor> i_targets,
+                SolutionType i_solution_type = SolutionType::All,
+                ThreadPool * i_thread_pool = nullptr) const;
+
+            /** Returns true if the root of the pattern is an identifier, so
+                the pattern can match expressions with any name */
+            bool RootMatchesAnyName() const { return m_root_matches_any_name; }
+
+            /** If RootMatchesAnyName() is false, the name a target must have to match the pattern */
+            const Name & GetRootName() const { return m_root_name; }
+
+            /** If RootMatchesAnyName() is false, the range of the argument count of
+                the targets that may match the pattern */
+            UIntInterval GetRootArity() const { return m_root_arity; }
+
+        private:
+            void InitRootInfo();
+
+            /** Returns false if the root of the target can't match the root of the pattern */
+            bool RootMayMatch(const Tensor & i_target) const;
+
         private:
             Tensor m_pattern;
             Tensor m_when;
+            PatternInfoTable m_pattern_infos;
             const Namespace & m_namespace;
+            Name m_root_name;
+            UIntInterval m_root_arity;
+            bool m_root_matches_any_name{ true };
         };
 
         Tensor ApplySubstitutions(const Namespace & i_namespace,
@@ -0,0 +1,410 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/o2o_pattern/o2o_substitution_template.h>
+#include <private/builtin_names.h>
+#include <private/make_expr.h>
+#include <private/hash_consing.h>
+#include <private/namespace.h>
+#include <core/pointer_map.h>
+#include <algorithm>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        namespace
+        {
+            bool IsVariable(const Tensor & i_tensor)
+            {
+                return IsIdentifier(i_tensor) && !IsRepetition(i_tensor);
+            }
+        }
+
+        struct SubstitutionTemplate::Compiler
+        {
+            SubstitutionTemplate & m_template;
+
+            // whether a subexpression of the source contains identifiers
+            PointerMap<Expression, bool> m_has_variables{};
+
+            /* for every scope, the index of the MakeNode instruction of the subexpressions
+               already compiled. A scope is the body of a repetition, or the whole source. */
+            std::vector<PointerMap<Expression, uint32_t>> m_compiled_nodes{};
+
+            /* Visits the subexpressions in post-order with an explicit stack, so that
+               deep expressions can't overflow the call stack */
+            bool HasVariables(const Tensor & i_tensor)
+            {
+                if (const bool * has_variables = m_has_variables.Find(i_tensor.GetExpression().get()))
+                    return *has_variables;
+
+                struct StackFrame
+                {
+                    const Tensor * m_tensor;
+                    size_t m_next_argument;
+                    bool m_has_variables;
+                };
+                std::vector<StackFrame> stack;
+                stack.push_back({ &i_tensor, 0, IsVariable(i_tensor) });
+
+                bool has_variables = false;
+                while (!stack.empty())
+                {
+                    StackFrame & frame = stack.back();
+                    const Span<const Tensor> arguments = frame.m_tensor->GetExpression()->GetArguments();
+                    if (frame.m_next_argument < arguments.size())
+                    {
+                        const Tensor & argument = arguments[frame.m_next_argument++];
+                        if (const bool * argument_has_variables = m_has_variables.Find(argument.GetExpression().get()))
+                            frame.m_has_variables = *argument_has_variables || frame.m_has_variables;
+                        else
+                            stack.push_back({ &argument, 0, IsVariable(argument) });
+                        continue;
+                    }
+
+                    has_variables = frame.m_has_variables;
+                    m_has_variables.TryEmplace(frame.m_tensor->GetExpression().get()).first = has_variables;
+                    stack.pop_back();
+                    if (!stack.empty())
+                        stack.back().m_has_variables = has_variables || stack.back().m_has_variables;
+                }
+                return has_variables;
+            }
+
+            uint32_t Emit(Opcode i_opcode, uint32_t i_operand = s_none, uint32_t i_extra = s_none)
+            {
+                const uint32_t index = NumericCast<uint32_t>(m_template.m_instructions.size());
+                m_template.m_instructions.push_back({ i_opcode, i_operand, i_extra });
+                return index;
+            }
+
+            uint32_t AddConstant(const Tensor & i_tensor)
+            {
+                m_template.m_constants.push_back(i_tensor);
+                return NumericCast<uint32_t>(m_template.m_constants.size() - 1);
+            }
+
+            uint32_t GetVariable(const Name & i_name)
+            {
+                std::vector<Name> & variables = m_template.m_variables;
+                const auto it = std::find(variables.begin(), variables.end(), i_name);
+                if (it != variables.end())
+                    return NumericCast<uint32_t>(it - variables.begin());
+                variables.push_back(i_name);
+                return NumericCast<uint32_t>(variables.size() - 1);
+            }
+
+            // the identifiers of a subexpression, in pre-order
+            void GetInvolvedVariables(std::vector<uint32_t> & o_variables, const Tensor & i_tensor)
+            {
+                std::vector<const Tensor *> stack{ &i_tensor };
+                while (!stack.empty())
+                {
+                    const Tensor & tensor = *stack.back();
+                    stack.pop_back();
+
+                    if (IsVariable(tensor))
+                    {
+                        const uint32_t variable = GetVariable(tensor.GetExpression()->GetName());
+                        if (std::find(o_variables.begin(), o_variables.end(), variable) == o_variables.end())
+                            o_variables.push_back(variable);
+                    }
+
+                    const Span<const Tensor> arguments = tensor.GetExpression()->GetArguments();
+                    for (size_t i = arguments.size(); i-- > 0; )
+                        stack.push_back(&arguments[i]);
+                }
+            }
+
+            // emits BeginRepetition, and returns the scope of the body
+            uint32_t BeginRepetition(const Tensor & i_repetition, uint32_t & o_repetition_index)
+            {
+                DJUP_ASSERT(IsRepetition(i_repetition));
+
+                o_repetition_index = NumericCast<uint32_t>(m_template.m_repetitions.size());
+                Repetition & repetition = m_template.m_repetitions.emplace_back();
+
+                GetInvolvedVariables(repetition.m_variables, i_repetition);
+                if (repetition.m_variables.empty())
+                    Error("Repetition without identifiers in substitution: ", ToSimplifiedString(i_repetition));
+
+                repetition.m_begin = Emit(Opcode::BeginRepetition, o_repetition_index);
+
+                m_compiled_nodes.emplace_back();
+                return NumericCast<uint32_t>(m_compiled_nodes.size() - 1);
+            }
+
+            void EndRepetition(uint32_t i_repetition_index)
+            {
+                m_template.m_repetitions[i_repetition_index].m_end = Emit(Opcode::EndRepetition, i_repetition_index);
+            }
+
+            /* Compiles a subexpression. Nodes with arguments are compiled with an explicit
+               stack, so that deep expressions can't overflow the call stack. */
+            void Compile(const Tensor & i_tensor, uint32_t i_scope)
+            {
+                struct StackFrame
+                {
+                    const Tensor * m_tensor;
+                    uint32_t m_scope;
+                    size_t m_next_argument;
+                    uint32_t m_repetition; // if not s_none, the node is the body of this repetition
+                };
+                std::vector<StackFrame> stack;
+
+                // emits the code of the leaves, or pushes a frame
+                auto const visit = [&](const Tensor & i_node, uint32_t i_node_scope, uint32_t i_repetition) {
+                    const Expression & expr = *i_node.GetExpression();
+
+                    if (!HasVariables(i_node))
+                    {
+                        Emit(Opcode::PushConstant, AddConstant(i_node));
+                    }
+                    else if (expr.GetArguments().empty())
+                    {
+                        Emit(Opcode::PushVariable, GetVariable(expr.GetName()), AddConstant(i_node));
+                    }
+                    else if (const uint32_t * compiled = m_compiled_nodes[i_node_scope].Find(&expr))
+                    {
+                        // a subexpression already instantiated in this scope is stored in a slot
+                        Instruction & make_node = m_template.m_instructions[*compiled];
+                        if (make_node.m_extra == s_none)
+                            make_node.m_extra = m_template.m_slot_count++;
+                        Emit(Opcode::Load, make_node.m_extra);
+                    }
+                    else
+                    {
+                        Emit(Opcode::BeginArguments);
+                        stack.push_back({ &i_node, i_node_scope, 0, i_repetition });
+                        return;
+                    }
+
+                    if (i_repetition != s_none)
+                        EndRepetition(i_repetition);
+                };
+
+                visit(i_tensor, i_scope, s_none);
+                while (!stack.empty())
+                {
+                    StackFrame & frame = stack.back();
+                    const Expression & expr = *frame.m_tensor->GetExpression();
+                    if (frame.m_next_argument < expr.GetArguments().size())
+                    {
+                        const Tensor & argument = expr.GetArgument(frame.m_next_argument++);
+                        const uint32_t scope = frame.m_scope; // frame is invalidated by visit
+                        if (GetCardinality(argument) != UIntInterval{ 1, 1 })
+                        {
+                            uint32_t repetition_index;
+                            const uint32_t body_scope = BeginRepetition(argument, repetition_index);
+                            visit(argument.GetExpression()->GetArgument(0), body_scope, repetition_index);
+                        }
+                        else
+                            visit(argument, scope, s_none);
+                        continue;
+                    }
+
+                    const uint32_t node_index = NumericCast<uint32_t>(m_template.m_nodes.size());
+                    m_template.m_nodes.push_back({ *frame.m_tensor,
+                        IsVariable(*frame.m_tensor) ? GetVariable(expr.GetName()) : s_none });
+
+                    const uint32_t make_node = Emit(Opcode::MakeNode, node_index);
+                    m_compiled_nodes[frame.m_scope].TryEmplace(&expr).first = make_node;
+
+                    const uint32_t repetition = frame.m_repetition;
+                    stack.pop_back();
+                    if (repetition != s_none)
+                        EndRepetition(repetition);
+                }
+            }
+        };
+
+        SubstitutionTemplate::SubstitutionTemplate(const Tensor & i_source)
+            : m_source(i_source)
+        {
+            Compiler compiler{ *this };
+            compiler.m_compiled_nodes.emplace_back();
+            compiler.Compile(i_source, 0);
+        }
+
+        Tensor SubstitutionTemplate::Instantiate(const Namespace & i_namespace,
+            Span<const Substitution> i_substitutions, SubstitutionRebuild i_rebuild) const
+        {
+            // the value of every variable, the first substitution wins
+            std::vector<const Tensor *> values(m_variables.size(), nullptr);
+            for (size_t variable = 0; variable < m_variables.size(); variable++)
+            {
+                for (const Substitution & substitution : i_substitutions)
+                {
+                    if (substitution.m_identifier_name == m_variables[variable])
+                    {
+                        values[variable] = &substitution.m_value;
+                        break;
+                    }
+                }
+            }
+
+            struct RepetitionFrame
+            {
+                uint32_t m_repetition;
+                uint32_t m_element;
+                uint32_t m_cardinality;
+                size_t m_tuples_offset;
+            };
+            std::vector<RepetitionFrame> repetition_frames;
+            std::vector<const Tensor *> tuples; // the values of the variables of the repetitions being expanded
+
+            std::vector<Tensor> stack;
+            std::vector<size_t> argument_offsets;
+            std::vector<Tensor> slots(m_slot_count);
+
+            auto const bind_elements = [&](const RepetitionFrame & i_frame) {
+                const Repetition & repetition = m_repetitions[i_frame.m_repetition];
+                for (size_t i = 0; i < repetition.m_variables.size(); i++)
+                {
+                    const Tensor * tuple = tuples[i_frame.m_tuples_offset + i];
+                    values[repetition.m_variables[i]] = tuple != nullptr ?
+                        &tuple->GetExpression()->GetArgument(i_frame.m_element) : nullptr;
+                }
+            };
+
+            for (size_t instruction_index = 0; instruction_index < m_instructions.size(); instruction_index++)
+            {
+                const Instruction & instruction = m_instructions[instruction_index];
+                switch (instruction.m_opcode)
+                {
+                case Opcode::PushConstant:
+                    stack.push_back(m_constants[instruction.m_operand]);
+                    break;
+
+                case Opcode::PushVariable:
+                {
+                    const Tensor * value = values[instruction.m_operand];
+                    stack.push_back(value != nullptr ? *value : m_constants[instruction.m_extra]);
+                    break;
+                }
+
+                case Opcode::BeginArguments:
+                    argument_offsets.push_back(stack.size());
+                    break;
+
+                case Opcode::MakeNode:
+                {
+                    const Node & node = m_nodes[instruction.m_operand];
+                    const Expression & source = *node.m_source.GetExpression();
+                    const Tensor * head = node.m_variable != s_none ? values[node.m_variable] : nullptr;
+
+                    const size_t arguments_offset = argument_offsets.back();
+                    argument_offsets.pop_back();
+                    const Span<const Tensor> arguments(stack.data() + arguments_offset,
+                        stack.size() - arguments_offset);
+
+                    bool some_argument_replaced = arguments.size() != source.GetArguments().size();
+                    for (size_t i = 0; !some_argument_replaced && i < arguments.size(); i++)
+                        some_argument_replaced = arguments[i].GetExpression() != source.GetArgument(i).GetExpression();
+
+                    Tensor result;
+                    if (!some_argument_replaced)
+                    {
+                        result = head != nullptr ? *head : node.m_source;
+                    }
+                    else
+                    {
+                        const Expression & expr = head != nullptr ? *head->GetExpression() : source;
+                        if (i_rebuild == SubstitutionRebuild::CanonicalizeEachNode)
+                            result = MakeExpression(i_namespace, expr.GetType(), expr.GetName(),
+                                arguments, expr.GetMetadata());
+                        else
+                            result = { HashConsExpression(NewExpression(expr.GetType(), expr.GetName(),
+                                arguments, expr.GetMetadata())) };
+                    }
+
+                    stack.resize(arguments_offset);
+                    if (instruction.m_extra != s_none)
+                        slots[instruction.m_extra] = result;
+                    stack.push_back(std::move(result));
+                    break;
+                }
+
+                case Opcode::Load:
+                    stack.push_back(slots[instruction.m_operand]);
+                    break;
+
+                case Opcode::BeginRepetition:
+                {
+                    const Repetition & repetition = m_repetitions[instruction.m_operand];
+
+                    // all the tuples must have the same size, unbound identifiers are empty tuples
+                    const uint32_t infinite = std::numeric_limits<uint32_t>::max();
+                    uint32_t cardinality = infinite;
+                    for (uint32_t variable : repetition.m_variables)
+                    {
+                        const Tensor * value = values[variable];
+                        if (value == nullptr)
+                        {
+                            if (cardinality == infinite)
+                                cardinality = 0;
+                            continue;
+                        }
+
+                        const Expression & tuple = *value->GetExpression();
+                        if (tuple.GetName() != builtin_names::Tuple)
+                            Error("Non-tuple expression in variadic substitution: ", m_variables[variable]);
+
+                        const uint32_t this_cardinality = NumericCast<uint32_t>(tuple.GetArguments().size());
+                        if (cardinality == infinite)
+                            cardinality = this_cardinality;
+                        else if (cardinality != this_cardinality)
+                            Error("Mismatching cardinality for variadic substitution of ",
+                                m_variables[variable], " (", cardinality, " and ", this_cardinality, ")");
+                    }
+
+                    if (cardinality == 0)
+                    {
+                        instruction_index = repetition.m_end;
+                        break;
+                    }
+
+                    const RepetitionFrame & frame = repetition_frames.emplace_back(
+                        RepetitionFrame{ instruction.m_operand, 0, cardinality, tuples.size() });
+                    for (uint32_t variable : repetition.m_variables)
+                        tuples.push_back(values[variable]);
+                    bind_elements(frame);
+                    break;
+                }
+
+                case Opcode::EndRepetition:
+                {
+                    RepetitionFrame & frame = repetition_frames.back();
+                    const Repetition & repetition = m_repetitions[frame.m_repetition];
+                    DJUP_ASSERT(frame.m_repetition == instruction.m_operand);
+
+                    if (++frame.m_element < frame.m_cardinality)
+                    {
+                        bind_elements(frame);
+                        instruction_index = repetition.m_begin;
+                        break;
+                    }
+
+                    // restore the tuples
+                    for (size_t i = 0; i < repetition.m_variables.size(); i++)
+                        values[repetition.m_variables[i]] = tuples[frame.m_tuples_offset + i];
+                    tuples.resize(frame.m_tuples_offset);
+                    repetition_frames.pop_back();
+                    break;
+                }
+                }
+            }
+
+            DJUP_ASSERT(stack.size() == 1 && argument_offsets.empty() && repetition_frames.empty());
+            if (i_rebuild == SubstitutionRebuild::CanonicalizeResult)
+                return i_namespace.Canonicalize(stack.back());
+            return std::move(stack.back());
+        }
+
+    } // namespace o2o_pattern
+
+} // namespace djup
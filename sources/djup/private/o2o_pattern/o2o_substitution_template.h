@@ -0,0 +1,91 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <private/common.h>
+#include <private/expression.h>
+#include <private/make_expr.h>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <vector>
+
+namespace djup
+{
+    class Namespace;
+
+    namespace o2o_pattern
+    {
+        /** An expression compiled to a list of instructions that instantiate it with the
+            values of a set of substitutions, in a single pass and without hashing.
+            Subexpressions without identifiers are copied, identifiers are replaced by
+            the value they are bound to, and repetitions are expanded for every element
+            of the tuples bound to the identifiers they contain. Subexpressions shared
+            by the source are instantiated only once. */
+        class SubstitutionTemplate
+        {
+        public:
+
+            explicit SubstitutionTemplate(const Tensor & i_source);
+
+            const Tensor & GetSource() const { return m_source; }
+
+            /** Same as ApplySubstitutions(i_namespace, GetSource(), i_substitutions). i_rebuild tells
+                whether the nodes built for the substitutions are canonicalized one by one, only at
+                the end, or not at all. */
+            Tensor Instantiate(const Namespace & i_namespace,
+                Span<const Substitution> i_substitutions,
+                SubstitutionRebuild i_rebuild = SubstitutionRebuild::CanonicalizeEachNode) const;
+
+        private:
+
+            enum class Opcode : uint8_t
+            {
+                PushConstant,       /**< pushes m_constants[m_operand] */
+                PushVariable,       /**< pushes the value of m_variables[m_operand], or m_constants[m_extra] if unbound */
+                BeginArguments,     /**< the values pushed from now on are the arguments of the next MakeNode */
+                MakeNode,           /**< replaces the arguments with a node like m_nodes[m_operand], and copies
+                                         it to the slot m_extra, if any */
+                Load,               /**< pushes the slot m_operand */
+                BeginRepetition,    /**< starts the expansion of m_repetitions[m_operand] */
+                EndRepetition       /**< jumps back to the beginning of the repetition, if there are elements left */
+            };
+
+            struct Instruction
+            {
+                Opcode m_opcode;
+                uint32_t m_operand;
+                uint32_t m_extra;
+            };
+
+            struct Node
+            {
+                Tensor m_source;
+                uint32_t m_variable; // if not s_none, the name of the node is an identifier
+            };
+
+            struct Repetition
+            {
+                uint32_t m_begin; // index of BeginRepetition
+                uint32_t m_end; // index of EndRepetition
+                std::vector<uint32_t> m_variables; // the identifiers in the repetition, in pre-order
+            };
+
+            static constexpr uint32_t s_none = std::numeric_limits<uint32_t>::max();
+
+            struct Compiler;
+
+        private:
+            Tensor m_source;
+            std::vector<Instruction> m_instructions;
+            std::vector<Tensor> m_constants;
+            std::vector<Node> m_nodes;
+            std::vector<Repetition> m_repetitions;
+            std::vector<Name> m_variables;
+            uint32_t m_slot_count{};
+        };
+
+    } // namespace o2o_pattern
+
+} // namespace djup
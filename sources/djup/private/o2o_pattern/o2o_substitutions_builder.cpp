@@ -7,143 +7,258 @@
 #include <private/common.h>
 #include <private/o2o_pattern/o2o_substitutions_builder.h>
 #include <private/o2o_pattern/o2o_pattern_match.h>
+#include <algorithm>
 
 namespace djup
 {
     namespace o2o_pattern
     {
-        bool SubstitutionsBuilder::AddToBottomLayer(const Substitution & i_substitution)
+        namespace
         {
-            for(const Substitution & exiting_substitution : m_substitutions)
+            /* Replaces the values of the layers deeper than i_depth with a tuple, that
+               becomes the last value of the enclosing layer. io_layers stores the index of
+               the first value of every layer. */
+            void ReduceLayers(std::vector<Tensor> & io_values, std::vector<size_t> & io_layers, size_t i_depth)
             {
-                if (exiting_substitution.m_identifier_name == i_substitution.m_identifier_name)
+                while (io_layers.size() > i_depth)
                 {
-                    if (!AlwaysEqual(exiting_substitution.m_value, i_substitution.m_value))
-                    {
-                        return false;
-                    }
+                    const size_t begin = io_layers.back();
+                    io_layers.pop_back();
+                    Tensor tuple = Tuple(Span<const Tensor>(io_values.data() + begin, io_values.size() - begin));
+                    io_values.resize(begin);
+                    io_values.push_back(std::move(tuple));
                 }
             }
-            m_substitutions.push_back(i_substitution);
-            return true;
         }
 
-        /* Add the source substitutions to the dest vector. If there is
-            a contradiction returns false, otherwise true. */
-        bool SubstitutionsBuilder::AddToBottomLayer(
-            const std::vector<Substitution> & i_source_substitutions)
+        void VariadicCaptures::Open(uint32_t i_depth)
         {
-            for (const Substitution & substitution : i_source_substitutions)
-            {
-                if (!AddToBottomLayer(substitution))
-                    return false;
-            }
-            // no contradictions
-            return true;
+            if (m_curr_depth == 0)
+                m_group_begin = GetArenaSize();
+            m_curr_depth += i_depth;
         }
 
-        void SubstitutionsBuilder::AddToVariadic(
-            const std::vector<Substitution>& i_source_substitutions)
+        void VariadicCaptures::Clear()
         {
-            for (const Substitution& subst : i_source_substitutions)
+            m_curr_depth = 0;
+            m_group_begin = 0;
+            m_sealed_size = 0;
+            m_sealed.reset();
+            m_tail.clear();
+            m_group_identifiers.clear();
+            m_completed.clear();
+        }
+
+        void VariadicCaptures::Append(Entry && i_entry)
+        {
+            if (m_tail.size() == s_chunk_size)
             {
-                VariadicValue& variadic_value = m_variadic_substitutions[subst.m_identifier_name];
-                if (variadic_value.m_stack.size() < m_curr_depth)
-                    variadic_value.m_stack.resize(m_curr_depth);
-                variadic_value.m_stack.back().push_back(subst.m_value);
+                m_sealed = IntrusivePtr<const Chunk>(new Chunk{ { std::move(m_sealed) }, std::move(m_tail) });
+                m_sealed_size += s_chunk_size;
+                m_tail.clear();
             }
+            if (m_tail.capacity() < s_chunk_size)
+                m_tail.reserve(s_chunk_size);
+            m_tail.push_back(std::move(i_entry));
         }
 
-        Tensor SubstitutionsBuilder::VariadicClear(VariadicValue& i_dest)
+        void VariadicCaptures::AddCapture(const Name & i_identifier_name, const Tensor & i_value)
         {
-            DJUP_ASSERT(i_dest.m_stack.size() >= 1);
-
-            while (i_dest.m_stack.size() > 1)
-                VariadicReduceDepth(i_dest);
+            if (std::find(m_group_identifiers.begin(), m_group_identifiers.end(),
+                    i_identifier_name) == m_group_identifiers.end())
+                m_group_identifiers.push_back(i_identifier_name);
 
-            Tensor result = ToTuple(i_dest.m_stack.front());
-            i_dest.m_stack.clear();
-            return result;
+            Append({ i_identifier_name, i_value, m_curr_depth });
         }
 
-        void SubstitutionsBuilder::VariadicReduceDepth(VariadicValue& i_dest)
+        void VariadicCaptures::Add(const std::vector<Substitution> & i_substitutions)
         {
-            DJUP_ASSERT(i_dest.m_stack.size() >= 2);
-
-            const size_t size = i_dest.m_stack.size();
-            i_dest.m_stack[size - 2].push_back(Tuple(i_dest.m_stack[size - 1]));
-            i_dest.m_stack.pop_back();
+            DJUP_ASSERT(m_curr_depth > 0);
+            for (const Substitution & substitution : i_substitutions)
+                AddCapture(substitution.m_identifier_name, substitution.m_value);
         }
 
-        Tensor SubstitutionsBuilder::ToTuple(const std::vector<Tensor>& i_source)
+        void VariadicCaptures::Add(const BindingEnvironment & i_substitutions)
         {
-            std::vector<Tensor> arguments;
-            arguments.reserve(i_source.size());
-            for (auto it = i_source.begin(); it != i_source.end(); ++it)
-                arguments.push_back(*it);
-            return Tuple(arguments);
+            DJUP_ASSERT(m_curr_depth > 0);
+            i_substitutions.ForEach([this](const Name & i_identifier_name, const Tensor & i_value) {
+                AddCapture(i_identifier_name, i_value);
+                return true;
+            });
         }
 
-        bool SubstitutionsBuilder::Add(
-            const std::vector<Substitution>& i_substitutions)
+        bool VariadicCaptures::Close(uint32_t i_depth, size_t i_binding_index)
         {
-            if (m_curr_depth == 0)
+            DJUP_ASSERT(m_curr_depth >= i_depth); // detects underflow
+            if (i_depth == 0)
+                return false;
+
+            m_curr_depth -= i_depth;
+            if (m_curr_depth != 0)
             {
-                return AddToBottomLayer(i_substitutions);
+                Append({ Name{}, Tensor{}, m_curr_depth });
+                return false;
             }
-            else
-            {                
-                AddToVariadic(i_substitutions);
 
-     
-                return true;
-            }
+            // the outermost group is closed, every identifier captured in it is now complete
+            for (const Name & identifier_name : m_group_identifiers)
+                m_completed.push_back({ identifier_name, m_group_begin, GetArenaSize(), i_binding_index });
+            m_group_identifiers.clear();
+            return true;
         }
 
-        void SubstitutionsBuilder::Open(uint32_t i_depth)
+        size_t VariadicCaptures::FindCompleted(const Name & i_identifier_name) const
         {
-            m_curr_depth += i_depth;
+            for (size_t index = 0; index < m_completed.size(); index++)
+                if (m_completed[index].m_identifier_name == i_identifier_name)
+                    return index;
+            return m_completed.size();
         }
 
-        bool SubstitutionsBuilder::Close(uint32_t i_depth)
+        std::vector<const VariadicCaptures::Chunk*> VariadicCaptures::GetChunks() const
         {
-            DJUP_ASSERT(m_curr_depth >= i_depth); // detects underflow
-            m_curr_depth -= i_depth;
+            std::vector<const Chunk*> chunks(m_sealed_size / s_chunk_size);
+            auto dest = chunks.rbegin();
+            for (const Chunk * chunk = m_sealed.get(); chunk != nullptr; chunk = chunk->m_parent.get())
+                *dest++ = chunk;
+            return chunks;
+        }
 
-            if (m_curr_depth == 0)
+        Tensor VariadicCaptures::Materialize(const CompletedCapture & i_capture,
+            Span<const Chunk * const> i_chunks, MaterializeScratch & io_scratch) const
+        {
+            // values of the open layers, each layer is a range of this vector
+            std::vector<Tensor> & values = io_scratch.m_values;
+            std::vector<size_t> & layers = io_scratch.m_layers;
+            values.clear();
+            layers.clear();
+            values.reserve(i_capture.m_end - i_capture.m_begin); // the values are never more than the entries
+
+            for (uint32_t index = i_capture.m_begin; index < i_capture.m_end; index++)
             {
-                for (auto& var_subst : m_variadic_substitutions)
+                const Entry & entry = index < m_sealed_size ?
+                    i_chunks[index / s_chunk_size]->m_entries[index % s_chunk_size] :
+                    m_tail[index - m_sealed_size];
+
+                if (entry.m_identifier_name.IsEmpty())
+                {
+                    ReduceLayers(values, layers, std::max<size_t>(entry.m_depth, 1));
+                }
+                else if (entry.m_identifier_name == i_capture.m_identifier_name)
                 {
-                    Tensor value = VariadicClear(var_subst.second);
-                    if (!AddToBottomLayer({ var_subst.first, value }))
-                    {
-                        return false;
-                    }
+                    while (layers.size() < entry.m_depth)
+                        layers.push_back(values.size());
+                    values.push_back(entry.m_value);
                 }
-                m_variadic_substitutions.clear();
             }
-            else
+
+            DJUP_ASSERT(!layers.empty());
+            ReduceLayers(values, layers, 1);
+            Tensor result = Tuple(values);
+            values.clear(); // the scratch must not keep alive the values
+            return result;
+        }
+
+        Tensor VariadicCaptures::MaterializeCompleted(size_t i_index) const
+        {
+            MaterializeScratch scratch;
+            return Materialize(m_completed[i_index], GetChunks(), scratch);
+        }
+
+        std::vector<Substitution> VariadicCaptures::MergeInto(std::vector<Substitution> && i_bindings) const
+        {
+            MaterializeScratch scratch;
+            return MergeInto(std::move(i_bindings), scratch);
+        }
+
+        std::vector<Substitution> VariadicCaptures::MergeInto(std::vector<Substitution> && i_bindings,
+            MaterializeScratch & io_scratch) const
+        {
+            if (m_completed.empty())
+                return std::move(i_bindings);
+
+            const std::vector<const Chunk*> chunks = GetChunks();
+            std::vector<Substitution> result;
+            result.reserve(i_bindings.size() + m_completed.size());
+            size_t completed_index = 0;
+            for (size_t binding_index = 0; binding_index <= i_bindings.size(); binding_index++)
             {
-                for (auto& var_subst : m_variadic_substitutions)
+                for (; completed_index < m_completed.size() &&
+                    m_completed[completed_index].m_binding_index == binding_index; completed_index++)
                 {
-                    while (var_subst.second.m_stack.size() > m_curr_depth)
-                        VariadicReduceDepth(var_subst.second);
+                    result.push_back({ m_completed[completed_index].m_identifier_name,
+                        Materialize(m_completed[completed_index], chunks, io_scratch) });
                 }
+
+                if (binding_index < i_bindings.size())
+                    result.push_back(std::move(i_bindings[binding_index]));
             }
+            DJUP_ASSERT(completed_index == m_completed.size());
+            return result;
+        }
+
+        /* Adds a substitution to the bindings. If there is a
+            contradiction returns false, otherwise true. */
+        bool SubstitutionsBuilder::AddToBottomLayer(const Name & i_identifier_name, const Tensor & i_value)
+        {
+            // an identifier already bound must have the same value
+            if (const Tensor * existing_value = m_bindings.Find(i_identifier_name))
+                return AlwaysEqual(*existing_value, i_value);
+
+            const size_t completed = m_variadic_captures.FindCompleted(i_identifier_name);
+            if (completed < m_variadic_captures.GetCompletedCount())
+                return AlwaysEqual(m_variadic_captures.MaterializeCompleted(completed), i_value);
 
+            m_bindings = m_bindings.Bind(i_identifier_name, i_value);
             return true;
         }
 
-        const std::vector<Substitution> & SubstitutionsBuilder::GetSubstitutions() const
+        bool SubstitutionsBuilder::Add(const BindingEnvironment & i_substitutions)
+        {
+            if (m_variadic_captures.GetDepth() == 0)
+            {
+                return i_substitutions.ForEach([this](const Name & i_identifier_name, const Tensor & i_value) {
+                    return AddToBottomLayer(i_identifier_name, i_value); });
+            }
+            else
+            {
+                m_variadic_captures.Add(i_substitutions);
+                return true;
+            }
+        }
+
+        void SubstitutionsBuilder::Clear()
+        {
+            m_bindings = {};
+            m_variadic_captures.Clear();
+        }
+
+        void SubstitutionsBuilder::Open(uint32_t i_depth)
+        {
+            m_variadic_captures.Open(i_depth);
+        }
+
+        bool SubstitutionsBuilder::Close(uint32_t i_depth)
+        {
+            const size_t first_new = m_variadic_captures.GetCompletedCount();
+            if (!m_variadic_captures.Close(i_depth, m_bindings.GetSize()))
+                return true;
+
+            return m_variadic_captures.ReconcileCompleted(first_new, [this](const Name & i_identifier_name) {
+                return m_bindings.Find(i_identifier_name); });
+        }
+
+        std::vector<Substitution> SubstitutionsBuilder::GetSubstitutions() const
         {
-            DJUP_ASSERT(m_curr_depth == 0);
-            return m_substitutions;
+            DJUP_ASSERT(m_variadic_captures.GetDepth() == 0);
+            return m_variadic_captures.MergeInto(m_bindings.ToSubstitutions());
         }
 
-        std::vector<Substitution> SubstitutionsBuilder::StealSubstitutions() const
+        std::vector<Substitution> SubstitutionsBuilder::GetSubstitutions(
+            VariadicCaptures::MaterializeScratch & io_scratch) const
         {
-            DJUP_ASSERT(m_curr_depth == 0);
-            return std::move(m_substitutions);
+            DJUP_ASSERT(m_variadic_captures.GetDepth() == 0);
+            return m_variadic_captures.MergeInto(m_bindings.ToSubstitutions(), io_scratch);
         }
 
     } // namespace o2o_pattern
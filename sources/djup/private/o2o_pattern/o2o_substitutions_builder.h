@@ -8,8 +8,9 @@
 #include <private/common.h>
 #include <djup/tensor.h>
 #include <core/name.h>
-#include <unordered_map>
-#include <unordered_set>
+#include <core/immutable_chain.h>
+#include <core/span.h>
+#include <private/o2o_pattern/o2o_binding_environment.h>
 #include <vector>
 
 namespace djup
@@ -18,47 +19,159 @@ namespace djup
     {
         struct Substitution;
 
-        class SubstitutionsBuilder
+        /** Values of the identifiers captured inside variadic groups. All the captures are
+            appended to a single arena, together with the closing of the nested groups, so
+            opening and closing a group doesn't create any expression. The nested tuples of a
+            capture are built only when its value is needed: when the substitutions of a match
+            are materialized, or when an identifier is bound twice and the values must be compared.
+            The arena is made of fixed-size chunks: full chunks are immutable and shared between
+            copies, so copying the captures only copies the last chunk. */
+        class VariadicCaptures
         {
         public:
 
-            bool Add(const std::vector<Substitution>& i_substitutions);
+            /** Containers used to build the tuples of the captures, that can be reused */
+            struct MaterializeScratch
+            {
+                std::vector<Tensor> m_values;
+                std::vector<size_t> m_layers;
+            };
+
+            uint32_t GetDepth() const { return m_curr_depth; }
+
+            /** Removes all the captures, but keeps the capacity of the containers */
+            void Clear();
 
             void Open(uint32_t i_depth);
 
-            bool Close(uint32_t i_depth);
+            void Add(const std::vector<Substitution> & i_substitutions);
+
+            void Add(const BindingEnvironment & i_substitutions);
+
+            /** Returns true if the outermost group has been closed. In this case the
+                identifiers of the group are appended to the completed captures, each
+                with the specified binding index. */
+            bool Close(uint32_t i_depth, size_t i_binding_index);
 
-            const std::vector<Substitution>& GetSubstitutions() const;
+            size_t GetCompletedCount() const { return m_completed.size(); }
 
-            std::vector<Substitution> StealSubstitutions() const;
+            /** Returns the index of the first completed capture of an identifier, or GetCompletedCount() */
+            size_t FindCompleted(const Name & i_identifier_name) const;
+
+            /** Builds the value of a completed capture */
+            Tensor MaterializeCompleted(size_t i_index) const;
+
+            /** Checks the captures completed from i_first_new against the previous bindings of the same
+                identifiers, returned by i_find_binding, and against the previous captures. Captures that
+                agree are discarded, since the identifier is already bound. Returns false on a contradiction.
+                This is the only case in which the tuples are built before the match is accepted. */
+            template <typename FIND_BINDING>
+                bool ReconcileCompleted(size_t i_first_new, const FIND_BINDING & i_find_binding)
+            {
+                for (size_t index = m_completed.size(); index-- > i_first_new; )
+                {
+                    const Name & identifier_name = m_completed[index].m_identifier_name;
+                    const Tensor * existing_value = i_find_binding(identifier_name);
+                    Tensor previous_capture;
+                    if (existing_value == nullptr)
+                    {
+                        const size_t previous = FindCompleted(identifier_name);
+                        if (previous == index)
+                            continue;
+                        previous_capture = MaterializeCompleted(previous);
+                        existing_value = &previous_capture;
+                    }
+
+                    if (!AlwaysEqual(*existing_value, MaterializeCompleted(index)))
+                        return false;
+                    m_completed.erase(m_completed.begin() + index);
+                }
+                return true;
+            }
+
+            /** Merges the completed captures into a list of substitutions, each at its binding index */
+            std::vector<Substitution> MergeInto(std::vector<Substitution> && i_bindings) const;
+
+            std::vector<Substitution> MergeInto(std::vector<Substitution> && i_bindings,
+                MaterializeScratch & io_scratch) const;
 
         private:
 
-            struct VariadicValue
+            static constexpr uint32_t s_chunk_size = 32;
+
+            struct Entry
             {
-                std::vector<std::vector<Tensor>> m_stack;
+                Name m_identifier_name; // empty for the closing of a group
+                Tensor m_value;
+                uint32_t m_depth{}; // depth of the value, or depth after the closing of a group
             };
 
-        private:
+            // sealed chunks are immutable, and shared by the copies of the builder
+            struct Chunk : ImmutableChainNode<Chunk>
+            {
+                std::vector<Entry> m_entries;
+            };
 
-            bool AddToBottomLayer(const Substitution & i_solution);
+            /** Range of the arena that spans an outermost group */
+            struct CompletedCapture
+            {
+                Name m_identifier_name;
+                uint32_t m_begin{}, m_end{};
+                size_t m_binding_index{};
+            };
+
+        private:
 
-            bool AddToBottomLayer(
-                const std::vector<Substitution>& i_source_substitutions);
+            uint32_t GetArenaSize() const { return m_sealed_size + static_cast<uint32_t>(m_tail.size()); }
 
-            void AddToVariadic(
-                const std::vector<Substitution>& i_source_substitutions);
+            void Append(Entry && i_entry);
 
-            static Tensor VariadicClear(VariadicValue& i_dest);
+            void AddCapture(const Name & i_identifier_name, const Tensor & i_value);
 
-            static void VariadicReduceDepth(VariadicValue& i_dest);
+            /** Returns the full chunks, from the first */
+            std::vector<const Chunk*> GetChunks() const;
 
-            static Tensor ToTuple(const std::vector<Tensor>& i_source);
+            Tensor Materialize(const CompletedCapture & i_capture,
+                Span<const Chunk * const> i_chunks, MaterializeScratch & io_scratch) const;
 
         private:
             uint32_t m_curr_depth{};
-            std::vector<Substitution> m_substitutions;
-            std::unordered_map<Name, VariadicValue> m_variadic_substitutions;
+            uint32_t m_group_begin{};
+            uint32_t m_sealed_size{};
+            IntrusivePtr<const Chunk> m_sealed;
+            std::vector<Entry> m_tail;
+            std::vector<Name> m_group_identifiers; // identifiers of the open outermost group
+            std::vector<CompletedCapture> m_completed;
+        };
+
+        /** Accumulates the substitutions of the edges of a path of the substitution graph.
+            Substitutions at depth zero are stored in a BindingEnvironment, so copying a
+            builder to follow many branches does not copy them. */
+        class SubstitutionsBuilder
+        {
+        public:
+
+            bool Add(const BindingEnvironment & i_substitutions);
+
+            /** Removes all the substitutions, but keeps the capacity of the containers */
+            void Clear();
+
+            void Open(uint32_t i_depth);
+
+            bool Close(uint32_t i_depth);
+
+            /** Materializes the substitutions, in the order they were added */
+            std::vector<Substitution> GetSubstitutions() const;
+
+            std::vector<Substitution> GetSubstitutions(VariadicCaptures::MaterializeScratch & io_scratch) const;
+
+        private:
+
+            bool AddToBottomLayer(const Name & i_identifier_name, const Tensor & i_value);
+
+        private:
+            BindingEnvironment m_bindings;
+            VariadicCaptures m_variadic_captures;
         };
     
     } // namespace o2o_pattern
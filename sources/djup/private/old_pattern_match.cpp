@@ -292,7 +292,7 @@ namespace djup
                 bool some_substitution = false;
                 std::vector<Tensor> new_arguments;
 
-                const std::vector<Tensor> & arguments = i_candidate.GetExpression()->GetArguments();
+                const Span<const Tensor> arguments = i_candidate.GetExpression()->GetArguments();
                 const size_t argument_count = arguments.size();
 
                 // substitute identifiers in associative functions with AssociativeIdentifier()
@@ -305,7 +305,7 @@ namespace djup
                         const Tensor & argument = arguments[index];
                         if(IsIdentifier(argument))
                         {
-                            new_arguments = arguments;
+                            new_arguments.assign(arguments.begin(), arguments.end());
                             some_substitution = true;
                             break;
                         }
@@ -9,54 +9,102 @@
 #include <private/make_expr.h>
 #include "djup/tensor.h"
 #include <private/expression.h>
-#include <unordered_map>
+#include <private/hash_consing.h>
+#include <private/namespace.h>
+#include <core/pointer_map.h>
+#include <vector>
 
 namespace djup
 {
     namespace detail
     {
-        using ReplacementMap = std::unordered_map<
-            std::shared_ptr<const Expression>,
-            std::shared_ptr<const Expression> >;
+        /* Replacements of the nodes already visited, keyed by address. A null replacement means
+           that the node is being visited. Keys are not owned by the map, so the results of the
+           predicate are kept alive here: the arguments of a node are owned either by the source
+           or by one of these results. */
+        struct ReplacementMap
+        {
+            PointerMap<Expression, ExpressionPtr> m_replacements;
+            std::vector<Tensor> m_predicate_results;
+        };
 
         template <typename PREDICATE>
             Tensor SubstituteByPredicateImpl(const Namespace & i_namespace,
                 const Tensor & i_where,
                 const PREDICATE & i_predicate,
+                SubstitutionRebuild i_rebuild,
                 ReplacementMap & i_replacement_map)
         {
-            auto const it = i_replacement_map.find(i_where.GetExpression());
-            if(it != i_replacement_map.end())
-                return Tensor(it->second);
+            /* The predicate is applied to a node before its arguments, and then the arguments
+               of the node it returns are processed. Nodes are visited with an explicit stack, so
+               that deep expressions can't overflow the call stack. The replacements of the
+               arguments of the nodes in the stack are in results. */
+            struct StackFrame
+            {
+                const Expression * m_where;
+                Tensor m_replacement;
+                size_t m_next_argument;
+                size_t m_first_result;
+            };
+            std::vector<StackFrame> stack;
+            std::vector<Tensor> results;
 
-            Tensor replacement = i_predicate(i_where);
+            auto visit = [&](const Tensor & i_node) {
+                const Expression * where = i_node.GetExpression().get();
+                const auto [replacement, inserted] = i_replacement_map.m_replacements.TryEmplace(where);
+                if (!inserted)
+                {
+                    if (replacement == nullptr)
+                        Error("SubstituteByPredicate - Cyclic expression");
+                    results.emplace_back(replacement);
+                    return;
+                }
 
-            std::vector<Tensor> new_arguments;
-            new_arguments.reserve(replacement.GetExpression()->GetArguments().size());
-        
-            bool some_argument_replaced = false;
-            for(const Tensor & argument : replacement.GetExpression()->GetArguments())
-            {
-                new_arguments.push_back( SubstituteByPredicateImpl(i_namespace, 
-                    argument, i_predicate, i_replacement_map));
+                Tensor predicate_result = i_predicate(i_node);
+                if (predicate_result.GetExpression() != i_node.GetExpression())
+                    i_replacement_map.m_predicate_results.push_back(predicate_result);
+                stack.push_back({ where, std::move(predicate_result), 0, results.size() });
+            };
 
-                some_argument_replaced = some_argument_replaced || 
-                    new_arguments.back().GetExpression() != argument.GetExpression();
-            }
-            if(some_argument_replaced)
+            visit(i_where);
+            while (!stack.empty())
             {
-                const Expression & expr = *replacement.GetExpression();
-                replacement = MakeExpression(i_namespace,
-                    expr.GetType(), expr.GetName(), new_arguments, expr.GetMetadata());
-            }
+                StackFrame & frame = stack.back();
+                const Span<const Tensor> arguments = frame.m_replacement.GetExpression()->GetArguments();
+                if (frame.m_next_argument < arguments.size())
+                {
+                    visit(arguments[frame.m_next_argument++]);
+                    continue;
+                }
 
-            if(!i_replacement_map.insert(std::make_pair(
-                i_where.GetExpression(), replacement.GetExpression())).second)
-            {
-                Error("SubstituteByPredicate - Cyclic expression");
+                const Span<const Tensor> new_arguments(results.data() + frame.m_first_result, arguments.size());
+
+                bool some_argument_replaced = false;
+                for (size_t i = 0; i < arguments.size() && !some_argument_replaced; i++)
+                    some_argument_replaced = new_arguments[i].GetExpression() != arguments[i].GetExpression();
+
+                if (some_argument_replaced)
+                {
+                    const Expression & expr = *frame.m_replacement.GetExpression();
+                    if (i_rebuild == SubstitutionRebuild::CanonicalizeEachNode)
+                        frame.m_replacement = MakeExpression(i_namespace,
+                            expr.GetType(), expr.GetName(), new_arguments, expr.GetMetadata());
+                    else
+                        frame.m_replacement = { HashConsExpression(NewExpression(
+                            expr.GetType(), expr.GetName(), new_arguments, expr.GetMetadata())) };
+                }
+
+                *i_replacement_map.m_replacements.Find(frame.m_where) = frame.m_replacement.GetExpression();
+
+                results.resize(frame.m_first_result);
+                results.push_back(std::move(frame.m_replacement));
+                stack.pop_back();
             }
 
-            return replacement;
+            DJUP_ASSERT(results.size() == 1);
+            if (i_rebuild == SubstitutionRebuild::CanonicalizeResult)
+                return i_namespace.Canonicalize(results.back());
+            return std::move(results.back());
         }
 
     } // namespace detail
@@ -66,31 +114,35 @@ namespace djup
         For every subexpression the predicate is invoked. The predicate can return
         the its input tensor to signal that the substitution was not done, or it
         can return a tensor bound to a different expression (in this case a 
-        substitution was performed). */
+        substitution was performed). i_rebuild tells whether the rebuilt nodes are
+        canonicalized one by one, only at the end, or not at all. */
     template <typename PREDICATE>
         [[nodiscard]] Tensor SubstituteByPredicate(const Namespace & i_namespace,
-            const Tensor & i_where, const PREDICATE & i_predicate)
+            const Tensor & i_where, const PREDICATE & i_predicate,
+            SubstitutionRebuild i_rebuild = SubstitutionRebuild::CanonicalizeEachNode)
     {
         detail::ReplacementMap replacement_map;
-        return detail::SubstituteByPredicateImpl(i_namespace, i_where, i_predicate, replacement_map);
+        return detail::SubstituteByPredicateImpl(i_namespace, i_where, i_predicate, i_rebuild, replacement_map);
     }
 
     /** Tries to apply a substitution to a whole expression graph.
         The predicate must take a single tensor argument and must return tensor.
         For every subexpression the predicate is invoked. The predicate can return the
         its argument to signal that the substitution was not done, or it can return a 
-        tensor bound to a different expression (in this case a substitution was performed). */
+        tensor bound to a different expression (in this case a substitution was performed).
+        The nodes shared by more roots are rebuilt only once. */
     template <typename PREDICATE>
         [[nodiscard]] std::vector<Tensor> SubstituteByPredicate(
             const Namespace & i_namespace, Span<const Tensor> i_where,
-            const PREDICATE & i_predicate)
+            const PREDICATE & i_predicate,
+            SubstitutionRebuild i_rebuild = SubstitutionRebuild::CanonicalizeEachNode)
     {
         detail::ReplacementMap replacement_map;
 
         std::vector<Tensor> result;
         result.reserve(i_where.size());
         for(auto const & where : i_where)
-            result.push_back(detail::SubstituteByPredicateImpl(i_namespace, where, i_predicate, replacement_map));
+            result.push_back(detail::SubstituteByPredicateImpl(i_namespace, where, i_predicate, i_rebuild, replacement_map));
 
         return result;
     }
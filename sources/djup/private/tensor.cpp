@@ -17,9 +17,9 @@ namespace djup
 {
     namespace
     {
-        const std::shared_ptr<const Expression> & GetEmptyExpression()
+        const ExpressionPtr & GetEmptyExpression()
         {
-            static std::shared_ptr<const Expression> expr = std::make_shared<Expression>();
+            static ExpressionPtr expr = NewExpression();
             return expr;
         }
     }
@@ -76,7 +76,7 @@ namespace djup
 
     }
 
-    const std::shared_ptr<const Expression> & Tensor::GetExpression() const
+    const ExpressionPtr & Tensor::GetExpression() const
     { 
         if(m_expression)
             return m_expression; 
@@ -84,7 +84,7 @@ namespace djup
             Error("Trying to retrieve the expression from an empty tensor");
     }
 
-    std::shared_ptr<const Expression> Tensor::StealExpression()
+    ExpressionPtr Tensor::StealExpression()
     {
         return std::move(m_expression);
     }
@@ -5,11 +5,11 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
-#include <memory>
 #include <core/span.h>
 #include <core/numeric_cast.h>
+#include <core/intrusive_ptr.h>
 
-#ifdef _NDEBUG
+#ifdef NDEBUG
     #define DJUP_DEBUG_STRING 0
 #else
     #define DJUP_DEBUG_STRING 1
@@ -21,6 +21,12 @@ namespace djup
 
     class Expression;
 
+    void IntrusiveAddRef(const Expression * i_expression) noexcept;
+    void IntrusiveRelease(const Expression * i_expression) noexcept;
+    uint32_t IntrusiveUseCount(const Expression * i_expression) noexcept;
+
+    using ExpressionPtr = IntrusivePtr<const Expression>;
+
     class Tensor
     {
     public:
@@ -42,15 +48,15 @@ namespace djup
 
     public:
 
-        Tensor(const std::shared_ptr<const Expression> & i_expression)
+        Tensor(const ExpressionPtr & i_expression)
             : m_expression(i_expression) { }
 
-        Tensor(std::shared_ptr<const Expression> && i_expression)
+        Tensor(ExpressionPtr && i_expression)
             : m_expression(std::move(i_expression)) { }
 
-        const std::shared_ptr<const Expression> & GetExpression() const;
+        const ExpressionPtr & GetExpression() const;
 
-        std::shared_ptr<const Expression> StealExpression();
+        ExpressionPtr StealExpression();
 
     private:
 
@@ -71,7 +77,7 @@ namespace djup
         }
 
     private:
-        std::shared_ptr<const Expression> m_expression;
+        ExpressionPtr m_expression;
     };
 
     inline Tensor operator ""_t(const char * i_source, size_t i_length)
@@ -21,6 +21,9 @@ namespace djup
         void TestM2oSubstitutionBuilder();
         void O2oPattern();
         void M2oPattern();
+        void HashConsing();
+        void SubstituteByPredicate_();
+        void NamespaceAxioms();
 
         void Djup()
         {
@@ -32,8 +35,11 @@ namespace djup
             //M2oPatternInfo();
             OldPattern();
             TensorToGraph();
-            //M2oDiscriminationTree_();
-            //TestM2oSubstitutionBuilder();
+            M2oDiscriminationTree_();
+            TestM2oSubstitutionBuilder();
+            HashConsing();
+            SubstituteByPredicate_();
+            NamespaceAxioms();
             O2oPattern();
             //M2oPattern();
 
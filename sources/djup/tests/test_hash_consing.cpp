@@ -0,0 +1,76 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/hash_consing.h>
+#include <private/expression.h>
+#include <tests/test_utils.h>
+
+namespace djup
+{
+    namespace tests
+    {
+        void HashConsing()
+        {
+            Print("Test: djup - Hash Consing...");
+
+            // without hash-consing equal expressions are distinct objects
+            {
+                const Tensor first = "f(real a, g(real b, 3))"_t;
+                const Tensor second = "f(real a, g(real b, 3))"_t;
+                CORE_EXPECTS(first.GetExpression() != second.GetExpression());
+                CORE_EXPECTS(AlwaysEqual(first, second));
+            }
+
+            EnableHashConsing(true);
+            CORE_EXPECTS(IsHashConsingEnabled());
+
+            {
+                const HashConsingStats prev_stats = GetHashConsingStats();
+
+                const Tensor first = "f(real a, g(real b, 3))"_t;
+                const Tensor second = "f(real a, g(real b, 3))"_t;
+                CORE_EXPECTS(first.GetExpression() == second.GetExpression());
+                CORE_EXPECTS(AlwaysEqual(first, second));
+
+                // shared subexpressions
+                const Tensor third = "h(g(real b, 3))"_t;
+                CORE_EXPECTS(third.GetExpression()->GetArgument(0).GetExpression() ==
+                    first.GetExpression()->GetArgument(1).GetExpression());
+
+                // commutative arguments are sorted before the lookup
+                const Tensor sum_1 = "Add(real a, real b)"_t;
+                const Tensor sum_2 = "Add(real b, real a)"_t;
+                CORE_EXPECTS(sum_1.GetExpression() == sum_2.GetExpression());
+
+                // the type is part of the identity of a node
+                const Tensor int_a = "int a"_t;
+                const Tensor real_a = "real a"_t;
+                CORE_EXPECTS(int_a.GetExpression() != real_a.GetExpression());
+
+                const HashConsingStats stats = GetHashConsingStats();
+                CORE_EXPECTS(stats.m_hits > prev_stats.m_hits);
+                CORE_EXPECTS(stats.m_misses > prev_stats.m_misses);
+                CORE_EXPECTS(stats.m_expression_count > 0);
+            }
+
+            // unreferenced expressions are removed from the table
+            PurgeHashConsingTable();
+            {
+                const size_t count = GetHashConsingStats().m_expression_count;
+                const Tensor tensor = "k(real unique_identifier_1, real unique_identifier_2)"_t;
+                CORE_EXPECTS(GetHashConsingStats().m_expression_count > count);
+            }
+            PurgeHashConsingTable();
+
+            EnableHashConsing(false);
+            CORE_EXPECTS(!IsHashConsingEnabled());
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace djup
@@ -1,4 +1,3 @@
-
 //   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
 // Distributed under the Boost Software License, Version 1.0.
 //        (See accompanying file LICENSE or copy at
@@ -8,46 +7,176 @@
 #include <private/namespace.h>
 #include <private/m2o_pattern/m2o_discrimination_tree.h>
 #include <private/m2o_pattern/m2o_substitution_graph.h>
-#include <private/m2o_pattern/m2o_pattern_info.h>
 #include <tests/test_utils.h>
-#include <fstream>
-#include <filesystem>
+#include <core/to_string.h>
 
 namespace djup
 {
     namespace tests
     {
+        namespace
+        {
+            std::vector<uint32_t> MatchedIds(const m2o_pattern::DiscriminationTree & i_tree, const Tensor & i_target)
+            {
+                std::vector<uint32_t> ids;
+                for (const m2o_pattern::MatchResult & match : i_tree.FindMatches(i_target))
+                    ids.push_back(match.m_pattern_id);
+                return ids;
+            }
+
+            Tensor FindSubstitution(const m2o_pattern::MatchResult & i_match, std::string_view i_name)
+            {
+                for (const o2o_pattern::Substitution & substitution : i_match.m_substitutions)
+                    if (substitution.m_identifier_name == Name(i_name))
+                        return substitution.m_value;
+                return {};
+            }
+        }
+
         void M2oDiscriminationTree_()
         {
             Print("Test: djup - m2o DiscriminationTree...");
 
-            const std::filesystem::path artifact_path = GetArtifactPath("m2o_discrimination");
+            const Namespace & standard_namespace = *GetStandardNamespace();
+
+            m2o_pattern::DiscriminationTree tree(standard_namespace);
+            tree.AddPattern(0, "f(real x)");
+            tree.AddPattern(1, "f(real x, real x)");
+            tree.AddPattern(2, "f(real x, real y)");
+            tree.AddPattern(3, "f(1, real y)");
+            tree.AddPattern(4, "g(f(real x), 2)");
+            tree.AddPattern(5, "f(real x...)"); // matched by o2o_pattern::Pattern
+            tree.AddPattern(6, "f(real x, real y)", "false");
+            tree.AddPattern(7, "f(real x, real y)", "true");
+            for (uint32_t i = 0; i < 1000; i++)
+                tree.AddPattern(100 + i, Tensor(ToString("h", i, "(real x, 5)")));
+            tree.Compile();
+
+            CORE_EXPECTS(tree.GetPatternCount() == 1008);
+
+            // the prefix f(real x, ...) is shared
+            CORE_EXPECTS(tree.GetNodeCount() < 3 * 1000 + 20);
+
+            CORE_EXPECTS(MatchedIds(tree, "f(3)") == std::vector<uint32_t>({ 0, 5 }));
+            CORE_EXPECTS(MatchedIds(tree, "f(3, 4)") == std::vector<uint32_t>({ 2, 5, 7 }));
+            CORE_EXPECTS(MatchedIds(tree, "f(3, 3)") == std::vector<uint32_t>({ 1, 2, 5, 7 }));
+            CORE_EXPECTS(MatchedIds(tree, "f(1, 1)") == std::vector<uint32_t>({ 1, 2, 3, 5, 7 }));
+            CORE_EXPECTS(MatchedIds(tree, "f(3, 4, 5)") == std::vector<uint32_t>({ 5 }));
+            CORE_EXPECTS(MatchedIds(tree, "g(f(7), 2)") == std::vector<uint32_t>({ 4 }));
+            CORE_EXPECTS(MatchedIds(tree, "g(f(7), 3)").empty());
+            CORE_EXPECTS(MatchedIds(tree, "h517(9, 5)") == std::vector<uint32_t>({ 617 }));
+            CORE_EXPECTS(MatchedIds(tree, "h517(9, 6)").empty());
+            CORE_EXPECTS(MatchedIds(tree, "k(1)").empty());
 
-            // create or clean artifact path
-            if (std::filesystem::exists(artifact_path))
+            // substitutions
             {
-                for (auto file : std::filesystem::recursive_directory_iterator(artifact_path))
-                    if (file.is_regular_file())
-                        std::filesystem::remove(file.path());
+                const std::vector<m2o_pattern::MatchResult> matches = tree.FindMatches("f(3, 4)");
+                CORE_EXPECTS(matches.size() == 3 && matches[0].m_pattern_id == 2);
+                CORE_EXPECTS(AlwaysEqual(FindSubstitution(matches[0], "x"), "3"));
+                CORE_EXPECTS(AlwaysEqual(FindSubstitution(matches[0], "y"), "4"));
             }
-            else
             {
-                std::filesystem::create_directories(artifact_path);
+                const std::vector<m2o_pattern::MatchResult> matches = tree.FindMatches("g(f(4), 2)");
+                CORE_EXPECTS(matches.size() == 1);
+                CORE_EXPECTS(AlwaysEqual(FindSubstitution(matches[0], "x"), "4"));
             }
 
-            m2o_pattern::DiscriminationTree discrimination_net;
-            discrimination_net.AddPattern(2, "a(b(c(real d)1))");
-            static bool save_it = false;
-            if (save_it)
+            // the automaton and o2o_pattern::Pattern find the same matches, with the same multiplicity
             {
-                discrimination_net.ToGraphWiz("discrimination").SaveAsImage(artifact_path / "discr.png");
+                const Tensor patterns[] = { "f(real x)", "f(real x, real x)", "f(real x, real y)", "f(1, real y)", "g(f(real x), 2)",
+                    "Equals(real x, f(real y))", "Equals(real x, real y)", "Equals(real x, real x)", "Equals(any x, 1)",
+                    "Equals(f(real x), Equals(real x, any y))", "f(Equals(any x, any y), Equals(any y, any z))" };
+                const Tensor targets[] = { "f(3)", "f(3, 4)", "f(3, 3)", "f(1, 1)", "f(1, 2)", "g(f(1), 2)", "g(f(1, 2), 2)",
+                    "Equals(f(3), 5)", "Equals(5, f(3))", "Equals(3, 4)", "Equals(3, 3)", "Equals(1, 1)", "Equals(f(1), 1)",
+                    "Equals(Equals(2, 3), f(2))", "Equals(Equals(2, 3), f(3))", "Equals(Equals(2, 3), f(4))",
+                    "f(Equals(1, 2), Equals(2, 3))", "f(Equals(1, 2), Equals(1, 2))", "f(Equals(1, 2), Equals(3, 4))" };
+                m2o_pattern::DiscriminationTree small_tree(standard_namespace);
+                for (uint32_t i = 0; i < std::size(patterns); i++)
+                    small_tree.AddPattern(i, patterns[i]);
+                small_tree.Compile();
+                CORE_EXPECTS(small_tree.GetFallbackPatternCount() == 0);
+                for (const Tensor & target : targets)
+                {
+                    std::vector<uint32_t> expected;
+                    for (uint32_t i = 0; i < std::size(patterns); i++)
+                    {
+                        const size_t solution_count = o2o_pattern::Pattern(standard_namespace, patterns[i]).MatchAll(target, nullptr).size();
+                        expected.insert(expected.end(), solution_count, i);
+                    }
+                    CORE_EXPECTS(MatchedIds(small_tree, target) == expected);
+                }
+
+                // the arguments of commutative functions are sorted, so they are matched in any order
+                CORE_EXPECTS(MatchedIds(small_tree, "Equals(f(3), 5)") == std::vector<uint32_t>({ 5 }));
+            }
+
+            // many commutative patterns in the same automaton
+            {
+                m2o_pattern::DiscriminationTree commutative_tree(standard_namespace);
+                for (uint32_t i = 0; i < 500; i++)
+                {
+                    commutative_tree.AddPattern(i, Tensor(ToString("Equals(h", i, "(real x), any y)")));
+                    commutative_tree.AddPattern(1000 + i, Tensor(ToString("Equals(h", i, "(real x), h", i, "(real y))")));
+                }
+                commutative_tree.AddPattern(500, "Equals(real x, real x)");
+                commutative_tree.AddPattern(501, "Equals(Equals(real x, 1), h7(real y))");
+                commutative_tree.AddPattern(502, "Add(real x, 1)"); // associative, matched by o2o_pattern::Pattern
+                commutative_tree.Compile();
+
+                CORE_EXPECTS(commutative_tree.GetFallbackPatternCount() == 1);
+                CORE_EXPECTS(commutative_tree.GetNodeCount() < 5 * 500 + 20);
+
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(h17(3), 5)") == std::vector<uint32_t>({ 17 }));
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(5, h17(3))") == std::vector<uint32_t>({ 17 }));
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(h17(3), h17(4))") == std::vector<uint32_t>({ 1017, 1017 }));
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(h17(3), h17(3))") == std::vector<uint32_t>({ 1017 }));
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(h17(3), h18(3))").empty());
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(3, 3)") == std::vector<uint32_t>({ 500 }));
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Equals(3, 4)").empty());
+                CORE_EXPECTS(MatchedIds(commutative_tree, "Add(2, 1)") == std::vector<uint32_t>({ 502 }));
+
+                const std::vector<m2o_pattern::MatchResult> matches = commutative_tree.FindMatches("Equals(h7(2), Equals(4, 1))");
+                CORE_EXPECTS(matches.size() == 1 && matches[0].m_pattern_id == 501);
+                CORE_EXPECTS(AlwaysEqual(FindSubstitution(matches[0], "x"), "4"));
+                CORE_EXPECTS(AlwaysEqual(FindSubstitution(matches[0], "y"), "2"));
             }
 
-            m2o_pattern::DiscriminationTree discrimination_net1;
-            discrimination_net1.AddPattern(2, "a(b(c(real d))1)");
-            if (save_it)
+            // SubstitutionGraph, with all the solutions or only one
             {
-                discrimination_net1.ToGraphWiz("discrimination").SaveAsImage(artifact_path / "discr1.png");
+                using m2o_pattern::SubstitutionGraph;
+
+                SubstitutionGraph all_solutions(tree);
+                all_solutions.FindMatches(standard_namespace, "f(1, 1)");
+                CORE_EXPECTS_EQ(all_solutions.GetSolutionCount(), 5u);
+                CORE_EXPECTS_EQ(all_solutions.GetSolutionAt(3).m_pattern_id, 5);
+
+                // the solutions of the previous target are discarded
+                all_solutions.FindMatches(standard_namespace, "g(f(4), 2)");
+                CORE_EXPECTS_EQ(all_solutions.GetSolutionCount(), 1u);
+                const std::vector<o2o_pattern::Substitution> & substitutions =
+                    all_solutions.GetSolutionAt(0).m_substitutions.GetSubstitutions();
+                CORE_EXPECTS(substitutions.size() == 1 && AlwaysEqual(substitutions[0].m_value, "4"));
+
+                SubstitutionGraph any_solution(tree, SubstitutionGraph::SolutionType::Any);
+                size_t all_steps = 0, any_steps = 0;
+                all_solutions.FindMatches(standard_namespace, "f(1, 1)", [&] { all_steps++; });
+                any_solution.FindMatches(standard_namespace, "f(1, 1)", [&] { any_steps++; });
+                CORE_EXPECTS_EQ(any_solution.GetSolutionCount(), 1u);
+                CORE_EXPECTS(any_steps < all_steps);
+                const int32_t any_id = any_solution.GetSolutionAt(0).m_pattern_id;
+                CORE_EXPECTS(any_id == 1 || any_id == 2 || any_id == 3 || any_id == 5 || any_id == 7);
+
+                // only the o2o fallback matches
+                any_solution.FindMatches(standard_namespace, "f(3, 4, 5)");
+                CORE_EXPECTS(any_solution.GetSolutionCount() == 1 && any_solution.GetSolutionAt(0).m_pattern_id == 5);
+
+                any_solution.FindMatches(standard_namespace, "k(1)");
+                CORE_EXPECTS(any_solution.GetSolutionCount() == 0);
+
+                m2o_pattern::DiscriminationTree not_compiled(standard_namespace);
+                not_compiled.AddPattern(0, "f(real x)");
+                CORE_EXPECTS_ERROR(SubstitutionGraph(not_compiled).FindMatches(standard_namespace, "f(1)"),
+                    "SubstitutionGraph::FindMatches - the discrimination tree must be compiled after adding patterns");
             }
 
             PrintLn("successful");
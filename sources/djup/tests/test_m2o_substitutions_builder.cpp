@@ -120,7 +120,7 @@ namespace djup
                 Tensor values[] = { "Tuple(Tuple(1, 2, 3), Tuple(4, 5, 6))"_t,
                                     "Tuple(Tuple(10, 11, 12), Tuple(13, 14, 15))"_t };
 
-                for (const Substitution substitution : builder.GetSubstitutions())
+                for (const Substitution & substitution : builder.GetSubstitutions())
                 {
                     bool found = false;
                     for (const Tensor & value : values)
@@ -135,6 +135,59 @@ namespace djup
                 }
             }
 
+            // captures are checked against the previous bindings of the same identifier
+            {
+                SubstitutionsBuilder builder;
+                CORE_EXPECTS(builder.Add({ { "y", "0"_t } }));
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add({ { "x", "1"_t } }));
+                CORE_EXPECTS(builder.Add({ { "x", "2"_t } }));
+                CORE_EXPECTS(builder.Close(1));
+
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add({ { "x", "1"_t } }));
+                CORE_EXPECTS(builder.Add({ { "x", "2"_t } }));
+                CORE_EXPECTS(builder.Close(1));
+
+                CORE_EXPECTS(builder.Add({ { "x", "Tuple(1, 2)"_t } }));
+                CORE_EXPECTS(!builder.Add({ { "x", "Tuple(1, 3)"_t } }));
+                CORE_EXPECTS(builder.Add({ { "z", "3"_t } }));
+
+                // the substitutions are in the order they were added
+                const std::vector<Substitution> substitutions = builder.GetSubstitutions();
+                CORE_EXPECTS_EQ(substitutions.size(), 3u);
+                CORE_EXPECTS(substitutions[0].m_identifier_name == "y");
+                CORE_EXPECTS(substitutions[1].m_identifier_name == "x");
+                CORE_EXPECTS(AlwaysEqual(substitutions[1].m_value, "Tuple(1, 2)"_t));
+                CORE_EXPECTS(substitutions[2].m_identifier_name == "z");
+
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add({ { "x", "1"_t } }));
+                CORE_EXPECTS(!builder.Close(1));
+            }
+
+            // the o2o builder shares the same variadic captures
+            {
+                o2o_pattern::SubstitutionsBuilder builder;
+                auto const Bind = [](const Name & i_identifier_name, const Tensor & i_value) {
+                    return o2o_pattern::BindingEnvironment{}.Bind(i_identifier_name, i_value); };
+                CORE_EXPECTS(builder.Add(Bind("x", "Tuple(Tuple(1, 2), Tuple(3))"_t)));
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add(Bind("y", "1"_t)));
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add(Bind("x", "1"_t)));
+                CORE_EXPECTS(builder.Add(Bind("x", "2"_t)));
+                CORE_EXPECTS(builder.Close(1));
+                builder.Open(1);
+                CORE_EXPECTS(builder.Add(Bind("x", "3"_t)));
+                CORE_EXPECTS(builder.Close(2));
+
+                const std::vector<Substitution> substitutions = builder.GetSubstitutions();
+                CORE_EXPECTS_EQ(substitutions.size(), 2u);
+                CORE_EXPECTS(substitutions[1].m_identifier_name == "y");
+                CORE_EXPECTS(AlwaysEqual(substitutions[1].m_value, "Tuple(1)"_t));
+            }
+
             PrintLn("successful");
         }
 
@@ -0,0 +1,128 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/namespace.h>
+#include <private/make_expr.h>
+#include <private/expression.h>
+#include <tests/test_utils.h>
+
+namespace djup
+{
+    namespace tests
+    {
+        void NamespaceAxioms()
+        {
+            Print("Test: djup - Namespace axioms...");
+
+            Namespace test_namespace("Test", GetStandardNamespace());
+            test_namespace.AddSubstitutionAxiom("f(real x)", "g(x)");
+            test_namespace.AddSubstitutionAxiom("f(real x, real y)", "h(x, y)");
+            test_namespace.AddSubstitutionAxiom("k(real x)", "1");
+            test_namespace.AddSubstitutionAxiom("k(2)", "3");
+
+            // axioms are selected by the name and the argument count of the root
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("f(3)")), "g(3)");
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("f(3, 4)")), "h(3, 4)");
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("f(3, 4, 5)")), "f(3, 4, 5)");
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("m(3)")), "m(3)");
+
+            // the first axiom added has precedence
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("k(2)")), "1");
+
+            // all the nodes are canonicalized, not only the root
+            CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize("m(f(3), n(k(2)))")), "m(g(3), n(1))");
+
+            // deep expressions are canonicalized without recursion
+            {
+                const Namespace & standard_namespace = *GetStandardNamespace();
+                Tensor deep = "f(7)"_t;
+                for (int i = 0; i < 2000; i++)
+                    deep = MakeExpression(standard_namespace, {}, "m", { deep, "f(7)"_t }, {});
+                Tensor canonical = test_namespace.Canonicalize(deep);
+                for (int i = 0; i < 2000; i++)
+                {
+                    CORE_EXPECTS(NameIs(canonical, "m"));
+                    CORE_EXPECTS_EQ(ToSimplifiedString(canonical.GetExpression()->GetArgument(1)), "g(7)");
+                    canonical = canonical.GetExpression()->GetArgument(0);
+                }
+                CORE_EXPECTS_EQ(ToSimplifiedString(canonical), "g(7)");
+            }
+
+            // canonical forms are cached
+            {
+                const Tensor source = "f(5)"_t;
+                const Tensor canonical = test_namespace.Canonicalize(source);
+                const CanonicalizationCacheStats prev_stats = test_namespace.GetCanonicalizationCacheStats();
+                CORE_EXPECTS(test_namespace.Canonicalize(source).GetExpression() == canonical.GetExpression());
+                CORE_EXPECTS(test_namespace.Canonicalize(canonical).GetExpression() == canonical.GetExpression());
+                const CanonicalizationCacheStats stats = test_namespace.GetCanonicalizationCacheStats();
+                CORE_EXPECTS(stats.m_hits == prev_stats.m_hits + 2);
+                CORE_EXPECTS(stats.m_size > 0);
+
+                test_namespace.AddSubstitutionAxiom("g(real x)", "x");
+                CORE_EXPECTS(test_namespace.GetCanonicalizationCacheStats().m_size == 0);
+                CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize(source)), "5");
+            }
+
+            // the nodes of the right-hand side are canonicalized once, after the substitution
+            {
+                Namespace nested_namespace("Nested", GetStandardNamespace());
+                nested_namespace.AddSubstitutionAxiom("f(real x)", "g(x)");
+                nested_namespace.AddSubstitutionAxiom("p(real x)", "q(f(x), m(f(x), f(1)))");
+                CORE_EXPECTS_EQ(ToSimplifiedString(nested_namespace.Canonicalize("p(3)")), "q(g(3), m(g(3), g(1)))");
+
+                const o2o_pattern::SubstitutionTemplate rhs("q(f(real x), m(f(real x), f(1)))"_t);
+                const o2o_pattern::Substitution substitutions[] = { { "x", "3"_t } };
+                const Tensor each_node = rhs.Instantiate(nested_namespace, substitutions,
+                    SubstitutionRebuild::CanonicalizeEachNode);
+                const Tensor result = rhs.Instantiate(nested_namespace, substitutions,
+                    SubstitutionRebuild::CanonicalizeResult);
+                CORE_EXPECTS(AlwaysEqual(*result.GetExpression(), *each_node.GetExpression()));
+                CORE_EXPECTS_EQ(ToSimplifiedString(rhs.Instantiate(nested_namespace, substitutions,
+                    SubstitutionRebuild::Raw)), "q(f(3), m(f(3), f(1)))");
+            }
+
+            // type inference axioms
+            {
+                Namespace typed_namespace("Typed", GetStandardNamespace());
+                typed_namespace.AddTypeInferenceAxiom("Sum(int x, int y)", "int");
+                typed_namespace.AddTypeInferenceAxiom("Sum(real x, real y)", "real");
+                typed_namespace.AddTypeInferenceAxiom("Zeros(int n)", "real[n]");
+                typed_namespace.AddSubstitutionAxiom("Twice(real x)", "Sum(x, x)");
+
+                // types are inferred from the leaves to the root, and the first axiom added has precedence
+                const Tensor sum = typed_namespace.Canonicalize("Sum(Sum(1, 2), 3)");
+                CORE_EXPECTS(sum.GetExpression()->GetType() == TensorType("int"));
+                CORE_EXPECTS(sum.GetExpression()->GetArgument(0).GetExpression()->GetType() == TensorType("int"));
+                CORE_EXPECTS(typed_namespace.Canonicalize("Sum(real x, 1)").GetExpression()->GetType() == TensorType("real"));
+
+                // the shape of the type can use the identifiers of the pattern
+                CORE_EXPECTS(typed_namespace.Canonicalize("Zeros(3)").GetExpression()->GetType() ==
+                    "real[3]"_t.GetExpression()->GetType());
+
+                // the result of a substitution gets a type too
+                CORE_EXPECTS_EQ(ToSimplifiedString(typed_namespace.Canonicalize("Twice(real z)")), "real Sum(real z, real z)");
+
+                // expressions not matched by any axiom are not changed
+                CORE_EXPECTS(typed_namespace.Canonicalize("Sum(1, 2, 3)").GetExpression()->GetType().IsEmpty());
+
+                // the type is stored in the canonical expression, so it is not inferred again
+                CORE_EXPECTS(typed_namespace.Canonicalize(sum).GetExpression() == sum.GetExpression());
+
+                // an axiom added after canonicalizing is used too
+                typed_namespace.AddTypeInferenceAxiom("Sum(int x, int y, int z)", "int");
+                CORE_EXPECTS(typed_namespace.Canonicalize("Sum(1, 2, 3)").GetExpression()->GetType() == TensorType("int"));
+
+                CORE_EXPECTS_ERROR(typed_namespace.AddTypeInferenceAxiom("f(real x)", "g(x)"),
+                    "AddTypeInferenceAxiom - g(x) is not a type");
+            }
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace djup
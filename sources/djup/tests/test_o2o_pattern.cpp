@@ -7,7 +7,11 @@
 #include <private/common.h>
 #include <private/namespace.h>
 #include <private/o2o_pattern/o2o_pattern_match.h>
+#include <private/o2o_pattern/o2o_match_trace.h>
+#include <private/o2o_pattern/o2o_binding_environment.h>
+#include <private/o2o_pattern/o2o_substitution_template.h>
 #include <tests/test_utils.h>
+#include <core/thread_pool.h>
 #include <fstream>
 #include <filesystem>
 
@@ -55,6 +59,14 @@ namespace djup
                 std::vector<o2o_pattern::MatchResult> solutions = pattern.MatchAll(i_test_descr.m_target,
                     i_test_descr.m_save_graphs ? artifact_path_string.c_str() : nullptr);
 
+                // the matcher only records a trace, images are rendered from it
+                if (i_test_descr.m_save_graphs)
+                {
+                    const std::filesystem::path trace_path = artifact_path / "match.djuptrace";
+                    CORE_EXPECTS(std::filesystem::exists(trace_path));
+                    o2o_pattern::ReplayMatchTrace(trace_path, artifact_path);
+                }
+
                 CORE_EXPECTS_EQ(solutions.size(), i_test_descr.m_expected_solutions);
 
                 for (size_t solution_index = 0; solution_index < solutions.size(); ++solution_index)
@@ -78,6 +90,28 @@ namespace djup
                     }
                     CORE_EXPECTS(substitution_succesful);
                 }
+
+                // MatchOne does not build the graph, but it must find a solution if and only if MatchAll does
+                const std::optional<o2o_pattern::MatchResult> first_solution = pattern.MatchOne(i_test_descr.m_target, nullptr);
+                CORE_EXPECTS(first_solution.has_value() == !solutions.empty());
+                if (first_solution)
+                {
+                    const Tensor after_sub = o2o_pattern::ApplySubstitutions(*GetStandardNamespace(),
+                        i_test_descr.m_pattern, first_solution->m_substitutions);
+                    CORE_EXPECTS(AlwaysEqual(after_sub, i_test_descr.m_target));
+                }
+
+                // the parallel search must find the same solutions, in any order
+                static ThreadPool thread_pool(4);
+                const std::vector<o2o_pattern::MatchResult> parallel_solutions = pattern.MatchAll(
+                    i_test_descr.m_target, thread_pool);
+                CORE_EXPECTS_EQ(parallel_solutions.size(), solutions.size());
+                for (const o2o_pattern::MatchResult & solution : parallel_solutions)
+                {
+                    const Tensor after_sub = o2o_pattern::ApplySubstitutions(*GetStandardNamespace(),
+                        i_test_descr.m_pattern, solution.m_substitutions);
+                    CORE_EXPECTS(AlwaysEqual(after_sub, i_test_descr.m_target));
+                }
             }
             catch (...)
             {
@@ -473,6 +507,174 @@ namespace djup
                 O2oPatternTest(descr);
             }
 
+            // commutative functions
+            {
+                auto target = "Equals(1, 2)"_t;
+                auto pattern = "Equals(real x, real y)"_t;
+                O2oPatternTestDescr descr;
+                descr.m_test_name = "pattern_31";
+                descr.m_save_graphs = false;
+                descr.m_pattern = pattern;
+                descr.m_target = target;
+                descr.m_expected_solutions = 2;
+                O2oPatternTest(descr);
+            }
+
+            {
+                auto target = "Equals(2, 2)"_t;
+                auto pattern = "Equals(real x, real y)"_t;
+                O2oPatternTestDescr descr;
+                descr.m_test_name = "pattern_32";
+                descr.m_save_graphs = false;
+                descr.m_pattern = pattern;
+                descr.m_target = target;
+                descr.m_expected_solutions = 1; // equal targets are interchangeable
+                O2oPatternTest(descr);
+            }
+
+            {
+                auto target = "Equals(3, 1, 2)"_t;
+                auto pattern = "Equals(1, real x...)"_t;
+                O2oPatternTestDescr descr;
+                descr.m_test_name = "pattern_33";
+                descr.m_save_graphs = false;
+                descr.m_pattern = pattern;
+                descr.m_target = target;
+                descr.m_expected_solutions = 1;
+                O2oPatternTest(descr);
+            }
+
+            {
+                auto target = "Equals(Sin(5), 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, Cos(4))"_t;
+                auto pattern = "Equals(10, 9, 8, 7, 6, 5, 4, 3, 2, 1, Cos(real y), Sin(real x))"_t;
+                O2oPatternTestDescr descr;
+                descr.m_test_name = "pattern_34";
+                descr.m_save_graphs = false;
+                descr.m_pattern = pattern;
+                descr.m_target = target;
+                descr.m_expected_solutions = 1;
+                O2oPatternTest(descr);
+            }
+
+            {
+                auto target = "Equals(Sin(1), Sin(2), 3)"_t;
+                auto pattern = "Equals(Sin(real x), Sin(real y), Cos(real z))"_t;
+                O2oPatternTestDescr descr;
+                descr.m_test_name = "pattern_35";
+                descr.m_save_graphs = false;
+                descr.m_pattern = pattern;
+                descr.m_target = target;
+                descr.m_expected_solutions = 0;
+                O2oPatternTest(descr);
+            }
+
+            // binding environments share the bindings of the environments they are made from
+            {
+                const o2o_pattern::BindingEnvironment empty;
+                const o2o_pattern::BindingEnvironment x = empty.Bind("x", "1"_t);
+                const o2o_pattern::BindingEnvironment xy = x.Bind("y", "2"_t);
+                const o2o_pattern::BindingEnvironment xz = x.Bind("z", "3"_t);
+
+                CORE_EXPECTS(empty.IsEmpty() && empty.Find("x") == nullptr);
+                CORE_EXPECTS_EQ(xy.GetSize(), 2u);
+                CORE_EXPECTS(xy.Find("x") == x.Find("x"));
+                CORE_EXPECTS(xy.Find("z") == nullptr && xz.Find("y") == nullptr);
+                CORE_EXPECTS(AlwaysEqual(*xz.Find("z"), "3"_t));
+
+                const std::vector<o2o_pattern::Substitution> substitutions = xy.ToSubstitutions();
+                CORE_EXPECTS_EQ(substitutions.size(), 2u);
+                CORE_EXPECTS(substitutions[0].m_identifier_name == Name("x"));
+                CORE_EXPECTS(substitutions[1].m_identifier_name == Name("y"));
+
+                // ForEach visits the bindings in the order they were added, and can stop
+                std::vector<Name> visited;
+                CORE_EXPECTS(xy.ForEach([&](const Name & i_identifier_name, const Tensor &) {
+                    visited.push_back(i_identifier_name); return true; }));
+                CORE_EXPECTS(visited.size() == 2 && visited[0] == Name("x") && visited[1] == Name("y"));
+                CORE_EXPECTS(!xy.ForEach([](const Name & i_identifier_name, const Tensor &) {
+                    return i_identifier_name != Name("x"); }));
+
+                // long chains are released without recursion
+                o2o_pattern::BindingEnvironment long_chain;
+                for (int i = 0; i < 1'000'000; i++)
+                    long_chain = long_chain.Bind("w", "1"_t);
+                CORE_EXPECTS_EQ(long_chain.GetSize(), 1'000'000u);
+            }
+
+            // batches have the solutions of MatchAll or MatchOne for every target
+            {
+                const o2o_pattern::Pattern pattern(*GetStandardNamespace(), "f(real x..., 1, real y...)"_t);
+                const std::vector<Tensor> targets = { "f(1, 2)"_t, "g(1, 2)"_t, "f(2, 3)"_t,
+                    "f(1, 2, 1, 3, 1)"_t, "f(1)"_t, "Sin(1)"_t, "f(3, 1)"_t };
+
+                ThreadPool thread_pool(3);
+                const o2o_pattern::BatchMatchResult all = pattern.MatchBatch(targets);
+                const o2o_pattern::BatchMatchResult any = pattern.MatchBatch(targets,
+                    o2o_pattern::Pattern::SolutionType::Any);
+                const o2o_pattern::BatchMatchResult parallel_all = pattern.MatchBatch(targets,
+                    o2o_pattern::Pattern::SolutionType::All, &thread_pool);
+
+                CORE_EXPECTS_EQ(all.m_substitution_offsets.size(), all.GetSolutionCount() + 1);
+                CORE_EXPECTS(all.m_target_indices == parallel_all.m_target_indices);
+                CORE_EXPECTS(all.m_substitution_offsets == parallel_all.m_substitution_offsets);
+
+                size_t solution_index = 0, any_solution_index = 0;
+                for (uint32_t target_index = 0; target_index < targets.size(); target_index++)
+                {
+                    const std::vector<o2o_pattern::MatchResult> expected =
+                        pattern.MatchAll(targets[target_index], nullptr);
+
+                    for (const o2o_pattern::MatchResult & expected_solution : expected)
+                    {
+                        CORE_EXPECTS(solution_index < all.GetSolutionCount());
+                        CORE_EXPECTS_EQ(all.m_target_indices[solution_index], target_index);
+                        const Span<const o2o_pattern::Substitution> substitutions = all.GetSubstitutions(solution_index);
+                        CORE_EXPECTS_EQ(substitutions.size(), expected_solution.m_substitutions.size());
+                        for (size_t i = 0; i < substitutions.size(); i++)
+                        {
+                            CORE_EXPECTS(substitutions[i].m_identifier_name == expected_solution.m_substitutions[i].m_identifier_name);
+                            CORE_EXPECTS(AlwaysEqual(substitutions[i].m_value, expected_solution.m_substitutions[i].m_value));
+                        }
+                        solution_index++;
+                    }
+
+                    if (!expected.empty())
+                    {
+                        CORE_EXPECTS(any_solution_index < any.GetSolutionCount());
+                        CORE_EXPECTS_EQ(any.m_target_indices[any_solution_index], target_index);
+                        const Tensor after_sub = o2o_pattern::ApplySubstitutions(*GetStandardNamespace(),
+                            "f(real x..., 1, real y...)"_t, any.GetSubstitutions(any_solution_index));
+                        CORE_EXPECTS(AlwaysEqual(after_sub, targets[target_index]));
+                        any_solution_index++;
+                    }
+                }
+                CORE_EXPECTS_EQ(solution_index, all.GetSolutionCount());
+                CORE_EXPECTS_EQ(any_solution_index, any.GetSolutionCount());
+                CORE_EXPECTS_EQ(all.GetSolutionCount(), 6u);
+            }
+
+            // a substitution template can be instantiated many times
+            {
+                const o2o_pattern::SubstitutionTemplate substitution_template(
+                    "f(real x..., g(real y, 2), h(g(real y, 2)), 5)"_t);
+
+                const o2o_pattern::Substitution substitutions[] = {
+                    { "x", "Tuple(1, 2, 3)"_t }, { "y", "7"_t }, { "y", "8"_t } };
+
+                CORE_EXPECTS(AlwaysEqual(substitution_template.Instantiate(*GetStandardNamespace(), substitutions),
+                    "f(1, 2, 3, g(7, 2), h(g(7, 2)), 5)"_t));
+
+                // unbound variadic identifiers expand to nothing, other identifiers are left unchanged
+                CORE_EXPECTS(AlwaysEqual(substitution_template.Instantiate(*GetStandardNamespace(), {}),
+                    "f(g(real y, 2), h(g(real y, 2)), 5)"_t));
+
+                const o2o_pattern::SubstitutionTemplate nested_template("f(g(real x, real y...)...)"_t);
+                const o2o_pattern::Substitution nested_substitutions[] = {
+                    { "x", "Tuple(1, 2)"_t }, { "y", "Tuple(Tuple(3), Tuple(4, 5))"_t } };
+                CORE_EXPECTS(AlwaysEqual(nested_template.Instantiate(*GetStandardNamespace(), nested_substitutions),
+                    "f(g(1, 3), g(2, 4, 5))"_t));
+            }
+
             PrintLn("successful");
         }
 
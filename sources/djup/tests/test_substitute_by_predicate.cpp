@@ -0,0 +1,134 @@
+
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <private/common.h>
+#include <private/substitute_by_predicate.h>
+#include <private/namespace.h>
+#include <private/o2o_pattern/o2o_pattern_match.h>
+#include <tests/test_utils.h>
+
+namespace djup
+{
+    namespace tests
+    {
+        void SubstituteByPredicate_()
+        {
+            Print("Test: djup - SubstituteByPredicate...");
+
+            const Namespace & standard_namespace = *GetStandardNamespace();
+
+            auto const replace_x = [](const Tensor & i_tensor) {
+                return NameIs(i_tensor, "x") ? "2"_t : i_tensor;
+            };
+
+            {
+                const Tensor source = "f(g(real x, 1), g(real x, 1), h(real y))"_t;
+                const Tensor result = SubstituteByPredicate(standard_namespace, source, replace_x);
+                CORE_EXPECTS(AlwaysEqual(result, "f(g(2, 1), g(2, 1), h(real y))"_t));
+
+                // subexpressions without substitutions are not rebuilt
+                CORE_EXPECTS(result.GetExpression()->GetArgument(2).GetExpression() ==
+                    source.GetExpression()->GetArgument(2).GetExpression());
+
+                const Tensor unchanged = SubstituteByPredicate(standard_namespace, source,
+                    [](const Tensor & i_tensor) { return i_tensor; });
+                CORE_EXPECTS(unchanged.GetExpression() == source.GetExpression());
+            }
+
+            // the arguments of the result of the predicate are substituted too
+            {
+                const Tensor result = SubstituteByPredicate(standard_namespace, "f(real z)"_t,
+                    [](const Tensor & i_tensor) { return NameIs(i_tensor, "z") ? "g(real x)"_t : i_tensor; });
+                CORE_EXPECTS(AlwaysEqual(SubstituteByPredicate(standard_namespace, result, replace_x), "f(g(2))"_t));
+            }
+
+            // long chains are processed without recursion
+            {
+                Tensor chain = "real x"_t;
+                for (int i = 0; i < 1'000; i++)
+                    chain = MakeExpression(standard_namespace, {}, "f", { chain }, {});
+
+                const Tensor result = SubstituteByPredicate(standard_namespace, chain, replace_x);
+                const Tensor * node = &result;
+                int depth = 0;
+                for (; NameIs(*node, "f"); depth++)
+                    node = &node->GetExpression()->GetArgument(0);
+                CORE_EXPECTS_EQ(depth, 1'000);
+                CORE_EXPECTS(AlwaysEqual(*node, "2"_t));
+            }
+
+            // chains close to a million levels are built, substituted and released without recursion
+            {
+                constexpr int depth = 1'000'000;
+                Tensor chain = "real x"_t;
+                for (int i = 0; i < depth; i++)
+                    chain = MakeExpression(standard_namespace, {}, "f", { chain }, {});
+
+                Tensor result = SubstituteByPredicate(standard_namespace, chain, replace_x);
+                chain = {};
+                const Tensor * node = &result;
+                int result_depth = 0;
+                for (; NameIs(*node, "f"); result_depth++)
+                    node = &node->GetExpression()->GetArgument(0);
+                CORE_EXPECTS_EQ(result_depth, depth);
+                CORE_EXPECTS(AlwaysEqual(*node, "2"_t));
+                result = {};
+            }
+
+            // ApplySubstitutions compiles and instantiates deep expressions without recursion
+            {
+                Tensor chain = "g(real x, real y...)"_t;
+                for (int i = 0; i < 2'000; i++)
+                    chain = MakeExpression(standard_namespace, {}, "f", { chain, "h(real x)"_t }, {});
+
+                const o2o_pattern::Substitution substitutions[] = {
+                    { "x", "2"_t }, { "y", "Tuple(3, 4)"_t } };
+                const Tensor result = o2o_pattern::ApplySubstitutions(standard_namespace, chain, substitutions);
+                const Tensor * node = &result;
+                int depth = 0;
+                for (; NameIs(*node, "f"); depth++)
+                {
+                    CORE_EXPECTS(AlwaysEqual(node->GetExpression()->GetArgument(1), "h(2)"_t));
+                    node = &node->GetExpression()->GetArgument(0);
+                }
+                CORE_EXPECTS_EQ(depth, 2'000);
+                CORE_EXPECTS(AlwaysEqual(*node, "g(2, 3, 4)"_t));
+            }
+
+            // a predicate that makes a node an argument of itself
+            {
+                const Tensor x = "real x"_t;
+                const Tensor g_of_x = MakeExpression(standard_namespace, {}, "g", { x }, {});
+                CORE_EXPECTS_ERROR(SubstituteByPredicate(standard_namespace,
+                    MakeExpression(standard_namespace, {}, "f", { x }, {}), [&](const Tensor & i_tensor) {
+                        return i_tensor.GetExpression() == x.GetExpression() ? g_of_x : i_tensor; }),
+                    "SubstituteByPredicate - Cyclic expression");
+            }
+
+            // rebuilt nodes can be canonicalized one by one, only at the end, or not at all
+            {
+                Namespace test_namespace("Test", GetStandardNamespace());
+                test_namespace.AddSubstitutionAxiom("f(real x)", "g(x)");
+
+                const Tensor source = "h(f(real x), f(real x), k(real y))"_t;
+                const Tensor each_node = SubstituteByPredicate(test_namespace, source, replace_x);
+                const Tensor at_end = SubstituteByPredicate(test_namespace, source, replace_x,
+                    SubstitutionRebuild::CanonicalizeResult);
+                const Tensor raw = SubstituteByPredicate(test_namespace, source, replace_x,
+                    SubstitutionRebuild::Raw);
+
+                CORE_EXPECTS_EQ(ToSimplifiedString(each_node), "h(g(2), g(2), k(real y))");
+                CORE_EXPECTS_EQ(ToSimplifiedString(at_end), "h(g(2), g(2), k(real y))");
+                CORE_EXPECTS_EQ(ToSimplifiedString(raw), "h(f(2), f(2), k(real y))");
+                CORE_EXPECTS_EQ(ToSimplifiedString(test_namespace.Canonicalize(raw)), "h(g(2), g(2), k(real y))");
+            }
+
+            PrintLn("successful");
+        }
+
+    } // namespace tests
+
+} // namespace djup
@@ -19,8 +19,9 @@ namespace djup
 
             Tensor a("real a");
             Tensor b("real b");
+            // arguments of commutative functions are sorted by name
             CORE_EXPECTS_EQ(ToSimplifiedString(a + b * 2), 
-                "Add(real a, Mul(2, real b))");
+                "Add(Mul(2, real b), real a)");
 
             auto s = ToSimplifiedString("0 * real");
             CORE_EXPECTS(s == "Mul(0, real)"); 
@@ -34,6 +35,11 @@ namespace djup
             auto s3 = ToSimplifiedString("g((4 a)...)");
             CORE_EXPECTS(s3 == "g((4, a)...)");
 
+            // integer literals of any length
+            CORE_EXPECTS_EQ(ToSimplifiedString(Tensor(12345)), "12345");
+            CORE_EXPECTS_EQ(ToSimplifiedString(Tensor(std::numeric_limits<int64_t>::min())),
+                "-9223372036854775808");
+
             auto s4 = R"(
                 (4 + 6) * (1 -5 * -4*1)
             )"_t;
@@ -0,0 +1,43 @@
+//   Copyright Giuseppe Campana (giu.campana@gmail.com) 2021-2025.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <filesystem>
+#include <exception>
+#include <iostream>
+
+namespace djup
+{
+    namespace o2o_pattern
+    {
+        void ReplayMatchTrace(const std::filesystem::path & i_trace_path,
+            const std::filesystem::path & i_dest_dir);
+    }
+}
+
+/* Renders the images of a substitution graph from a trace saved while matching. For example:
+    djup_trace_replay artifacts/test_o2opattern/pattern_9/match.djuptrace images
+   If the destination directory is omitted, the images are saved beside the trace. */
+int main(int argc, char ** argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        std::cerr << "Usage: djup_trace_replay <trace file> [destination directory]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        const std::filesystem::path trace_path = argv[1];
+        const std::filesystem::path dest_dir = argc == 3 ? argv[2] : trace_path.parent_path();
+        std::filesystem::create_directories(dest_dir);
+        djup::o2o_pattern::ReplayMatchTrace(trace_path, dest_dir);
+        return 0;
+    }
+    catch (const std::exception & i_exception)
+    {
+        std::cerr << "Error: " << i_exception.what() << std::endl;
+        return 1;
+    }
+}